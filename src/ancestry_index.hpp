@@ -0,0 +1,145 @@
+/**
+ * @file ancestry_index.hpp
+ * @brief Root, depth, parent and lowest-common-ancestor queries in constant time.
+ *
+ * Child links only point downwards, so finding the assembly a scale belongs to would
+ * otherwise need a scan of the whole graph. The index is built in one pass after parsing:
+ * an iterative Euler tour of every tree records each scale's parent, depth, root and
+ * first tour position, and a sparse table of range minima over the tour's depths turns
+ * a lowest-common-ancestor query into two table reads.
+ *
+ * A scale hanging from several parents is attached to the first one reached by the tour,
+ * and scales only reachable through a cycle become roots of their own trees.
+ */
+
+#pragma once
+
+#include "shape_profile.hpp"
+
+#include <bit>
+#include <optional>
+
+/**
+ * @brief Constant-time ancestry queries over a scale graph, by scale index.
+ */
+class ancestry_index {
+public:
+    static constexpr std::uint32_t no_parent{~std::uint32_t{0}}; ///< Parent of a root.
+
+    ancestry_index() = default;
+
+    /**
+     * @brief Builds the index in O(N log N) time and space.
+     * @param links The child links from link_scales().
+     */
+    explicit ancestry_index(const scale_links& links) {
+        const auto n = links.size();
+        parent_.assign(n, no_parent);
+        depth_.assign(n, 0);
+        root_.assign(n, no_parent);
+        first_.assign(n, 0);
+        euler_.reserve(2 * n);
+
+        std::vector<std::uint8_t> has_parent(n, 0);
+        for (const auto child : links.side_child) {
+            if (child != scale_links::no_child) has_parent[child] = 1;
+        }
+        for (std::uint32_t i = 0; i < n; ++i) {
+            if (!has_parent[i]) tour(links, i);
+        }
+        for (std::uint32_t i = 0; i < n; ++i) {
+            if (root_[i] == no_parent) tour(links, i); // only reachable through a cycle
+        }
+        build_sparse_table();
+    }
+
+    /// @brief Number of indexed scales.
+    [[nodiscard]] std::size_t size() const { return parent_.size(); }
+
+    /// @brief The scale @p node hangs from, or no_parent for a root.
+    [[nodiscard]] std::uint32_t parent(std::uint32_t node) const { return parent_[node]; }
+
+    /// @brief Distance of @p node from its root; roots have depth 0.
+    [[nodiscard]] std::uint32_t depth(std::uint32_t node) const { return depth_[node]; }
+
+    /// @brief The top-level scale of the tree containing @p node.
+    [[nodiscard]] std::uint32_t root(std::uint32_t node) const { return root_[node]; }
+
+    /**
+     * @brief The deepest scale that has both @p a and @p b in its subtree.
+     * @return The common ancestor, or std::nullopt if they belong to different trees.
+     */
+    [[nodiscard]] std::optional<std::uint32_t> lca(std::uint32_t a, std::uint32_t b) const {
+        if (root_[a] != root_[b]) return std::nullopt;
+        auto l = first_[a];
+        auto r = first_[b];
+        if (l > r) std::swap(l, r);
+        const auto k = static_cast<std::size_t>(std::bit_width(r - l + 1) - 1);
+        return euler_[shallower(table_[k][l], table_[k][r + 1 - (std::uint32_t{1} << k)])];
+    }
+
+private:
+    void tour(const scale_links& links, std::uint32_t root) {
+        // Each stack entry is a scale and the index of the next side to descend into.
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> stack{{root, 0}};
+        visit(root, no_parent, root);
+        while (!stack.empty()) {
+            auto& [node, side] = stack.back();
+            const auto children = links.children(node);
+            if (side == children.size()) {
+                stack.pop_back();
+                if (!stack.empty()) euler_.push_back(stack.back().first);
+                continue;
+            }
+            const auto child = children[side++];
+            if (child != scale_links::no_child && root_[child] == no_parent) {
+                visit(child, node, root);
+                stack.emplace_back(child, 0);
+            }
+        }
+    }
+
+    void visit(std::uint32_t node, std::uint32_t parent, std::uint32_t root) {
+        parent_[node] = parent;
+        depth_[node] = parent == no_parent ? 0 : depth_[parent] + 1;
+        root_[node] = root;
+        first_[node] = static_cast<std::uint32_t>(euler_.size());
+        euler_.push_back(node);
+    }
+
+    [[nodiscard]] std::uint32_t shallower(std::uint32_t i, std::uint32_t j) const {
+        return depth_[euler_[i]] <= depth_[euler_[j]] ? i : j;
+    }
+
+    void build_sparse_table() {
+        const auto m = euler_.size();
+        table_.clear();
+        if (m == 0) return;
+        auto& base = table_.emplace_back(m);
+        for (std::uint32_t i = 0; i < m; ++i) base[i] = i;
+        for (std::size_t k = 1; (std::size_t{1} << k) <= m; ++k) {
+            const auto& prev = table_[k - 1];
+            const auto half = std::size_t{1} << (k - 1);
+            std::vector<std::uint32_t> row(m - (std::size_t{1} << k) + 1);
+            for (std::size_t i = 0; i < row.size(); ++i) row[i] = shallower(prev[i], prev[i + half]);
+            table_.push_back(std::move(row));
+        }
+    }
+
+    std::vector<std::uint32_t> parent_;
+    std::vector<std::uint32_t> depth_;
+    std::vector<std::uint32_t> root_;
+    std::vector<std::uint32_t> first_;              ///< First tour position of each scale.
+    std::vector<std::uint32_t> euler_;              ///< Scales in Euler tour order.
+    std::vector<std::vector<std::uint32_t>> table_; ///< table_[k][i]: shallowest tour position in [i, i + 2^k).
+};
+
+/**
+ * @brief Maps every scale name to its index in the scales list.
+ */
+inline std::unordered_map<std::string_view, std::uint32_t> index_by_name(std::span<const scale_wrapper> scales_list) {
+    std::unordered_map<std::string_view, std::uint32_t> index;
+    index.reserve(scales_list.size());
+    for (std::uint32_t i = 0; i < scales_list.size(); ++i) index.emplace(scales_list[i]->name, i);
+    return index;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file change_feed.hpp
+ * @brief Change subscriptions: pushed, coalesced records of the scales edits touch.
+ *
+ * Subscribers watch single scales, whole subtrees (a scale and everything hanging below
+ * it) or everything. After each edit, the server hands the graph's change journal to a
+ * change_hub, which renders one record per touched scale for every subscriber watching
+ * it:
+ *     CHANGE name,balance,balance...   the scale's current report row
+ *     REMOVED name                     the scale was removed
+ * Records wait for a coalescing window; a scale touched again within the window only
+ * replaces its pending record, so each subscriber receives at most one record per scale
+ * per window, in the order the scales were first touched. Broadcasts such as `RELOADED`
+ * are never coalesced and split the window: later records follow them. With a zero window,
+ * the editor flushes right after the edit, once it has released the graph.
+ *
+ * Matching costs O(depth) name lookups per touched scale, the same order as the
+ * rebalancing walk that touched it, and nothing at all while nobody subscribes. A removed
+ * scale reaches the subscribers watching it or a subtree it hung in when it was removed.
+ */
+
+#pragma once
+
+#include "scale_graph.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * @brief Routes the changes of a scale graph to subscribers, coalesced per window.
+ *
+ * All members may be called from any thread. Sinks are called one batch at a time, from
+ * the thread that flushes: the hub's own thread once a window has passed, or whoever calls
+ * flush().
+ */
+class change_hub {
+public:
+    /// @brief Receives a batch of records, each a line without its newline.
+    using sink = std::function<void(std::span<const std::string> records)>;
+
+    /**
+     * @param window How long records wait to be coalesced; zero delivers after each edit.
+     */
+    explicit change_hub(std::chrono::milliseconds window = {}) : window_{window} {
+        if (window_.count() > 0) flusher_ = std::jthread{[this](std::stop_token stop) { run(stop); }};
+    }
+
+    change_hub(const change_hub&) = delete;
+    change_hub& operator=(const change_hub&) = delete;
+
+    ~change_hub() {
+        if (flusher_.joinable()) {
+            flusher_.request_stop();
+            wake_.notify_all();
+            flusher_.join();
+        }
+        flush();
+    }
+
+    /// @brief The coalescing window.
+    [[nodiscard]] std::chrono::milliseconds window() const { return window_; }
+
+    /// @brief True while some subscriber is connected.
+    [[nodiscard]] bool active() const {
+        std::lock_guard lock{mutex_};
+        return !subscribers_.empty();
+    }
+
+    /**
+     * @brief Registers a subscriber that watches nothing yet.
+     * @return Its id.
+     */
+    std::uint32_t connect(sink deliver) {
+        std::lock_guard lock{mutex_};
+        const auto id = next_id_++;
+        subscribers_[id].deliver = std::move(deliver);
+        return id;
+    }
+
+    /**
+     * @brief Delivers the subscriber's pending records, then removes it.
+     */
+    void disconnect(std::uint32_t id) {
+        flush();
+        std::lock_guard delivering{deliver_mutex_};
+        std::lock_guard lock{mutex_};
+        for (auto& [name, watchers] : by_name_) watchers.erase(id);
+        std::erase_if(by_name_, [](const auto& entry) { return entry.second.empty(); });
+        subscribers_.erase(id);
+    }
+
+    /**
+     * @brief Makes subscriber @p id watch the scale @p name, or its whole subtree.
+     *
+     * The name need not exist yet; watching starts when a scale of that name is touched.
+     * @return False if there is no such subscriber.
+     */
+    bool watch(std::uint32_t id, const std::string& name, bool subtree) {
+        std::lock_guard lock{mutex_};
+        if (!subscribers_.contains(id)) return false;
+        by_name_[name][id] = subtree || by_name_[name][id];
+        return true;
+    }
+
+    /**
+     * @brief Stops subscriber @p id watching @p name.
+     * @return False if it did not watch it.
+     */
+    bool unwatch(std::uint32_t id, const std::string& name) {
+        std::lock_guard lock{mutex_};
+        const auto it = by_name_.find(name);
+        if (it == by_name_.end() || !it->second.erase(id)) return false;
+        if (it->second.empty()) by_name_.erase(it);
+        return true;
+    }
+
+    /**
+     * @brief Makes subscriber @p id receive the changes of every scale, or stop doing so.
+     * @return False if there is no such subscriber, or it already was in that state.
+     */
+    bool watch_all(std::uint32_t id, bool on = true) {
+        std::lock_guard lock{mutex_};
+        const auto it = subscribers_.find(id);
+        if (it == subscribers_.end() || it->second.everything == on) return false;
+        it->second.everything = on;
+        return true;
+    }
+
+    /**
+     * @brief Appends every change, prefixed with its delivery time in Unix milliseconds, to
+     *        a change-data-capture file.
+     * @return False if the file cannot be opened.
+     */
+    bool capture_to(const std::string& path) {
+        auto file = std::make_shared<std::ofstream>(path, std::ios::app);
+        if (!*file) return false;
+        watch_all(connect([file](std::span<const std::string> records) {
+            const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            for (const auto& record : records) *file << now << ' ' << record << '\n';
+            file->flush();
+        }));
+        return true;
+    }
+
+    /**
+     * @brief Queues records for the scales in @p changes; call after each edit, while the
+     *        graph cannot change.
+     *
+     * With a zero window nothing flushes on its own; call flush() afterwards, outside any
+     * lock the sinks might need.
+     * @param graph The edited graph.
+     * @param changes Its journal, from scale_graph::take_changes().
+     */
+    void collect(const scale_graph& graph, const scale_graph::changes& changes) {
+        {
+            std::lock_guard lock{mutex_};
+            if (subscribers_.empty() || (changes.touched.empty() && changes.removed.empty())) return;
+
+            std::vector<std::uint32_t> interested;
+            for (const auto index : changes.touched) {
+                interested_in(graph, index, interested);
+                if (interested.empty()) continue;
+                std::ostringstream row;
+                row << "CHANGE ";
+                report_scale(row, graph.scale(index), graph.format());
+                auto record = std::move(row).str();
+                record.pop_back(); // the newline
+                queue(interested, graph.scale(index).name, record);
+            }
+            for (const auto& [name, parent] : changes.removed) {
+                // A parent removed in the same batch has no links left to walk
+                const auto live = parent != scale_graph::no_scale && graph.scales()[parent];
+                interested_in(graph, live ? parent : scale_graph::no_scale, interested, name);
+                if (!interested.empty()) queue(interested, name, "REMOVED " + name);
+            }
+            if (pending_since_ == clock::time_point{} && has_pending()) pending_since_ = clock::now();
+        }
+        if (window_.count() > 0) wake_.notify_all();
+    }
+
+    /**
+     * @brief Queues @p record for every subscriber, whatever it watches.
+     *
+     * A broadcast is never coalesced, whatever its text, and records queued after it start
+     * afresh instead of replacing earlier ones, so they are delivered after it.
+     */
+    void broadcast(const std::string& record) {
+        {
+            std::lock_guard lock{mutex_};
+            std::vector<std::uint32_t> ids;
+            for (const auto& [id, subscriber] : subscribers_) ids.push_back(id);
+            if (ids.empty()) return;
+            for (const auto id : ids) {
+                auto& subscriber = subscribers_[id];
+                subscriber.records.push_back(record);
+                subscriber.slot.clear();
+            }
+            if (pending_since_ == clock::time_point{}) pending_since_ = clock::now();
+        }
+        if (window_.count() > 0) wake_.notify_all();
+    }
+
+    /**
+     * @brief Delivers all pending records now.
+     */
+    void flush() {
+        std::lock_guard delivering{deliver_mutex_};
+        std::vector<std::pair<sink*, std::vector<std::string>>> batches;
+        {
+            std::lock_guard lock{mutex_};
+            for (auto& [id, subscriber] : subscribers_) {
+                if (subscriber.records.empty()) continue;
+                batches.emplace_back(&subscriber.deliver, std::move(subscriber.records));
+                subscriber.records.clear();
+                subscriber.slot.clear();
+            }
+            pending_since_ = {};
+        }
+        // Sinks run without the hub lock, so they may take their own locks; the delivery
+        // lock keeps batches in order and the subscribers alive.
+        for (auto& [deliver, records] : batches) (*deliver)(records);
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct string_hash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+
+    struct subscriber {
+        sink deliver;
+        bool everything{};                                  ///< Watches every scale.
+        std::vector<std::string> records;                   ///< Pending records, in first-touch order.
+        std::unordered_map<std::string, std::size_t> slot;  ///< Scale name -> its pending record.
+    };
+
+    [[nodiscard]] bool has_pending() const {
+        return std::ranges::any_of(subscribers_, [](const auto& entry) { return !entry.second.records.empty(); });
+    }
+
+    /**
+     * Collects into @p ids the subscribers watching everything, the scale @p name, or a
+     * subtree holding it; @p parent starts the walk up, and is the scale itself if @p name
+     * is empty.
+     */
+    void interested_in(const scale_graph& graph, std::uint32_t parent, std::vector<std::uint32_t>& ids,
+                       std::string_view name = {}) const {
+        ids.clear();
+        for (const auto& [id, subscriber] : subscribers_) {
+            if (subscriber.everything) ids.push_back(id);
+        }
+        if (!by_name_.empty()) {
+            auto add_watchers = [&](std::string_view watched, bool self) {
+                const auto it = by_name_.find(watched);
+                if (it == by_name_.end()) return;
+                for (const auto& [id, subtree] : it->second) {
+                    if (self || subtree) ids.push_back(id);
+                }
+            };
+            bool self = name.empty();
+            if (!self) add_watchers(name, true);
+            for (auto node = parent; node != scale_graph::no_scale; node = graph.parent(node).parent, self = false) {
+                add_watchers(graph.scale(node).name, self);
+            }
+        }
+        std::ranges::sort(ids);
+        ids.erase(std::ranges::unique(ids).begin(), ids.end());
+    }
+
+    /// Queues @p record for @p name with each subscriber, replacing a pending one.
+    void queue(std::span<const std::uint32_t> ids, const std::string& name, const std::string& record) {
+        for (const auto id : ids) {
+            auto& subscriber = subscribers_[id];
+            const auto [it, added] = subscriber.slot.try_emplace(name, subscriber.records.size());
+            if (added) subscriber.records.push_back(record);
+            else subscriber.records[it->second] = record;
+        }
+    }
+
+    /// Flusher loop: delivers the pending records once they are a window old.
+    void run(std::stop_token stop) {
+        std::unique_lock lock{mutex_};
+        while (!stop.stop_requested()) {
+            if (pending_since_ == clock::time_point{}) {
+                wake_.wait(lock, stop, [&] { return pending_since_ != clock::time_point{}; });
+                continue;
+            }
+            if (const auto due = pending_since_ + window_; clock::now() < due) {
+                wake_.wait_until(lock, stop, due, [] { return false; });
+                continue;
+            }
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+    std::chrono::milliseconds window_;
+    std::mutex deliver_mutex_; ///< Held while batches are delivered; taken before mutex_.
+    mutable std::mutex mutex_; ///< Guards everything below.
+    std::condition_variable_any wake_;
+    std::uint32_t next_id_{1};
+    std::map<std::uint32_t, subscriber> subscribers_;
+    /// Watched name -> subscriber id -> whether it watches the subtree.
+    std::unordered_map<std::string, std::map<std::uint32_t, bool>, string_hash, std::equal_to<>> by_name_;
+    clock::time_point pending_since_{}; ///< First pending record, if any.
+    std::jthread flusher_;
+};
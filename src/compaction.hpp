@@ -0,0 +1,59 @@
+/**
+ * @file compaction.hpp
+ * @brief Relocation of a scale graph into one contiguous, balancing-ordered arena.
+ *
+ * Scales created one by one live wherever the allocator put them, and in a long-lived
+ * graph that keeps being edited they drift further apart. Compaction copies every scale
+ * into a single array laid out in bottom-up balancing order, so the engines sweep memory
+ * front to back, and re-points all child links at the copies. The scales are handed out
+ * through aliasing shared pointers that share ownership of the arena, which therefore
+ * lives exactly as long as any of its scales is referenced.
+ *
+ * compact_scales() only reads the source graph and returns a new list, so it can run on a
+ * background thread while readers keep using the old graph; the caller swaps the lists
+ * once it returns.
+ */
+
+#pragma once
+
+#include "shape_profile.hpp"
+
+/**
+ * @brief Contiguous storage shared by all scales of a compacted graph.
+ */
+struct scale_arena {
+    std::vector<Scale> scales; ///< The scales, in bottom-up balancing order.
+};
+
+/**
+ * @brief Copies a graph into a fresh arena laid out in balancing order.
+ * @param scales_list The scales to relocate, in output order.
+ * @return The relocated scales, in the same output order.
+ */
+inline std::vector<scale_wrapper> compact_scales(std::span<const scale_wrapper> scales_list) {
+    const auto links = link_scales(scales_list);
+    const auto shape = profile_shape(links);
+
+    auto arena = std::make_shared<scale_arena>();
+    arena->scales.reserve(scales_list.size());
+    std::vector<std::uint32_t> slot(scales_list.size());
+    for (const auto i : shape.order) {
+        slot[i] = static_cast<std::uint32_t>(arena->scales.size());
+        arena->scales.push_back(*scales_list[i]);
+    }
+
+    std::vector<scale_wrapper> compacted(scales_list.size());
+    for (std::size_t i = 0; i < scales_list.size(); ++i) {
+        compacted[i] = scale_wrapper{arena, &arena->scales[slot[i]]};
+    }
+    for (std::size_t i = 0; i < scales_list.size(); ++i) {
+        auto& scale = *compacted[i];
+        const auto children = links.children(i);
+        for (std::size_t side = 0; side < children.size(); ++side) {
+            if (children[side] != scale_links::no_child) {
+                scale.side(side) = std::weak_ptr<Scale>{compacted[children[side]]};
+            }
+        }
+    }
+    return compacted;
+}
@@ -0,0 +1,408 @@
+/**
+ * @file engine.hpp
+ * @brief Balancing engines and the cost model that picks one from a shape profile.
+ *
+ * Two engines are available:
+ * - sequential: balances the scales level by level on the calling thread.
+ * - level_parallel: balances each level with a pool of threads, synchronising on a barrier
+ *   between levels. It pays off for wide, shallow graphs and loses on deep chains, where
+ *   every level holds a single scale and the barrier cost dominates.
+ *
+ * A scale held by more than one side gets its counterweight written by each of them, and
+ * the report shows the last write; only the sequential order makes that write the same on
+ * every run, so such graphs always run on the sequential engine.
+ *
+ * The cost model predicts the run time of each engine and thread count from the profile's
+ * width histogram. Its coefficients have portable defaults and can be fitted to the
+ * current machine with calibrate_cost_model().
+ */
+
+#pragma once
+
+#include "shape_profile.hpp"
+
+#include <barrier>
+#include <chrono>
+#include <istream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <thread>
+
+/**
+ * @brief The available balancing engines.
+ */
+enum class balance_engine {
+    automatic,      ///< Let the cost model decide.
+    sequential,     ///< Single-threaded, level by level.
+    level_parallel, ///< Level-synchronous with a thread pool.
+};
+
+/**
+ * @brief Returns the command line name of an engine.
+ */
+constexpr std::string_view engine_name(balance_engine engine) {
+    switch (engine) {
+        case balance_engine::sequential: return "sequential";
+        case balance_engine::level_parallel: return "level";
+        default: return "auto";
+    }
+}
+
+/**
+ * @brief Parses an engine name as accepted by `--engine`.
+ */
+inline std::optional<balance_engine> parse_engine(std::string_view name) {
+    for (const auto engine : {balance_engine::automatic, balance_engine::sequential, balance_engine::level_parallel}) {
+        if (engine_name(engine) == name) return engine;
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief An engine together with the number of threads to run it on.
+ */
+struct engine_choice {
+    balance_engine engine{balance_engine::sequential}; ///< Engine to run.
+    unsigned threads{1};                               ///< Worker threads, including the caller.
+    double predicted_ns{};                             ///< Cost model estimate of the run time.
+};
+
+/**
+ * @brief Linear cost model of the balancing engines.
+ */
+struct cost_model {
+    double node_ns{20.0};            ///< Time to balance one scale.
+    double level_sync_ns{1500.0};    ///< Time for all threads to pass a barrier.
+    double thread_start_ns{30000.0}; ///< Time to start and join one worker thread.
+
+    /**
+     * @brief Predicts the balancing time of an engine on a graph.
+     * @param shape The graph's shape profile.
+     * @param engine Engine to predict; automatic is treated as sequential.
+     * @param threads Number of threads for the parallel engine.
+     * @return Predicted time in nanoseconds.
+     */
+    [[nodiscard]] double predict(const shape_profile& shape, balance_engine engine, unsigned threads) const {
+        if (engine != balance_engine::level_parallel || threads <= 1) {
+            return node_ns * static_cast<double>(shape.node_count);
+        }
+        double ns = thread_start_ns * (threads - 1);
+        for (const auto w : shape.width) {
+            ns += node_ns * static_cast<double>((w + threads - 1) / threads) + level_sync_ns;
+        }
+        return ns;
+    }
+
+    /**
+     * @brief Writes the coefficients as `key value` lines.
+     */
+    void save(std::ostream& os) const {
+        os << "node_ns " << node_ns << '\n'
+           << "level_sync_ns " << level_sync_ns << '\n'
+           << "thread_start_ns " << thread_start_ns << '\n';
+    }
+
+    /**
+     * @brief Reads coefficients written by save(); unknown keys are ignored.
+     * @return The model, or std::nullopt if the stream held no valid coefficient.
+     */
+    static std::optional<cost_model> load(std::istream& is) {
+        cost_model model;
+        bool any = false;
+        std::string key;
+        double value{};
+        while (is >> key >> value) {
+            if (value < 0) return std::nullopt;
+            if (key == "node_ns") model.node_ns = value, any = true;
+            else if (key == "level_sync_ns") model.level_sync_ns = value, any = true;
+            else if (key == "thread_start_ns") model.thread_start_ns = value, any = true;
+        }
+        return any ? std::optional{model} : std::nullopt;
+    }
+};
+
+/**
+ * @brief Picks the cheapest engine and thread count for a graph.
+ *
+ * Graphs with shared children are left to visit_levels(), which runs them in the
+ * sequential order whatever was chosen.
+ * @param shape The graph's shape profile.
+ * @param model The cost model.
+ * @param max_threads Upper bound on the thread count.
+ * @return The cheapest choice according to the model.
+ */
+inline engine_choice choose_engine(const shape_profile& shape, const cost_model& model, unsigned max_threads) {
+    engine_choice best{balance_engine::sequential, 1, model.predict(shape, balance_engine::sequential, 1)};
+    for (unsigned threads = 2; threads <= max_threads; ++threads) {
+        const auto ns = model.predict(shape, balance_engine::level_parallel, threads);
+        if (ns < best.predicted_ns) best = {balance_engine::level_parallel, threads, ns};
+    }
+    return best;
+}
+
+/// @brief Largest run of scale indices passed to one completion hook call.
+inline constexpr std::size_t completion_block{1024};
+
+/**
+ * @brief Completion hook that ignores finished scales.
+ */
+struct ignore_balanced {
+    void operator()(std::span<const std::uint32_t>) const noexcept {}
+};
+
+/**
+ * @brief Visits the scales of each level with a pool of threads.
+ *
+ * The levels are visited bottom-up with a barrier between two levels, so a visit may read
+ * everything the visits of lower levels wrote; the scales of one level are split evenly
+ * between the threads and visited in any order. Visits that write to children must not run
+ * on graphs with shared children (see shape_profile::shared_count), as two visits of one
+ * level could then write the same child.
+ * @param shape The profile of the scales.
+ * @param threads Number of threads, including the calling one.
+ * @param visit Called concurrently from the workers with the index of every scale.
+ * @param on_visited Called concurrently from the workers with each finished run of at
+ *        most completion_block scale indices, as a slice of the profile's order, right
+ *        after visiting it while its scales are still in cache.
+ */
+template <typename Visit, typename OnVisited = ignore_balanced>
+void visit_levels_parallel(const shape_profile& shape, unsigned threads, Visit&& visit, OnVisited&& on_visited = {}) {
+    threads = std::max(threads, 1u);
+    std::barrier sync{static_cast<std::ptrdiff_t>(threads)};
+    const std::span<const std::uint32_t> order{shape.order};
+
+    auto worker = [&](unsigned t) {
+        for (std::size_t l = 0; l < shape.depth(); ++l) {
+            const auto first = shape.level_offsets[l];
+            const auto last = shape.level_offsets[l + 1];
+            const auto chunk = (last - first + threads - 1) / threads;
+            const auto begin = std::min(last, first + t * chunk);
+            const auto end = std::min(last, begin + chunk);
+            for (auto block = begin; block < end; block += completion_block) {
+                const auto block_end = std::min(end, block + completion_block);
+                for (auto i = block; i < block_end; ++i) visit(order[i]);
+                on_visited(order.subspan(block, block_end - block));
+            }
+            sync.arrive_and_wait();
+        }
+    };
+
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+    worker(0);
+}
+
+/**
+ * @brief Visits the scales level by level with the given engine.
+ * @param shape The profile of the scales.
+ * @param choice Engine and thread count; automatic falls back to sequential, and so does a
+ *        graph with shared children.
+ * @param visit Called with the index of every scale, after all scales of lower levels.
+ * @param on_visited Called with each finished run of scale indices; see
+ *        visit_levels_parallel().
+ */
+template <typename Visit, typename OnVisited = ignore_balanced>
+void visit_levels(const shape_profile& shape, const engine_choice& choice, Visit&& visit, OnVisited&& on_visited = {}) {
+    if (choice.engine == balance_engine::level_parallel && choice.threads > 1 && shape.shared_count == 0) {
+        visit_levels_parallel(shape, choice.threads, visit, on_visited);
+        return;
+    }
+    const std::span<const std::uint32_t> order{shape.order};
+    for (std::size_t l = 0; l < shape.depth(); ++l) {
+        const auto level = order.subspan(shape.level_offsets[l], shape.width[l]);
+        for (std::size_t block = 0; block < level.size(); block += completion_block) {
+            const auto run = level.subspan(block, std::min(completion_block, level.size() - block));
+            for (const auto i : run) visit(i);
+            on_visited(run);
+        }
+    }
+}
+
+/**
+ * @brief Balances the scales of each level with a pool of threads.
+ *
+ * Every scale of a level only reads scales of lower levels, which a barrier guarantees to
+ * be complete, so the scales of one level can be balanced in any order.
+ * @param scales_list The scales to balance.
+ * @param shape The profile of the scales.
+ * @param threads Number of threads, including the calling one.
+ * @param on_balanced Called concurrently from the workers with each finished run of at
+ *        most completion_block scale indices, as a slice of the profile's order, right
+ *        after balancing it while its scales are still in cache.
+ */
+template <typename OnBalanced = ignore_balanced>
+void balance_levels_parallel(std::span<scale_wrapper> scales_list, const shape_profile& shape, unsigned threads,
+                             OnBalanced&& on_balanced = {}) {
+    visit_levels_parallel(shape, threads, [&](std::uint32_t i) { balance_scale(*scales_list[i]); }, on_balanced);
+}
+
+/**
+ * @brief Balances all scales with the given engine.
+ * @param scales_list The scales to balance.
+ * @param shape The profile of the scales.
+ * @param choice Engine and thread count; automatic falls back to sequential.
+ * @param on_balanced Called with each finished run of scale indices; see
+ *        balance_levels_parallel().
+ */
+template <typename OnBalanced = ignore_balanced>
+void balance_with(std::span<scale_wrapper> scales_list, const shape_profile& shape, const engine_choice& choice,
+                  OnBalanced&& on_balanced = {}) {
+    visit_levels(shape, choice, [&](std::uint32_t i) { balance_scale(*scales_list[i]); }, on_balanced);
+}
+
+/**
+ * @brief Builds a synthetic complete binary tree of @p n scales for calibration.
+ */
+inline std::vector<scale_wrapper> make_binary_tree(std::size_t n) {
+    std::vector<scale_wrapper> scales_list;
+    scales_list.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) scales_list.push_back(std::make_shared<Scale>("S" + std::to_string(i)));
+    for (std::size_t i = 0; i < n; ++i) {
+        auto& scale = *scales_list[i];
+        if (2 * i + 1 < n) scale.left = std::weak_ptr<Scale>{scales_list[2 * i + 1]};
+        else scale.left = Pan(static_cast<int>(i % 7));
+        if (2 * i + 2 < n) scale.right = std::weak_ptr<Scale>{scales_list[2 * i + 2]};
+        else scale.right = Pan(static_cast<int>(i % 5));
+    }
+    return scales_list;
+}
+
+/**
+ * @brief Most levels a synthetic shape may have if it is to be balanced.
+ *
+ * A scale weighs at least twice its heaviest side, so every level doubles the mass below
+ * it; with the pan masses of the generators here, deeper shapes overflow int.
+ */
+inline constexpr std::size_t synthetic_depth_limit{24};
+
+/**
+ * @brief Builds a synthetic chain of @p n scales for calibration.
+ *
+ * Only chains of up to synthetic_depth_limit scales can be balanced; longer ones serve to
+ * profile and walk deep graphs.
+ */
+inline std::vector<scale_wrapper> make_chain(std::size_t n) {
+    std::vector<scale_wrapper> scales_list;
+    scales_list.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) scales_list.push_back(std::make_shared<Scale>("S" + std::to_string(i)));
+    for (std::size_t i = 0; i < n; ++i) {
+        auto& scale = *scales_list[i];
+        if (i + 1 < n) scale.left = std::weak_ptr<Scale>{scales_list[i + 1]};
+        else scale.left = Pan(1);
+        scale.right = Pan(static_cast<int>(i % 3));
+    }
+    return scales_list;
+}
+
+/**
+ * @brief Builds a synthetic random tree of @p n scales, reproducible from @p seed.
+ *
+ * Each scale after the first hangs from a side chosen uniformly among the free sides of
+ * the scales before it, which gives a ragged tree of logarithmic expected depth. Sides
+ * synthetic_depth_limit levels down take no scale; a scale arriving when every free side
+ * is that deep starts a new tree.
+ */
+inline std::vector<scale_wrapper> make_random_tree(std::size_t n, std::uint64_t seed) {
+    std::vector<scale_wrapper> scales_list;
+    scales_list.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) scales_list.push_back(std::make_shared<Scale>("S" + std::to_string(i)));
+    std::mt19937_64 rng{seed};
+    std::vector<std::pair<pan_or_scale*, std::size_t>> free_sides; // a side and the depth of a scale hung there
+    for (std::size_t i = 0; i < n; ++i) {
+        auto& scale = *scales_list[i];
+        std::size_t depth = 1;
+        if (!free_sides.empty()) {
+            const auto pick = std::uniform_int_distribution<std::size_t>{0, free_sides.size() - 1}(rng);
+            *free_sides[pick].first = std::weak_ptr<Scale>{scales_list[i]};
+            depth = free_sides[pick].second;
+            free_sides[pick] = free_sides.back();
+            free_sides.pop_back();
+        }
+        scale.left = Pan(static_cast<int>(rng() % 10));
+        scale.right = Pan(static_cast<int>(rng() % 10));
+        if (depth == synthetic_depth_limit) continue;
+        free_sides.emplace_back(&scale.left, depth + 1);
+        free_sides.emplace_back(&scale.right, depth + 1);
+    }
+    return scales_list;
+}
+
+/**
+ * @brief Builds a synthetic forest of @p n scales split into chains of at most @p length.
+ */
+inline std::vector<scale_wrapper> make_chains(std::size_t n, std::size_t length) {
+    length = std::max<std::size_t>(length, 1);
+    std::vector<scale_wrapper> scales_list;
+    scales_list.reserve(n);
+    for (std::size_t first = 0, c = 0; first < n; first += length, ++c) {
+        for (auto& scale : make_chain(std::min(length, n - first))) {
+            scale->name = "C" + std::to_string(c) + scale->name;
+            scales_list.push_back(std::move(scale));
+        }
+    }
+    return scales_list;
+}
+
+/**
+ * @brief Builds a synthetic forest of @p n scales split into @p trees complete binary trees.
+ */
+inline std::vector<scale_wrapper> make_forest(std::size_t n, std::size_t trees) {
+    trees = std::clamp<std::size_t>(trees, 1, std::max<std::size_t>(n, 1));
+    std::vector<scale_wrapper> scales_list;
+    scales_list.reserve(n);
+    for (std::size_t t = 0; t < trees; ++t) {
+        auto tree = make_binary_tree(n * (t + 1) / trees - n * t / trees);
+        for (auto& scale : tree) {
+            scale->name = "T" + std::to_string(t) + scale->name;
+            scales_list.push_back(std::move(scale));
+        }
+    }
+    return scales_list;
+}
+
+/**
+ * @brief Fits the cost model coefficients to the current machine.
+ *
+ * Times the sequential engine on a large binary tree (per-scale cost), the level walk of
+ * a chain's profile with an empty visit (per-level barrier cost) and bare thread start-up.
+ * The chain is only walked, not balanced: its masses double on every level and would
+ * overflow int after about 30 of them. Each measurement
+ * keeps the best of a few repetitions to filter out noise.
+ * @param max_threads Thread count used for the parallel measurements.
+ * @return The fitted model.
+ */
+inline cost_model calibrate_cost_model(unsigned max_threads) {
+    using clock = std::chrono::steady_clock;
+    constexpr int repetitions = 5;
+    auto best_of = [&](auto&& run) {
+        double best = std::numeric_limits<double>::max();
+        for (int r = 0; r < repetitions; ++r) {
+            const auto start = clock::now();
+            run();
+            best = std::min(best, std::chrono::duration<double, std::nano>(clock::now() - start).count());
+        }
+        return best;
+    };
+
+    cost_model model;
+    constexpr std::size_t tree_size = 1 << 18;
+    auto tree = make_binary_tree(tree_size);
+    const auto tree_shape = profile_shape(tree);
+    model.node_ns = best_of([&] { balance_with(tree, tree_shape, {}); }) / tree_size;
+
+    const auto threads = std::max(2u, max_threads);
+    model.thread_start_ns = best_of([&] {
+        std::vector<std::jthread> pool;
+        for (unsigned t = 1; t < threads; ++t) pool.emplace_back([] {});
+    }) / (threads - 1);
+
+    constexpr std::size_t chain_size = 1 << 12;
+    auto chain = make_chain(chain_size);
+    const auto chain_shape = profile_shape(chain);
+    const auto chain_ns = best_of([&] { visit_levels_parallel(chain_shape, threads, [](std::uint32_t) {}); });
+    model.level_sync_ns = std::max(0.0, (chain_ns - model.thread_start_ns * (threads - 1)) / chain_size);
+    return model;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file fused_report.hpp
+ * @brief Fused mode that formats each report row during the balancing pass.
+ *
+ * Balancing and reporting separately walk the whole graph twice, pulling every scale
+ * through the cache once for each walk. In fused mode, a scale's row is formatted right
+ * after the engine balanced it (a scale's row only depends on its own sides, which are
+ * final once it is balanced), while the scale is still in cache. Each row goes into its own
+ * slot of one output buffer, at an offset computed up front from the row's longest
+ * possible length, so workers of the parallel engine write disjoint slots without any
+ * coordination. Afterwards, the rows are packed together in place and written with a
+ * single call. The bytes written are identical to report_changes().
+ */
+
+#pragma once
+
+#include "engine.hpp"
+
+#include <cstring>
+
+/**
+ * @brief Output buffer with one fixed slot per report row.
+ *
+ * format() may be called concurrently for different rows; write() after all of them.
+ */
+class report_buffer {
+public:
+    /**
+     * @brief Reserves a slot for the row of every scale.
+     * @param scales_list The scales in output order; must outlive the buffer.
+     * @param format Notation of the printed masses.
+     */
+    report_buffer(std::span<const scale_wrapper> scales_list, const mass_format& format = {})
+        : scales_{scales_list}, format_{format}, offsets_(scales_list.size() + 1), lengths_(scales_list.size()) {
+        for (std::size_t i = 0; i < scales_list.size(); ++i) {
+            const auto& scale = *scales_list[i];
+            offsets_[i + 1] = offsets_[i] + scale.name.size() + scale.side_count() * (1 + mass_format::max_width) + 1;
+        }
+        buffer_.resize(offsets_.back());
+    }
+
+    /**
+     * @brief Formats the row of the scale at output position @p i into its slot.
+     */
+    void format(std::size_t i) {
+        const auto& scale = *scales_[i];
+        char* const first = buffer_.data() + offsets_[i];
+        char* const last = buffer_.data() + offsets_[i + 1];
+        char* out = std::ranges::copy(scale.name, first).out;
+        for (std::size_t s = 0; s < scale.side_count(); ++s) {
+            *out++ = ',';
+            out = format_.write(out, last, Scale::resolve_side(scale.side(s)).balance_mass);
+        }
+        *out++ = '\n';
+        lengths_[i] = static_cast<std::uint32_t>(out - first);
+    }
+
+    /**
+     * @brief Packs the formatted rows together and writes them to @p os in one call.
+     */
+    void write(std::ostream& os) {
+        std::size_t packed = 0;
+        for (std::size_t i = 0; i < lengths_.size(); ++i) {
+            std::memmove(buffer_.data() + packed, buffer_.data() + offsets_[i], lengths_[i]);
+            packed += lengths_[i];
+        }
+        os.write(buffer_.data(), static_cast<std::streamsize>(packed));
+    }
+
+private:
+    std::span<const scale_wrapper> scales_;
+    mass_format format_;
+    std::vector<std::size_t> offsets_;  ///< Slot i is [offsets_[i], offsets_[i + 1]).
+    std::vector<std::uint32_t> lengths_; ///< Bytes formatted into each slot.
+    std::vector<char> buffer_;
+};
+
+/**
+ * @brief Balances all scales and formats each row as soon as its scale is balanced.
+ * @param os The output stream.
+ * @param scales_list The scales to balance and report.
+ * @param shape The profile of the scales.
+ * @param choice Engine and thread count.
+ * @param format Notation of the printed masses.
+ */
+inline void balance_and_format(std::ostream& os, std::span<scale_wrapper> scales_list, const shape_profile& shape,
+                               const engine_choice& choice, const mass_format& format = {}) {
+    report_buffer rows{scales_list, format};
+    balance_with(scales_list, shape, choice, [&](std::span<const std::uint32_t> balanced) {
+        for (const auto i : balanced) rows.format(i);
+    });
+    rows.write(os);
+}
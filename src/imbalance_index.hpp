@@ -0,0 +1,194 @@
+/**
+ * @file imbalance_index.hpp
+ * @brief Secondary index of scales ordered by required balance, partitioned by tree.
+ *
+ * A scale's required balance is the total counterweight its sides need, the sum of their
+ * balance masses. The index keeps every scale in an ordered set for the whole graph and in
+ * one for the tree it belongs to, keyed by that balance, so threshold, range and top-K
+ * queries find their first hit in O(log N) and then only walk the k hits: no query ever
+ * scans scales it does not return.
+ *
+ * scale_graph keeps the index current: refiling a rebalanced scale costs O(log N) and is
+ * deferred until the next query, so each changed scale is refiled once per query however
+ * many edits changed it. Moving a subtree to another tree relabels each of its scales, in
+ * O(subtree log N); scale_graph defers that to the next query as well, and skips it for
+ * subtrees that are back in the tree they are filed under by then.
+ */
+
+#pragma once
+
+#include "scale.hpp"
+
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Total counterweight needed on the sides of @p scale, once it is balanced.
+ */
+inline int required_balance(const Scale& scale) {
+    int total = 0;
+    for (std::size_t i = 0; i < scale.side_count(); ++i) total += Scale::resolve_side(scale.side(i)).balance_mass;
+    return total;
+}
+
+/**
+ * @brief Scales ordered by required balance, in total and per tree.
+ *
+ * Scales are identified by index and trees by the index of their root.
+ */
+class imbalance_index {
+public:
+    static constexpr std::uint32_t no_tree{~std::uint32_t{0}}; ///< Selects all trees in queries.
+
+    /// @brief A scale and its required balance.
+    struct hit {
+        std::uint32_t scale{}; ///< Index of the scale.
+        int balance{};         ///< Its required balance.
+
+        bool operator==(const hit&) const = default;
+    };
+
+    /// @brief Removes every entry.
+    void clear() {
+        entries_.clear();
+        all_.clear();
+        trees_.clear();
+    }
+
+    /// @brief True if @p scale has an entry.
+    [[nodiscard]] bool contains(std::uint32_t scale) const {
+        return scale < entries_.size() && entries_[scale].tree != no_tree;
+    }
+
+    /// @brief Number of scales with an entry.
+    [[nodiscard]] std::size_t size() const { return all_.size(); }
+
+    /// @brief Approximate heap bytes held by the index.
+    [[nodiscard]] std::size_t memory_bytes() const {
+        constexpr auto pointer = sizeof(void*);
+        constexpr auto set_node = sizeof(ordered_set::value_type) + 4 * pointer; // colour, parent, children
+        return entries_.capacity() * sizeof(entry) + 2 * all_.size() * set_node
+            + trees_.size() * (sizeof(decltype(trees_)::value_type) + 2 * pointer) + trees_.bucket_count() * pointer;
+    }
+
+    /// @brief Required balance of @p scale, which must have an entry.
+    [[nodiscard]] int balance(std::uint32_t scale) const { return entries_[scale].balance; }
+
+    /// @brief Root of the tree @p scale is filed under, which must have an entry.
+    [[nodiscard]] std::uint32_t tree(std::uint32_t scale) const { return entries_[scale].tree; }
+
+    /**
+     * @brief Files @p scale under @p tree with @p balance, replacing any previous entry.
+     */
+    void set(std::uint32_t scale, std::uint32_t tree, int balance) {
+        if (!contains(scale)) {
+            if (entries_.size() <= scale) entries_.resize(scale + 1);
+            auto& tree_scales = trees_[tree];
+            entries_[scale] = {balance, tree, &tree_scales};
+            all_.emplace(balance, scale);
+            tree_scales.emplace(balance, scale);
+            return;
+        }
+        auto& e = entries_[scale];
+        if (e.tree == tree && e.balance == balance) return;
+        // Re-key the existing set nodes rather than freeing and allocating new ones
+        rekey(all_, all_, e.balance, balance, scale);
+        auto& tree_scales = e.tree == tree ? *e.tree_scales : trees_[tree];
+        rekey(*e.tree_scales, tree_scales, e.balance, balance, scale);
+        if (e.tree_scales->empty()) trees_.erase(e.tree);
+        e = {balance, tree, &tree_scales};
+    }
+
+    /**
+     * @brief Updates the balance of @p scale, keeping its tree; does nothing without an entry.
+     */
+    void update(std::uint32_t scale, int balance) {
+        if (contains(scale)) set(scale, entries_[scale].tree, balance);
+    }
+
+    /**
+     * @brief Refiles @p scale under @p tree, keeping its balance; does nothing without an entry.
+     */
+    void move(std::uint32_t scale, std::uint32_t tree) {
+        if (contains(scale)) set(scale, tree, entries_[scale].balance);
+    }
+
+    /// @brief Removes the entry of @p scale, if any.
+    void erase(std::uint32_t scale) {
+        if (!contains(scale)) return;
+        auto& e = entries_[scale];
+        all_.erase({e.balance, scale});
+        e.tree_scales->erase({e.balance, scale});
+        if (e.tree_scales->empty()) trees_.erase(e.tree);
+        e = {};
+    }
+
+    /**
+     * @brief Scales whose required balance exceeds @p threshold, lightest first.
+     * @param threshold Exclusive lower bound.
+     * @param tree Root of the tree to search, or no_tree for all trees.
+     */
+    [[nodiscard]] std::vector<hit> above(int threshold, std::uint32_t tree = no_tree) const {
+        const auto* scales = ordered(tree);
+        if (!scales || threshold == std::numeric_limits<int>::max()) return {};
+        return collect(scales->lower_bound({threshold + 1, 0}), scales->end());
+    }
+
+    /**
+     * @brief Scales whose required balance lies in [@p low, @p high], lightest first.
+     * @param tree Root of the tree to search, or no_tree for all trees.
+     */
+    [[nodiscard]] std::vector<hit> range(int low, int high, std::uint32_t tree = no_tree) const {
+        const auto* scales = ordered(tree);
+        if (!scales || low > high) return {};
+        return collect(scales->lower_bound({low, 0}), scales->upper_bound({high, no_tree}));
+    }
+
+    /**
+     * @brief The @p k scales with the largest required balance, largest first.
+     * @param tree Root of the tree to search, or no_tree for all trees.
+     */
+    [[nodiscard]] std::vector<hit> top(std::size_t k, std::uint32_t tree = no_tree) const {
+        std::vector<hit> hits;
+        const auto* scales = ordered(tree);
+        if (!scales) return hits;
+        hits.reserve(std::min(k, scales->size()));
+        for (auto it = scales->rbegin(); it != scales->rend() && hits.size() < k; ++it) hits.push_back({it->second, it->first});
+        return hits;
+    }
+
+private:
+    using ordered_set = std::set<std::pair<int, std::uint32_t>>; ///< (balance, scale) pairs.
+
+    struct entry {
+        int balance{};
+        std::uint32_t tree{no_tree};      ///< no_tree if the scale has no entry.
+        ordered_set* tree_scales{};       ///< The set of its tree; map nodes never move.
+    };
+
+    /// Moves the node of @p scale from @p from to @p to under its new balance.
+    static void rekey(ordered_set& from, ordered_set& to, int old_balance, int new_balance, std::uint32_t scale) {
+        auto node = from.extract({old_balance, scale});
+        node.value().first = new_balance;
+        to.insert(std::move(node));
+    }
+
+    [[nodiscard]] const ordered_set* ordered(std::uint32_t tree) const {
+        if (tree == no_tree) return &all_;
+        const auto it = trees_.find(tree);
+        return it != trees_.end() ? &it->second : nullptr;
+    }
+
+    static std::vector<hit> collect(ordered_set::const_iterator first, ordered_set::const_iterator last) {
+        std::vector<hit> hits;
+        for (; first != last; ++first) hits.push_back({first->second, first->first});
+        return hits;
+    }
+
+    std::vector<entry> entries_;                           ///< By scale index.
+    ordered_set all_;                                      ///< Every scale.
+    std::unordered_map<std::uint32_t, ordered_set> trees_; ///< The scales of each tree, by root.
+};
@@ -0,0 +1,238 @@
+/**
+ * @file latency_histogram.hpp
+ * @brief HDR-style latency histograms recorded per thread and merged on demand.
+ *
+ * Buckets are log-linear: values below 64 ns have a bucket each, and every further power
+ * of two is split into 32 buckets, so any recorded value is known to within about 3%
+ * across the whole range up to 2^40 ns. Recording finds the bucket with one bit_width()
+ * and bumps a counter in the calling thread's slot (see thread_slots.hpp), so writers never
+ * share a cache line and need no atomic read-modify-write. Readers merge all slots into a plain
+ * histogram when percentiles are asked for.
+ *
+ * A set of histograms takes about 27 KB, so per-thread slots cost that much for every thread
+ * that records. Where records are mostly serialized anyway, like the requests of one tenant,
+ * latency_stats can instead keep a single shared set that every thread adds to atomically.
+ */
+
+#pragma once
+
+#include "thread_slots.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+/**
+ * @brief Plain log-linear histogram of nanosecond values.
+ */
+class latency_histogram {
+public:
+    static constexpr unsigned sub_bucket_bits{6}; ///< 64 linear buckets before the first split.
+    static constexpr std::uint64_t half_count{std::uint64_t{1} << (sub_bucket_bits - 1)}; ///< Buckets per power of two.
+    static constexpr unsigned max_value_bits{40}; ///< Larger values are clamped.
+    static constexpr std::size_t bucket_count{(max_value_bits - sub_bucket_bits + 2) * half_count};
+
+    /**
+     * @brief The bucket holding @p value.
+     */
+    static constexpr std::size_t bucket_of(std::uint64_t value) {
+        value = std::min(value, (std::uint64_t{1} << max_value_bits) - 1);
+        const auto width = static_cast<unsigned>(std::bit_width(value));
+        const auto shift = width > sub_bucket_bits ? width - sub_bucket_bits : 0u;
+        return shift * half_count + (value >> shift);
+    }
+
+    /**
+     * @brief The largest value that falls into @p bucket.
+     */
+    static constexpr std::uint64_t highest_in(std::size_t bucket) {
+        const auto shift = bucket < 2 * half_count ? 0 : bucket / half_count - 1;
+        return ((bucket - shift * half_count + 1) << shift) - 1;
+    }
+
+    /// @brief Adds one occurrence of @p value.
+    void record(std::uint64_t value) {
+        ++counts_[bucket_of(value)];
+        sum_ += value;
+    }
+
+    /// @brief Adds @p count occurrences of every value in @p bucket; see add_sum().
+    void add(std::size_t bucket, std::uint64_t count) { counts_[bucket] += count; }
+
+    /// @brief Adds @p total to the exact sum of the values, kept apart from the buckets.
+    void add_sum(std::uint64_t total) { sum_ += total; }
+
+    /// @brief Adds every value recorded in @p other.
+    void merge(const latency_histogram& other) {
+        for (std::size_t b = 0; b < bucket_count; ++b) counts_[b] += other.counts_[b];
+        sum_ += other.sum_;
+    }
+
+    /// @brief Exact sum of the recorded values, before bucketing.
+    [[nodiscard]] std::uint64_t sum() const { return sum_; }
+
+    /// @brief Number of recorded values.
+    [[nodiscard]] std::uint64_t count() const {
+        std::uint64_t total = 0;
+        for (const auto c : counts_) total += c;
+        return total;
+    }
+
+    /**
+     * @brief The value below or at which a share @p q of all values lie.
+     * @param q Quantile in [0, 1]; 1 yields the maximum.
+     * @return The highest value of the bucket reaching the quantile, or 0 if empty.
+     */
+    [[nodiscard]] std::uint64_t value_at(double q) const {
+        const auto total = count();
+        if (total == 0) return 0;
+        const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(total))));
+        std::uint64_t seen = 0;
+        for (std::size_t b = 0; b < bucket_count; ++b) {
+            seen += counts_[b];
+            if (seen >= rank) return highest_in(b);
+        }
+        return highest_in(bucket_count - 1);
+    }
+
+private:
+    std::array<std::uint64_t, bucket_count> counts_{};
+    std::uint64_t sum_{};
+};
+
+/**
+ * @brief Writes one line `name count=N p50_ns=.. p90_ns=.. p99_ns=.. p999_ns=.. max_ns=..`.
+ */
+inline void report_latency(std::ostream& os, std::string_view name, const latency_histogram& histogram) {
+    os << name << " count=" << histogram.count()
+       << " p50_ns=" << histogram.value_at(0.5) << " p90_ns=" << histogram.value_at(0.9)
+       << " p99_ns=" << histogram.value_at(0.99) << " p999_ns=" << histogram.value_at(0.999)
+       << " max_ns=" << histogram.value_at(1.0) << '\n';
+}
+
+/**
+ * @brief Request paths whose latency is tracked.
+ */
+enum class latency_path : std::uint8_t { query, update, recompute };
+
+/// @brief Number of latency_path values.
+inline constexpr std::size_t latency_path_count{3};
+
+/**
+ * @brief Lower-case name of a path, as used in reports.
+ */
+constexpr std::string_view latency_path_name(latency_path path) {
+    switch (path) {
+        case latency_path::query: return "query";
+        case latency_path::update: return "update";
+        case latency_path::recompute: return "recompute";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief How latency_stats keeps its counters.
+ */
+enum class latency_recording : std::uint8_t {
+    per_thread, ///< One set per recording thread; for many concurrent writers.
+    shared,     ///< One set for all threads; for writers that rarely overlap.
+};
+
+/**
+ * @brief Latency histograms of every path, with one set of counters per recording thread
+ *        or one shared set.
+ *
+ * record() may be called from any number of threads.
+ */
+class latency_stats {
+public:
+    explicit latency_stats(latency_recording recording = latency_recording::per_thread)
+        : shared_{recording == latency_recording::shared ? std::make_unique<path_counters>() : nullptr} {}
+
+    /**
+     * @brief Records one latency of @p path.
+     */
+    void record(latency_path path, std::chrono::nanoseconds elapsed) {
+        const auto ns = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(0, elapsed.count()));
+        const auto bucket = latency_histogram::bucket_of(ns);
+        const auto p = static_cast<std::size_t>(path);
+        if (shared_) {
+            shared_->buckets[p][bucket].fetch_add(1, std::memory_order_relaxed);
+            shared_->sum_ns[p].fetch_add(ns, std::memory_order_relaxed);
+            return;
+        }
+        auto& slot = slots_.local();
+        // Only this thread writes the slot, so a relaxed load and store cannot lose counts.
+        auto& counter = slot.buckets[p][bucket];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot.sum_ns[p].store(slot.sum_ns[p].load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Merges the counters of all threads for @p path.
+     */
+    [[nodiscard]] latency_histogram snapshot(latency_path path) const {
+        latency_histogram merged;
+        auto add = [&](const path_counters& counters) {
+            const auto p = static_cast<std::size_t>(path);
+            for (std::size_t b = 0; b < latency_histogram::bucket_count; ++b) {
+                merged.add(b, counters.buckets[p][b].load(std::memory_order_relaxed));
+            }
+            merged.add_sum(counters.sum_ns[p].load(std::memory_order_relaxed));
+        };
+        if (shared_) add(*shared_);
+        slots_.for_each(add);
+        return merged;
+    }
+
+    /**
+     * @brief Approximate heap bytes of the counters.
+     */
+    [[nodiscard]] std::size_t memory_bytes() const {
+        return (shared_ ? sizeof(path_counters) : 0) + slots_.memory_bytes();
+    }
+
+    /**
+     * @brief Writes one report_latency() line per path.
+     */
+    void report(std::ostream& os) const {
+        for (std::size_t p = 0; p < latency_path_count; ++p) {
+            const auto path = static_cast<latency_path>(p);
+            report_latency(os, latency_path_name(path), snapshot(path));
+        }
+    }
+
+private:
+    using bucket_counters = std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count>;
+    struct path_counters {
+        std::array<bucket_counters, latency_path_count> buckets;
+        std::array<std::atomic<std::uint64_t>, latency_path_count> sum_ns; ///< Exact, for Prometheus `_sum`.
+    };
+
+    std::unique_ptr<path_counters> shared_; ///< The shared set, if any.
+    thread_slots<path_counters> slots_;
+};
+
+/**
+ * @brief Records the lifetime of the timer as one latency of a path.
+ */
+class latency_timer {
+public:
+    latency_timer(latency_stats& stats, latency_path path)
+        : stats_{stats}, path_{path}, start_{std::chrono::steady_clock::now()} {}
+    latency_timer(const latency_timer&) = delete;
+    latency_timer& operator=(const latency_timer&) = delete;
+    ~latency_timer() { stats_.record(path_, std::chrono::steady_clock::now() - start_); }
+
+private:
+    latency_stats& stats_;
+    latency_path path_;
+    std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,108 @@
+/**
+ * @file load_generator.cpp
+ * @brief scaleblancer_load - drives an in-process scale server with synthetic requests.
+ *
+ * The server is started in the same process on the graph from FILE..., or on a synthetic
+ * complete binary tree, and driven through scale_server::handle() from worker threads, so
+ * runs need nothing but the local machine. The tool prints the throughput and the latency
+ * percentiles seen by the clients, followed by the server's own latency report.
+ *
+ * Usage: scaleblancer_load [options] [FILE...]
+ *
+ * Command line options:
+ *     --mode closed|open     closed loop at fixed concurrency (default) or open loop at fixed rate
+ *     --concurrency N        worker threads (default 4)
+ *     --rate R               requests per second in open-loop mode (default 10000)
+ *     --requests N           total requests (default 100000)
+ *     --query-ratio F        share of GET queries, the rest being SET updates (default 0.9)
+ *     --zipf S               Zipf exponent of the update hot spots; 0 is uniform (default 0)
+ *     --scales N             size of the synthetic tree used without FILE (default 65536)
+ *     --seed N               seed of the request generators (default 1)
+ */
+
+#include "engine.hpp"
+#include "load_generator.hpp"
+#include "parallel_ingest.hpp"
+
+/**
+ * @brief Command line options of the load generator.
+ */
+struct load_options {
+    load_config config;              ///< Load parameters.
+    std::size_t scales{1 << 16};     ///< Size of the synthetic tree.
+    std::vector<std::string> inputs; ///< Input files; a synthetic tree is used if there are none.
+};
+
+/**
+ * @brief Parses the command line.
+ * @param args The arguments, excluding the program name.
+ * @return The options, or std::nullopt after reporting a usage error.
+ */
+inline std::optional<load_options> parse_load_options(std::span<char* const> args) {
+    load_options opts;
+    auto& config = opts.config;
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const std::string_view arg{args[i]};
+        auto value = [&]() -> const char* { return i + 1 < args.size() ? args[++i] : nullptr; };
+
+        const char* v = nullptr;
+        if (arg == "--mode" && (v = value()) && (v == std::string_view{"closed"} || v == std::string_view{"open"})) {
+            config.mode = v == std::string_view{"open"} ? load_mode::open : load_mode::closed;
+        } else if (arg == "--concurrency" && (v = value()) && std::atoi(v) > 0) {
+            config.concurrency = static_cast<unsigned>(std::atoi(v));
+        } else if (arg == "--rate" && (v = value()) && std::atof(v) > 0) {
+            config.rate = std::atof(v);
+        } else if (arg == "--requests" && (v = value()) && std::atoll(v) > 0) {
+            config.requests = static_cast<std::uint64_t>(std::atoll(v));
+        } else if (arg == "--query-ratio" && (v = value()) && std::atof(v) >= 0 && std::atof(v) <= 1) {
+            config.query_ratio = std::atof(v);
+        } else if (arg == "--zipf" && (v = value()) && std::atof(v) >= 0) {
+            config.zipf_skew = std::atof(v);
+        } else if (arg == "--scales" && (v = value()) && std::atoll(v) > 0) {
+            opts.scales = static_cast<std::size_t>(std::atoll(v));
+        } else if (arg == "--seed" && (v = value())) {
+            config.seed = static_cast<std::uint64_t>(std::atoll(v));
+        } else if (!arg.starts_with("--")) {
+            opts.inputs.emplace_back(arg);
+        } else {
+            std::cerr << "Invalid argument: " << std::quoted(arg) << '\n';
+            return std::nullopt;
+        }
+    }
+    return opts;
+}
+
+/**
+ * @brief Entry point of the load generator.
+ */
+int main(int argc, char* argv[])
+{
+    const auto opts = parse_load_options({argv + 1, static_cast<std::size_t>(argc > 0 ? argc - 1 : 0)});
+    if (!opts) return 2;
+    const auto& config = opts->config;
+
+    std::vector<scale_wrapper> scales_list;
+    if (opts->inputs.empty()) {
+        scales_list = make_binary_tree(opts->scales);
+    } else if (!parse_scale_files(opts->inputs, scales_list, std::max(1u, std::thread::hardware_concurrency()))) {
+        return 1;
+    }
+
+    const load_workload workload{scales_list, config};
+    scale_graph graph{std::move(scales_list)};
+    if (!graph.valid()) return 1;
+    scale_server server{std::move(graph)};
+    latency_stats latencies;
+    const auto result = run_load(server, workload, config, latencies);
+
+    std::cout << "mode=" << (config.mode == load_mode::open ? "open" : "closed")
+              << " concurrency=" << config.concurrency << " requests=" << result.requests
+              << " errors=" << result.errors
+              << " elapsed_ms=" << std::chrono::duration_cast<std::chrono::milliseconds>(result.elapsed).count()
+              << " throughput_rps=" << static_cast<std::uint64_t>(result.throughput()) << '\n';
+    report_latency(std::cout, "client_query", latencies.snapshot(latency_path::query));
+    report_latency(std::cout, "client_update", latencies.snapshot(latency_path::update));
+    std::cout << "server:\n";
+    server.latencies().report(std::cout);
+    return result.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+/**
+ * @file load_generator.hpp
+ * @brief Synthetic request load against a scale_server, for sizing server deployments.
+ *
+ * Two loop disciplines are supported:
+ * - closed loop: a fixed number of workers each send the next request as soon as the
+ *   previous one was answered, so the offered load adapts to the server's speed;
+ * - open loop: requests are due at a fixed rate regardless of how fast answers come back,
+ *   and each latency is measured from the moment the request was due rather than the
+ *   moment it was sent. A stalled server therefore shows up in the percentiles of every
+ *   request it delayed, instead of silently lowering the offered rate (coordinated
+ *   omission).
+ *
+ * The workload mixes GET queries over all scales with SET updates that change the pans of
+ * one scale while keeping its sub-scales, so the tree shape stays fixed for the whole run.
+ * Update targets follow a hot-spot distribution: uniform, or Zipf-skewed towards a few
+ * scales spread randomly over the tree.
+ */
+
+#pragma once
+
+#include "scale_server.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+
+/**
+ * @brief Loop discipline of a load run.
+ */
+enum class load_mode : std::uint8_t { closed, open };
+
+/**
+ * @brief Parameters of a load run.
+ */
+struct load_config {
+    load_mode mode{load_mode::closed}; ///< Loop discipline.
+    unsigned concurrency{4};           ///< Worker threads issuing requests.
+    double rate{10000};                ///< Requests per second in open-loop mode.
+    std::uint64_t requests{100000};    ///< Total number of requests to issue.
+    double query_ratio{0.9};           ///< Share of requests that are GET queries.
+    double zipf_skew{0};               ///< Exponent of the update hot-spot distribution; 0 is uniform.
+    std::uint64_t seed{1};             ///< Seed of the request generators.
+};
+
+/**
+ * @brief Outcome of a load run; latencies are kept in the latency_stats passed in.
+ */
+struct load_result {
+    std::uint64_t requests{};           ///< Requests answered.
+    std::uint64_t errors{};             ///< Requests answered with ERROR.
+    std::chrono::nanoseconds elapsed{}; ///< Wall time of the whole run.
+
+    /// @brief Answered requests per second.
+    [[nodiscard]] double throughput() const {
+        return elapsed.count() > 0 ? static_cast<double>(requests) * 1e9 / static_cast<double>(elapsed.count()) : 0;
+    }
+};
+
+/**
+ * @brief Query and update targets drawn from a scale graph, and the request generator.
+ */
+class load_workload {
+public:
+    /**
+     * @brief Collects targets from @p scales_list; call before the scales are handed to the server.
+     * @param scales_list The scales the server will hold.
+     * @param config Supplies the hot-spot skew and the seed of the hot-spot placement.
+     */
+    load_workload(std::span<const scale_wrapper> scales_list, const load_config& config) {
+        for (const auto& scale : scales_list) {
+            names_.push_back(scale->name);
+            update_target target{scale->name, {}};
+            for (std::size_t i = 0; i < scale->side_count(); ++i) {
+                target.pans.push_back(std::holds_alternative<Pan>(scale->side(i)));
+            }
+            if (std::ranges::find(target.pans, true) != target.pans.end()) targets_.push_back(std::move(target));
+        }
+        // Hot spots land on random scales rather than on the first ones of the input.
+        std::ranges::shuffle(targets_, std::mt19937_64{config.seed});
+
+        double total = 0;
+        hot_spot_cdf_.reserve(targets_.size());
+        for (std::size_t rank = 1; rank <= targets_.size(); ++rank) {
+            total += 1 / std::pow(static_cast<double>(rank), config.zipf_skew);
+            hot_spot_cdf_.push_back(total);
+        }
+        for (auto& p : hot_spot_cdf_) p /= total;
+    }
+
+    /// @brief True if there is anything to query.
+    [[nodiscard]] bool empty() const { return names_.empty(); }
+
+    /**
+     * @brief Draws the next request.
+     * @param rng The calling worker's generator.
+     * @param query_ratio Share of GET queries.
+     * @return The request line, and whether it is a query.
+     */
+    std::pair<std::string, bool> next(std::mt19937_64& rng, double query_ratio) const {
+        std::uniform_real_distribution<double> unit{0, 1};
+        if (targets_.empty() || unit(rng) < query_ratio) {
+            return {"GET " + names_[std::uniform_int_distribution<std::size_t>{0, names_.size() - 1}(rng)], true};
+        }
+        const auto hot = std::ranges::lower_bound(hot_spot_cdf_, unit(rng)) - hot_spot_cdf_.begin();
+        const auto& target = targets_[std::min<std::size_t>(hot, targets_.size() - 1)];
+        std::string request = "SET " + target.name;
+        std::uniform_int_distribution<int> mass{0, 99};
+        for (const bool pan : target.pans) {
+            request += ',';
+            if (pan) request += std::to_string(mass(rng)); // sub-scales are kept by empty tokens
+        }
+        return {std::move(request), false};
+    }
+
+private:
+    struct update_target {
+        std::string name;
+        std::vector<bool> pans; ///< Which sides hold pans.
+    };
+
+    std::vector<std::string> names_;
+    std::vector<update_target> targets_;
+    std::vector<double> hot_spot_cdf_; ///< Cumulative probability of picking targets_[i].
+};
+
+/**
+ * @brief Drives @p server with the configured load and waits until every request is answered.
+ * @param server The server under test.
+ * @param workload Targets drawn from the server's graph.
+ * @param config Loop discipline, mix and volume.
+ * @param latencies Receives one latency per request, queries and updates separately.
+ * @return Throughput and error counts; nothing is sent if the workload is empty.
+ */
+inline load_result run_load(scale_server& server, const load_workload& workload, const load_config& config,
+                            latency_stats& latencies) {
+    if (workload.empty()) return {};
+    using clock = std::chrono::steady_clock;
+    std::atomic<std::uint64_t> next_ticket{0};
+    std::atomic<std::uint64_t> errors{0};
+    const auto interval = std::chrono::duration<double, std::nano>{1e9 / std::max(config.rate, 1e-3)};
+    const auto start = clock::now();
+
+    auto worker = [&](unsigned index) {
+        std::mt19937_64 rng{config.seed + index + 1};
+        std::uint64_t failed = 0;
+        for (auto ticket = next_ticket++; ticket < config.requests; ticket = next_ticket++) {
+            auto [request, query] = workload.next(rng, config.query_ratio);
+            auto sent = clock::now();
+            if (config.mode == load_mode::open) {
+                sent = start + std::chrono::duration_cast<clock::duration>(interval * static_cast<double>(ticket));
+                std::this_thread::sleep_until(sent);
+            }
+            if (server.handle(request).starts_with("ERROR")) ++failed;
+            latencies.record(query ? latency_path::query : latency_path::update, clock::now() - sent);
+        }
+        errors += failed;
+    };
+    {
+        std::vector<std::jthread> pool;
+        for (unsigned t = 1; t < std::max(config.concurrency, 1u); ++t) pool.emplace_back(worker, t);
+        worker(0);
+    }
+    return {config.requests, errors.load(), clock::now() - start};
+}
@@ -0,0 +1,202 @@
+/**
+ * @file parallel_ingest.hpp
+ * @brief Concurrent ingestion of many input files into one shared namespace.
+ *
+ * Each input is parsed by a single worker thread, and all workers intern names in one
+ * sharded, mutex-protected name table, so a file may refer to scales defined in any other
+ * file. The result is deterministic and identical to running parse_scales() over the
+ * concatenation of the inputs:
+ * - every mention of a name is stamped with its position (input, line, field), and the
+ *   scales list is ordered by each name's earliest stamp;
+ * - when several lines assign the same side of a scale, the one with the latest stamp
+ *   wins, whichever thread happened to apply it last.
+ */
+
+#pragma once
+
+#include "run_metrics.hpp"
+#include "scale.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <syncstream>
+#include <thread>
+
+/**
+ * @brief Name table and merge logic shared by the ingestion workers.
+ *
+ * parse() may run concurrently for different inputs; finish() must run after all of them.
+ */
+class scale_ingest {
+public:
+    /**
+     * @brief Prepares an empty namespace.
+     * @param format Notation of the masses in every input.
+     */
+    explicit scale_ingest(const mass_format& format = {}) : format_{format} {}
+
+    /**
+     * @brief Parses one input into the shared namespace.
+     * @param infile The input stream.
+     * @param input_index Position of the input in the global order.
+     * @param label Name of the input used in diagnostics.
+     */
+    void parse(std::istream& infile, std::uint64_t input_index, std::string_view label) {
+        std::string line;
+        for (std::uint64_t line_number = 0; std::getline(infile, line); ++line_number) {
+            if (line.empty() || line.front() == '#') continue; // skip comment lines.
+
+            const auto fields = parse_fields(line);
+            const auto& name = fields.front();
+            const auto sides = std::span{fields}.subspan(1);
+
+            // Same validation as parse_scales(), plus the field limit of the stamps
+            if (name.empty() || std::ranges::find(sides, name) != sides.end() || has_invalid_mass(sides, format_)
+                || fields.size() > max_fields) {
+                std::osyncstream{std::cerr} << "Invalid line " << line_number << " of " << label << ": "
+                                            << std::quoted(line) << '\n';
+                continue;
+            }
+
+            const auto stamp = (input_index << line_bits | line_number) << field_bits;
+            auto& owner = intern(name, stamp);
+            for (std::size_t i = 0; i < sides.size(); ++i) assign_side(owner, i, sides[i], stamp | (i + 1));
+        }
+    }
+
+    /**
+     * @brief Orders the interned scales by first mention and hands them out.
+     * @param scales_list Output vector receiving the scales.
+     */
+    void finish(std::vector<scale_wrapper>& scales_list) {
+        std::vector<std::pair<std::uint64_t, scale_wrapper>> ordered;
+        for (auto& shard : shards_) {
+            for (auto& [name, e] : shard.entries) ordered.emplace_back(e.first_seen, std::move(e.scale));
+            shard.entries.clear();
+        }
+        std::ranges::sort(ordered, {}, &std::pair<std::uint64_t, scale_wrapper>::first);
+
+        scales_list.clear();
+        scales_list.reserve(ordered.size());
+        for (auto& [stamp, scale] : ordered) scales_list.push_back(std::move(scale));
+    }
+
+private:
+    static constexpr unsigned line_bits{32};
+    static constexpr unsigned field_bits{10};
+    static constexpr std::size_t max_fields{std::size_t{1} << field_bits};
+    static constexpr std::size_t shard_count{64};
+
+    struct entry {
+        scale_wrapper scale;
+        std::uint64_t first_seen{std::numeric_limits<std::uint64_t>::max()};
+        std::vector<std::uint64_t> side_stamps; ///< Stamp of the line that last assigned each side.
+    };
+
+    struct alignas(64) shard {
+        std::mutex lock;
+        std::unordered_map<std::string, entry> entries;
+    };
+
+    shard& shard_of(const std::string& name) {
+        return shards_[std::hash<std::string>{}(name) % shard_count];
+    }
+
+    entry& intern(const std::string& name, std::uint64_t stamp) {
+        auto& s = shard_of(name);
+        std::scoped_lock guard{s.lock};
+        auto& e = s.entries[name];
+        if (!e.scale) e.scale = std::make_shared<Scale>(name, format_.unit());
+        e.first_seen = std::min(e.first_seen, stamp);
+        return e;
+    }
+
+    void assign_side(entry& owner, std::size_t side_index, const std::string& token, std::uint64_t stamp) {
+        if (token.empty()) return;
+
+        pan_or_scale side;
+        if (std::isdigit(token.front())) {
+            side.emplace<Pan>(*format_.parse(token));
+        } else {
+            side.emplace<std::weak_ptr<Scale>>(intern(token, stamp).scale);
+        }
+
+        auto& s = shard_of(owner.scale->name);
+        std::scoped_lock guard{s.lock};
+        if (side_index >= owner.side_stamps.size()) owner.side_stamps.resize(side_index + 1);
+        if (owner.side_stamps[side_index] > stamp) return; // a later line already assigned this side
+        owner.side_stamps[side_index] = stamp;
+        if (side_index >= owner.scale->side_count()) owner.scale->extra_sides.resize(side_index - 1);
+        owner.scale->side(side_index) = std::move(side);
+    }
+
+    mass_format format_;
+    std::array<shard, shard_count> shards_;
+};
+
+/**
+ * @brief Parses several inputs concurrently into one list of interconnected scales.
+ * @param inputs The input streams, in global order.
+ * @param labels Names of the inputs used in diagnostics.
+ * @param scales_list Output vector to hold the constructed scales.
+ * @param max_threads Maximum number of worker threads.
+ * @param format Notation of the masses in every input.
+ */
+inline void parse_scale_streams(std::span<std::istream* const> inputs, std::span<const std::string> labels,
+                                std::vector<scale_wrapper>& scales_list, unsigned max_threads,
+                                const mass_format& format = {}) {
+    scale_ingest ingest{format};
+    std::atomic<std::size_t> next{0};
+    auto worker = [&] {
+        for (auto i = next++; i < inputs.size(); i = next++) {
+            ingest.parse(*inputs[i], i, i < labels.size() ? std::string_view{labels[i]} : "input");
+        }
+    };
+
+    const auto threads = std::clamp<std::size_t>(max_threads, 1, std::max<std::size_t>(inputs.size(), 1));
+    {
+        std::vector<std::jthread> pool;
+        for (std::size_t t = 1; t < threads; ++t) pool.emplace_back(worker);
+        worker();
+    }
+    ingest.finish(scales_list);
+}
+
+/**
+ * @brief Parses several files concurrently into one list of interconnected scales.
+ * @param paths The files, in global order.
+ * @param scales_list Output vector to hold the constructed scales.
+ * @param max_threads Maximum number of worker threads.
+ * @param format Notation of the masses in every file.
+ * @param metrics Counts the bytes and lines read, if given.
+ * @return False if a file could not be opened; nothing is parsed in that case.
+ */
+inline bool parse_scale_files(std::span<const std::string> paths, std::vector<scale_wrapper>& scales_list,
+                              unsigned max_threads, const mass_format& format = {}, run_metrics* metrics = nullptr) {
+    std::vector<std::ifstream> files;
+    files.reserve(paths.size()); // the counting buffers keep pointers into the files
+    std::vector<std::unique_ptr<counting_streambuf>> counters;
+    std::vector<std::unique_ptr<std::istream>> counted;
+    std::vector<std::istream*> inputs;
+    for (const auto& path : paths) {
+        auto& file = files.emplace_back(path);
+        if (!file) {
+            std::cerr << "Cannot open input: " << std::quoted(path) << '\n';
+            return false;
+        }
+        if (metrics) {
+            counters.push_back(std::make_unique<counting_streambuf>(*file.rdbuf(), *metrics));
+            inputs.push_back(counted.emplace_back(std::make_unique<std::istream>(counters.back().get())).get());
+        } else {
+            inputs.push_back(&file);
+        }
+    }
+    parse_scale_streams(inputs, paths, scales_list, max_threads, format);
+    return true;
+}
@@ -0,0 +1,494 @@
+/**
+ * @file pipeline.hpp
+ * @brief Parse, balance and report pipeline assembled from compile-time policies.
+ *
+ * The Scale graph pays for every feature on every run: masses are checked nowhere but
+ * stored behind variants and weak pointers, names live in one string per scale, and each
+ * phase carries its own bookkeeping. scale_pipeline instead keeps the graph in flat arrays
+ * indexed by scale and takes each concern as a template parameter:
+ * - Mass: the mass type and its arithmetic (int_mass, checked_mass, wide_mass);
+ * - Names: how scale names are stored and looked up (hashed_names, interned_names);
+ * - Allocation: where the per-scale arrays live (default_allocation, arena_allocation);
+ * - Instrumentation: what the phases record (no_instrumentation, metrics_instrumentation);
+ * - Engine: how the levels are walked (sequential_engine, level_engine).
+ *
+ * Policies that do nothing are empty types whose calls inline away, so the minimal
+ * configuration compiles down to the bare parse loop, one pass over the sides per level
+ * and the formatting loop. Whatever the policies, the input is read exactly like
+ * parse_scales(), and the report is byte-identical to balance_with() followed by
+ * report_changes() on the same input.
+ */
+
+#pragma once
+
+#include "engine.hpp"
+#include "run_metrics.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory_resource>
+
+/**
+ * @brief Mass policy: plain int arithmetic, exactly as the Scale graph does it.
+ */
+struct int_mass {
+    using value_type = int;                 ///< Type of masses and counterweights.
+    static constexpr bool checked = false;  ///< Whether add() and multiply() detect overflow.
+
+    /// @brief Stores a + b in @p sum; returns false on overflow.
+    static bool add(value_type a, value_type b, value_type& sum) {
+        sum = a + b;
+        return true;
+    }
+
+    /// @brief Stores a * k in @p product; returns false on overflow.
+    static bool multiply(value_type a, std::size_t k, value_type& product) {
+        product = static_cast<value_type>(k) * a;
+        return true;
+    }
+};
+
+/**
+ * @brief Mass policy: int arithmetic that reports totals too heavy for int.
+ */
+struct checked_mass {
+    using value_type = int;                ///< Type of masses and counterweights.
+    static constexpr bool checked = true;  ///< Whether add() and multiply() detect overflow.
+
+    /// @brief Stores a + b in @p sum; returns false on overflow.
+    static bool add(value_type a, value_type b, value_type& sum) { return !__builtin_add_overflow(a, b, &sum); }
+
+    /// @brief Stores a * k in @p product; returns false on overflow.
+    static bool multiply(value_type a, std::size_t k, value_type& product) {
+        return !__builtin_mul_overflow(a, k, &product);
+    }
+};
+
+/**
+ * @brief Mass policy: 64-bit totals, for deep graphs whose sums outgrow int.
+ *
+ * Pan masses are still read as int, like everywhere else.
+ */
+struct wide_mass {
+    using value_type = std::int64_t;        ///< Type of masses and counterweights.
+    static constexpr bool checked = false;  ///< Whether add() and multiply() detect overflow.
+
+    /// @brief Stores a + b in @p sum; returns false on overflow.
+    static bool add(value_type a, value_type b, value_type& sum) {
+        sum = a + b;
+        return true;
+    }
+
+    /// @brief Stores a * k in @p product; returns false on overflow.
+    static bool multiply(value_type a, std::size_t k, value_type& product) {
+        product = static_cast<value_type>(k) * a;
+        return true;
+    }
+};
+
+/**
+ * @brief Name policy: one std::string per scale in a hash map, like parse_scales().
+ */
+class hashed_names {
+public:
+    /**
+     * @brief Looks up @p name, adding it with the next id if it is new.
+     * @return The id and whether the name was added.
+     */
+    std::pair<std::uint32_t, bool> intern(std::string_view name) {
+        if (const auto it = ids_.find(name); it != ids_.end()) return {it->second, false};
+        const auto id = static_cast<std::uint32_t>(names_.size());
+        names_.push_back(&ids_.emplace(std::string{name}, id).first->first);
+        return {id, true};
+    }
+
+    /// @brief Name of scale @p id.
+    [[nodiscard]] std::string_view name(std::uint32_t id) const { return *names_[id]; }
+
+    /// @brief Number of names.
+    [[nodiscard]] std::size_t size() const { return names_.size(); }
+
+private:
+    struct string_hash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+
+    std::unordered_map<std::string, std::uint32_t, string_hash, std::equal_to<>> ids_;
+    std::vector<const std::string*> names_; ///< Keys of ids_ by id; map nodes never move.
+};
+
+/**
+ * @brief Name policy: names packed back to back into large chunks.
+ *
+ * Saves the allocation and header of one string per scale, and keeps the names of
+ * consecutive scales on the same cache lines when the report prints them.
+ */
+class interned_names {
+public:
+    /**
+     * @brief Looks up @p name, adding it with the next id if it is new.
+     * @return The id and whether the name was added.
+     */
+    std::pair<std::uint32_t, bool> intern(std::string_view name) {
+        if (const auto it = ids_.find(name); it != ids_.end()) return {it->second, false};
+        if (left_ < name.size()) {
+            left_ = std::max(chunk_size, name.size());
+            chunks_.push_back(std::make_unique<char[]>(left_));
+            free_ = chunks_.back().get();
+        }
+        const std::string_view stored{free_, name.size()};
+        std::ranges::copy(name, free_);
+        free_ += name.size();
+        left_ -= name.size();
+
+        const auto id = static_cast<std::uint32_t>(names_.size());
+        names_.push_back(stored);
+        ids_.emplace(stored, id);
+        return {id, true};
+    }
+
+    /// @brief Name of scale @p id.
+    [[nodiscard]] std::string_view name(std::uint32_t id) const { return names_[id]; }
+
+    /// @brief Number of names.
+    [[nodiscard]] std::size_t size() const { return names_.size(); }
+
+private:
+    static constexpr std::size_t chunk_size{1 << 16};
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* free_{};        ///< Next free byte of the last chunk.
+    std::size_t left_{};  ///< Free bytes left in the last chunk.
+    std::unordered_map<std::string_view, std::uint32_t> ids_;
+    std::vector<std::string_view> names_;
+};
+
+/**
+ * @brief Allocation policy: every array on the global heap.
+ */
+struct default_allocation {
+    template <typename T>
+    using vector = std::vector<T>; ///< Array type of the pipeline.
+
+    /// @brief Creates an empty array.
+    template <typename T>
+    vector<T> make_vector() {
+        return {};
+    }
+};
+
+/**
+ * @brief Allocation policy: every array carved from one monotonic arena.
+ *
+ * The per-scale side lists become bump allocations that are never freed one by one;
+ * the whole arena goes away with the pipeline.
+ */
+struct arena_allocation {
+    template <typename T>
+    using vector = std::pmr::vector<T>; ///< Array type of the pipeline.
+
+    /// @brief Creates an empty array in the arena.
+    template <typename T>
+    vector<T> make_vector() {
+        return vector<T>{&arena};
+    }
+
+    std::pmr::monotonic_buffer_resource arena; ///< Backs every array of the pipeline.
+};
+
+/**
+ * @brief Instrumentation policy: records nothing, at no cost.
+ */
+struct no_instrumentation {
+    struct mark {}; ///< Start of a phase.
+
+    mark start() const { return {}; }
+    void finish(run_counter, mark) const {}
+    void count(run_counter, std::uint64_t) const {}
+};
+
+/**
+ * @brief Instrumentation policy: times the phases and counts the input into run_metrics.
+ */
+struct metrics_instrumentation {
+    using mark = std::chrono::steady_clock::time_point; ///< Start of a phase.
+
+    run_metrics* metrics{}; ///< Receives the counters; nothing is recorded if null.
+
+    mark start() const { return std::chrono::steady_clock::now(); }
+
+    void finish(run_counter counter, mark started) const {
+        if (metrics) metrics->add_elapsed(counter, started);
+    }
+
+    void count(run_counter counter, std::uint64_t value) const {
+        if (metrics) metrics->add(counter, value);
+    }
+};
+
+/**
+ * @brief Engine policy: walks the levels on the calling thread.
+ */
+struct sequential_engine {
+    template <typename Visit>
+    void operator()(const shape_profile& shape, Visit&& visit) const {
+        visit_levels(shape, {}, visit);
+    }
+};
+
+/**
+ * @brief Engine policy: walks each level with a pool of threads; see visit_levels_parallel().
+ */
+struct level_engine {
+    unsigned threads{1}; ///< Number of threads, including the calling one.
+
+    template <typename Visit>
+    void operator()(const shape_profile& shape, Visit&& visit) const {
+        visit_levels(shape, {balance_engine::level_parallel, threads}, visit);
+    }
+};
+
+/**
+ * @brief Parses, balances and reports scales over flat arrays, with each concern a policy.
+ *
+ * parse() may be called for several inputs in turn; they share one namespace, as if
+ * concatenated. Scales keep the order of their first mention.
+ * @tparam Mass Mass type and arithmetic.
+ * @tparam Names Storage of the scale names.
+ * @tparam Allocation Storage of the per-scale arrays.
+ * @tparam Instrumentation What the phases record.
+ * @tparam Engine How the levels are balanced.
+ */
+template <typename Mass = int_mass, typename Names = hashed_names, typename Allocation = default_allocation,
+          typename Instrumentation = no_instrumentation, typename Engine = sequential_engine>
+class scale_pipeline {
+public:
+    using mass_type = typename Mass::value_type; ///< Type of masses and counterweights.
+
+    /**
+     * @param format Notation of the masses in the input and the report.
+     * @param instrumentation The instrumentation policy.
+     * @param engine The engine policy.
+     */
+    explicit scale_pipeline(const mass_format& format = {}, Instrumentation instrumentation = {}, Engine engine = {})
+        : format_{format}, instrumentation_{instrumentation}, engine_{engine} {}
+
+    scale_pipeline(const scale_pipeline&) = delete;
+    scale_pipeline& operator=(const scale_pipeline&) = delete;
+
+    /// @brief Number of scales parsed so far.
+    [[nodiscard]] std::size_t size() const { return sides_.size(); }
+
+    /**
+     * @brief Reads scale definitions with the same rules and diagnostics as parse_scales().
+     * @param in The input stream.
+     */
+    void parse(std::istream& in) {
+        const auto started = instrumentation_.start();
+        std::uint64_t rows = 0;
+        std::uint64_t bytes = 0;
+        std::string line;
+        for (int line_number = 0; std::getline(in, line); ++line_number) {
+            ++rows;
+            bytes += line.size() + 1;
+            if (line.empty() || line.front() == '#') continue; // skip comment lines.
+
+            const auto fields = split_fields(line);
+            const std::string_view name = fields.front();
+            const auto tokens = fields.subspan(1);
+            if (name.empty() || std::ranges::find(tokens, name) != tokens.end() || has_invalid_mass(tokens, format_)) {
+                std::cerr << "Invalid line " << line_number << ": " << std::quoted(line) << '\n';
+                continue;
+            }
+
+            const auto id = scale_id(name);
+            if (sides_[id].size() < tokens.size()) sides_[id].resize(tokens.size());
+            for (std::size_t i = 0; i < tokens.size(); ++i) {
+                const auto& token = tokens[i];
+                if (token.empty()) continue;
+                // Look the child up first: adding it may grow sides_
+                const auto child = std::isdigit(static_cast<unsigned char>(token.front())) ? no_child : scale_id(token);
+                sides_[id][i] = child == no_child ? side{no_child, *format_.parse(token)} : side{child, 0};
+            }
+        }
+        linked_ = false;
+        instrumentation_.count(run_counter::rows_parsed, rows);
+        instrumentation_.count(run_counter::parse_bytes, bytes);
+        instrumentation_.finish(run_counter::parse_ns, started);
+    }
+
+    /**
+     * @brief Balances every scale after the scales hanging from it.
+     * @return False, after reporting it, if a total mass overflowed a checked mass type.
+     */
+    [[nodiscard]] bool balance() {
+        const auto started = instrumentation_.start();
+        if (!linked_) link();
+        const auto self = static_cast<mass_type>(format_.unit());
+        std::ranges::fill(total_, self);
+        std::ranges::fill(scale_balance_, mass_type{});
+        std::ranges::fill(pan_balance_, mass_type{});
+        overflowed_.store(no_child, std::memory_order_relaxed);
+
+        engine_(shape_, [&](std::uint32_t i) { balance_node(i, self); });
+        instrumentation_.finish(run_counter::balance_ns, started);
+
+        if constexpr (Mass::checked) {
+            if (const auto i = overflowed_.load(std::memory_order_relaxed); i != no_child) {
+                std::cerr << "Mass overflow in scale " << std::quoted(names_.name(i)) << '\n';
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Writes one CSV row of counterweights per scale, like report_changes().
+     * @param os The output stream.
+     */
+    void report(std::ostream& os) const {
+        const auto started = instrumentation_.start();
+        constexpr std::size_t flush_at{1 << 16};
+        std::vector<char> out(flush_at + mass_format::max_chars);
+        std::size_t used = 0;
+        auto flush = [&] {
+            os.write(out.data(), static_cast<std::streamsize>(used));
+            used = 0;
+        };
+        for (std::uint32_t i = 0; i < links_.size(); ++i) {
+            const auto name = names_.name(i);
+            if (used + name.size() > flush_at) flush();
+            if (name.size() > flush_at) os.write(name.data(), static_cast<std::streamsize>(name.size()));
+            else used = std::ranges::copy(name, out.data() + used).out - out.data();
+
+            for (auto s = links_.side_offsets[i]; s < links_.side_offsets[i + 1]; ++s) {
+                if (used > flush_at) flush();
+                out[used++] = ',';
+                const auto child = links_.side_child[s];
+                const auto balance = child == no_child ? pan_balance_[s] : scale_balance_[child];
+                used = format_.write(out.data() + used, out.data() + out.size(), balance) - out.data();
+            }
+            out[used++] = '\n';
+        }
+        flush();
+        instrumentation_.finish(run_counter::report_ns, started);
+    }
+
+private:
+    static constexpr std::uint32_t no_child{scale_links::no_child};
+
+    /// @brief One side of a scale as parsed: a child scale, or a pan and its mass.
+    struct side {
+        std::uint32_t child{no_child}; ///< Child scale, or no_child for a pan.
+        int mass{};                    ///< Mass of the pan.
+    };
+
+    /**
+     * @brief Splits @p line like parse_fields(), reusing the field strings across lines.
+     */
+    std::span<const std::string> split_fields(std::string_view line) {
+        std::size_t count = 0;
+        for (std::size_t start = 0;; ++count) {
+            const auto comma = line.find(',', start);
+            if (fields_.size() <= count) fields_.emplace_back();
+            auto& field = fields_[count];
+            field.assign(line.substr(start, comma == std::string_view::npos ? line.npos : comma - start));
+            std::erase_if(field, ::isspace);
+            if (comma == std::string_view::npos) break;
+            start = comma + 1;
+        }
+        ++count;
+        while (count > 3 && fields_[count - 1].empty()) --count;
+        for (; count < 3; ++count) {
+            if (fields_.size() <= count) fields_.emplace_back();
+            fields_[count].clear();
+        }
+        return std::span{fields_}.first(count);
+    }
+
+    /**
+     * @brief Id of the scale named @p name, adding it with two empty pans if it is new.
+     */
+    std::uint32_t scale_id(std::string_view name) {
+        const auto [id, added] = names_.intern(name);
+        if (added) sides_.emplace_back(2);
+        return id;
+    }
+
+    /**
+     * @brief Flattens the parsed sides into child links and pan masses, and profiles them.
+     */
+    void link() {
+        const auto n = sides_.size();
+        links_ = {};
+        links_.side_offsets.reserve(n + 1);
+        pan_mass_.clear();
+        for (const auto& scale_sides : sides_) {
+            for (const auto& s : scale_sides) {
+                links_.side_child.push_back(s.child);
+                pan_mass_.push_back(static_cast<mass_type>(s.mass));
+            }
+            links_.side_offsets.push_back(static_cast<std::uint32_t>(links_.side_child.size()));
+        }
+        shape_ = profile_shape(links_);
+        total_.resize(n);
+        scale_balance_.resize(n);
+        pan_balance_.resize(pan_mass_.size());
+        linked_ = true;
+    }
+
+    /**
+     * @brief Balances scale @p i; see balance_sides().
+     *
+     * A sub-scale's counterweight is stored with the sub-scale, as Scale does, so the
+     * report reads the same value for it whichever parent side it is printed under.
+     */
+    void balance_node(std::uint32_t i, mass_type self) {
+        const auto first = links_.side_offsets[i];
+        const auto last = links_.side_offsets[i + 1];
+        auto mass_of = [&](std::uint32_t s) {
+            const auto child = links_.side_child[s];
+            return child == no_child ? pan_mass_[s] : total_[child];
+        };
+
+        auto heaviest = std::numeric_limits<mass_type>::min();
+        for (auto s = first; s < last; ++s) heaviest = std::max(heaviest, mass_of(s));
+        for (auto s = first; s < last; ++s) {
+            const auto child = links_.side_child[s];
+            (child == no_child ? pan_balance_[s] : scale_balance_[child]) = heaviest - mass_of(s);
+        }
+
+        mass_type sides_mass{};
+        if (!Mass::multiply(heaviest, last - first, sides_mass) || !Mass::add(self, sides_mass, total_[i])) {
+            auto none = no_child;
+            overflowed_.compare_exchange_strong(none, i, std::memory_order_relaxed);
+        }
+    }
+
+    Allocation allocation_; ///< Declared first, so it outlives the arrays it backs.
+    mass_format format_;
+    [[no_unique_address]] Instrumentation instrumentation_;
+    [[no_unique_address]] Engine engine_;
+
+    Names names_;
+    std::vector<std::string> fields_; ///< Fields of the current line.
+    typename Allocation::template vector<typename Allocation::template vector<side>> sides_{
+        allocation_.template make_vector<typename Allocation::template vector<side>>()};
+
+    bool linked_{};
+    scale_links links_;
+    shape_profile shape_;
+    typename Allocation::template vector<mass_type> pan_mass_{allocation_.template make_vector<mass_type>()};
+    typename Allocation::template vector<mass_type> total_{allocation_.template make_vector<mass_type>()};
+    typename Allocation::template vector<mass_type> scale_balance_{allocation_.template make_vector<mass_type>()};
+    typename Allocation::template vector<mass_type> pan_balance_{allocation_.template make_vector<mass_type>()};
+    std::atomic<std::uint32_t> overflowed_{no_child}; ///< First scale whose total overflowed.
+};
+
+/// @brief Smallest pipeline: plain int masses, hashed names, heap arrays, no metrics, one thread.
+using minimal_pipeline = scale_pipeline<>;
+
+/// @brief Fully featured pipeline: overflow checks, packed names, one arena, metrics, level threads.
+using checked_pipeline =
+    scale_pipeline<checked_mass, interned_names, arena_allocation, metrics_instrumentation, level_engine>;
@@ -0,0 +1,104 @@
+/**
+ * @file report_stream.hpp
+ * @brief Streaming report mode that writes rows while the graph is still being balanced.
+ *
+ * Rows are reported in scales_list order, but the engines finish scales bottom-up and, in
+ * the parallel engine, in no fixed order within a level. A reorder buffer records which
+ * scales are final and releases the longest complete prefix of rows as soon as it grows,
+ * so downstream consumers start reading before the last scale is balanced. The bytes
+ * written are identical to balancing first and calling report_changes() afterwards.
+ */
+
+#pragma once
+
+#include "engine.hpp"
+
+#include <atomic>
+
+/**
+ * @brief Tracks finished scales and writes the complete prefix of report rows.
+ *
+ * complete() may be called from any number of threads; drain() from one consumer only.
+ */
+class reorder_buffer {
+public:
+    /**
+     * @brief Creates a buffer for @p size rows, none of them finished.
+     */
+    explicit reorder_buffer(std::size_t size) : done_(size) {}
+
+    /**
+     * @brief Marks scales as final and wakes the consumer.
+     * @param indices Indices of the finished scales in output order.
+     */
+    void complete(std::span<const std::uint32_t> indices) {
+        for (const auto i : indices) done_[i].store(true, std::memory_order_release);
+        epoch_.fetch_add(1, std::memory_order_release);
+        epoch_.notify_one();
+    }
+
+    /**
+     * @brief Writes every row of the finished prefix not written yet.
+     * @param os The output stream.
+     * @param scales_list The scales in output order.
+     * @param format Notation of the printed masses.
+     * @return Number of rows written.
+     */
+    std::size_t drain(std::ostream& os, std::span<const scale_wrapper> scales_list, const mass_format& format = {}) {
+        const auto first = next_;
+        while (next_ < done_.size() && done_[next_].load(std::memory_order_acquire)) {
+            report_scale(os, *scales_list[next_++], format);
+        }
+        return next_ - first;
+    }
+
+    /// @brief True once every row has been written.
+    [[nodiscard]] bool finished() const { return next_ == done_.size(); }
+
+    /// @brief Counter bumped by every complete() call.
+    [[nodiscard]] std::uint64_t epoch() const { return epoch_.load(std::memory_order_acquire); }
+
+    /// @brief Blocks until epoch() differs from @p seen.
+    void wait(std::uint64_t seen) const { epoch_.wait(seen, std::memory_order_acquire); }
+
+private:
+    std::vector<std::atomic<bool>> done_;
+    std::atomic<std::uint64_t> epoch_{0};
+    std::size_t next_{0};
+};
+
+/**
+ * @brief Balances all scales and streams their report rows as they become final.
+ *
+ * The sequential engine drains the buffer itself after every level; the parallel engine
+ * hands the output to a dedicated writer thread, so formatting overlaps with balancing.
+ * The stream is flushed whenever new rows were written.
+ * @param os The output stream.
+ * @param scales_list The scales to balance and report.
+ * @param shape The profile of the scales.
+ * @param choice Engine and thread count.
+ * @param format Notation of the printed masses.
+ */
+inline void balance_and_stream(std::ostream& os, std::span<scale_wrapper> scales_list,
+                               const shape_profile& shape, const engine_choice& choice,
+                               const mass_format& format = {}) {
+    reorder_buffer rows{scales_list.size()};
+
+    if (choice.engine != balance_engine::level_parallel || choice.threads <= 1) {
+        balance_with(scales_list, shape, choice, [&](std::span<const std::uint32_t> level) {
+            rows.complete(level);
+            if (rows.drain(os, scales_list, format) > 0) os.flush();
+        });
+        return;
+    }
+
+    std::jthread writer{[&] {
+        while (true) {
+            const auto seen = rows.epoch();
+            if (rows.drain(os, scales_list, format) > 0) os.flush();
+            if (rows.finished()) break;
+            rows.wait(seen);
+        }
+    }};
+    balance_with(scales_list, shape, choice, [&](std::span<const std::uint32_t> chunk) { rows.complete(chunk); });
+}
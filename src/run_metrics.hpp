@@ -0,0 +1,220 @@
+/**
+ * @file run_metrics.hpp
+ * @brief Run-time metrics, exposed as a periodically rewritten Prometheus text file.
+ *
+ * Counters live in per-thread slots (see thread_slots.hpp), so the parsing workers and
+ * request handlers bump them without ever touching a shared cache line; the exporter
+ * thread sums the slots when it writes the file. Each refresh writes a temporary file and
+ * renames it over the target, so a scraper never reads a half-written file.
+ */
+
+#pragma once
+
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <streambuf>
+#include <string>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+/**
+ * @brief Monotonic counters tracked during a run.
+ */
+enum class run_counter : std::uint8_t { rows_parsed, parse_bytes, parse_ns, balance_ns, report_ns };
+
+/// @brief Number of run_counter values.
+inline constexpr std::size_t run_counter_count{5};
+
+/**
+ * @brief Counters of one run, summed over all threads on demand.
+ */
+class run_metrics {
+public:
+    /**
+     * @brief Adds @p value to @p counter in the calling thread's slot.
+     */
+    void add(run_counter counter, std::uint64_t value) {
+        auto& slot = slots_.local()[static_cast<std::size_t>(counter)];
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Adds the time since @p start to a nanosecond counter.
+     */
+    void add_elapsed(run_counter counter, std::chrono::steady_clock::time_point start) {
+        add(counter, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start).count()));
+    }
+
+    /**
+     * @brief Sum of @p counter over all threads.
+     */
+    [[nodiscard]] std::uint64_t total(run_counter counter) const {
+        std::uint64_t sum = 0;
+        slots_.for_each([&](const auto& slot) {
+            sum += slot[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+        });
+        return sum;
+    }
+
+private:
+    thread_slots<std::array<std::atomic<std::uint64_t>, run_counter_count>> slots_;
+};
+
+/**
+ * @brief Stream buffer that passes another one through and counts the bytes and lines read.
+ *
+ * Counting happens once per refill of a 64 KiB buffer, in the reading thread's slot.
+ */
+class counting_streambuf : public std::streambuf {
+public:
+    /**
+     * @brief Wraps @p source; both @p source and @p metrics must outlive the buffer.
+     */
+    counting_streambuf(std::streambuf& source, run_metrics& metrics) : source_{source}, metrics_{metrics} {}
+
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        const auto n = source_.sgetn(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        if (n <= 0) return traits_type::eof();
+        metrics_.add(run_counter::parse_bytes, static_cast<std::uint64_t>(n));
+        const auto lines = std::count(buffer_.data(), buffer_.data() + n, '\n');
+        metrics_.add(run_counter::rows_parsed, static_cast<std::uint64_t>(lines));
+        setg(buffer_.data(), buffer_.data(), buffer_.data() + n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::streambuf& source_;
+    run_metrics& metrics_;
+    std::array<char, 1 << 16> buffer_;
+};
+
+/**
+ * @brief Resident memory of the process in bytes, or its peak if the current size is unknown.
+ */
+inline std::uint64_t resident_memory_bytes() {
+    std::ifstream statm{"/proc/self/statm"};
+    std::uint64_t size = 0, resident = 0;
+    if (statm >> size >> resident) return resident * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+/**
+ * @brief Values sampled from outside run_metrics for one refresh of the metrics file.
+ */
+struct metrics_sample {
+    std::uint64_t graph_scales{};     ///< Scales currently in the graph.
+    std::uint64_t queue_depth{};      ///< Edits waiting for or holding the graph lock.
+    const latency_stats* latencies{}; ///< Request latencies, if a server is running.
+};
+
+/**
+ * @brief Writes all metrics in the Prometheus text exposition format.
+ * @param os The output stream.
+ * @param metrics The run's counters.
+ * @param sample Gauges and latencies sampled for this refresh.
+ */
+inline void write_prometheus(std::ostream& os, const run_metrics& metrics, const metrics_sample& sample) {
+    auto metric = [&](std::string_view name, std::string_view type, std::string_view help, auto value) {
+        os << "# HELP scaleblancer_" << name << ' ' << help << "\n# TYPE scaleblancer_" << name << ' ' << type
+           << "\nscaleblancer_" << name << ' ' << value << '\n';
+    };
+    auto seconds = [&](run_counter counter) { return static_cast<double>(metrics.total(counter)) / 1e9; };
+
+    const auto parse_seconds = seconds(run_counter::parse_ns);
+    const auto parse_bytes = metrics.total(run_counter::parse_bytes);
+    metric("rows_parsed_total", "counter", "Input lines read.", metrics.total(run_counter::rows_parsed));
+    metric("parse_bytes_total", "counter", "Input bytes read.", parse_bytes);
+    metric("parse_seconds_total", "counter", "Wall time spent parsing input.", parse_seconds);
+    metric("parse_bytes_per_second", "gauge", "Input bytes parsed per second of parsing.",
+           parse_seconds > 0 ? static_cast<double>(parse_bytes) / parse_seconds : 0.0);
+    metric("balance_seconds_total", "counter", "Wall time spent balancing.", seconds(run_counter::balance_ns));
+    metric("report_seconds_total", "counter", "Wall time spent writing the report.", seconds(run_counter::report_ns));
+    metric("graph_scales", "gauge", "Scales in the graph.", sample.graph_scales);
+    metric("resident_memory_bytes", "gauge", "Resident memory of the process.", resident_memory_bytes());
+    metric("update_queue_depth", "gauge", "Edits waiting for or holding the graph lock.", sample.queue_depth);
+
+    if (!sample.latencies) return;
+    os << "# HELP scaleblancer_request_latency_seconds Server request latency.\n"
+       << "# TYPE scaleblancer_request_latency_seconds summary\n";
+    for (std::size_t p = 0; p < latency_path_count; ++p) {
+        const auto path = static_cast<latency_path>(p);
+        const auto histogram = sample.latencies->snapshot(path);
+        for (const auto q : {0.5, 0.9, 0.99, 0.999}) {
+            os << "scaleblancer_request_latency_seconds{path=\"" << latency_path_name(path) << "\",quantile=\"" << q
+               << "\"} " << static_cast<double>(histogram.value_at(q)) / 1e9 << '\n';
+        }
+        os << "scaleblancer_request_latency_seconds_sum{path=\"" << latency_path_name(path) << "\"} "
+           << static_cast<double>(histogram.sum()) / 1e9 << '\n';
+        os << "scaleblancer_request_latency_seconds_count{path=\"" << latency_path_name(path) << "\"} "
+           << histogram.count() << '\n';
+    }
+}
+
+/**
+ * @brief Background thread rewriting a metrics file at a fixed interval, and once more on stop.
+ */
+class metrics_exporter {
+public:
+    /**
+     * @brief Starts refreshing @p path every @p interval.
+     * @param path The metrics file.
+     * @param interval Time between refreshes.
+     * @param metrics The run's counters; must outlive the exporter.
+     * @param sample Called on the exporter thread to sample gauges for each refresh.
+     */
+    metrics_exporter(std::string path, std::chrono::milliseconds interval, const run_metrics& metrics,
+                     std::function<metrics_sample()> sample)
+        : path_{std::move(path)}, metrics_{metrics}, sample_{std::move(sample)},
+          thread_{[this, interval](std::stop_token stop) {
+              while (!stop.stop_requested()) {
+                  refresh();
+                  std::unique_lock guard{lock_};
+                  wake_.wait_for(guard, stop, interval, [] { return false; });
+              }
+          }} {}
+
+    metrics_exporter(const metrics_exporter&) = delete;
+    metrics_exporter& operator=(const metrics_exporter&) = delete;
+
+    /**
+     * @brief Stops refreshing and writes the final values.
+     */
+    ~metrics_exporter() {
+        thread_.request_stop();
+        thread_.join();
+        refresh();
+    }
+
+private:
+    /// Rewrites the file; returns false if it could not be written.
+    bool refresh() const {
+        const auto temporary = path_ + ".tmp";
+        {
+            std::ofstream out{temporary};
+            write_prometheus(out, metrics_, sample_());
+            if (!out) return false;
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, path_, error);
+        return !error;
+    }
+
+    std::string path_;
+    const run_metrics& metrics_;
+    std::function<metrics_sample()> sample_;
+    std::mutex lock_;
+    std::condition_variable_any wake_; ///< Never notified; the wait ends on timeout or stop.
+    std::jthread thread_;             ///< Declared last, so it starts after the members it uses.
+};
@@ -0,0 +1,414 @@
+/**
+ * @file scale.hpp
+ * @brief Core model of ScaleBalancer: pans, scales, parsing, balancing and reporting.
+ *
+ * Every other module builds on the types and passes declared here. The functions are
+ * header-only so that the application and the test suites share one definition.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+#include <ranges>
+
+/**
+ * @brief Represents a pan with weight and optional counterbalance.
+ */
+struct Pan {
+    static constexpr int default_mass{0}; ///< Default mass for a pan (0).
+    int mass{};           ///< Weight placed on the pan.
+    int balance_mass{};   ///< Additional mass added for balancing.
+
+    /**
+     * @brief Constructs a Pan with optional initial weight.
+     * @param kg Initial mass (default is 0).
+     */
+    explicit Pan(int kg = default_mass) : mass{kg} {}
+};
+
+/**
+ * @brief A scale can can hold either a Pan or a weak reference to another Scale.
+ */
+
+struct Scale;
+using scale_wrapper = std::shared_ptr<Scale>;
+using pan_or_scale = std::variant<Pan, std::weak_ptr<Scale>>;
+
+/**
+ * @brief Represents a composite scale which can contain Pans or other Scales on each side.
+ */
+struct Scale final : Pan {
+    static constexpr int default_mass{1}; ///< Default self-mass for a Scale.
+    int self_mass{default_mass};          ///< Mass of the beam itself, in mass units.
+    std::string name;                     ///< Identifier of the scale.
+    pan_or_scale left;                    ///< Left side: Pan or linked Scale.
+    pan_or_scale right;                   ///< Right side: Pan or linked Scale.
+    std::vector<pan_or_scale> extra_sides; ///< Further sides of a scale with more than two pans.
+
+    /**
+     * @brief Constructs a Scale with a name.
+     * @param n The name of the scale.
+     * @param self Mass of the beam itself, in mass units (see mass_format::unit()).
+     */
+    explicit Scale(std::string n, int self = default_mass)
+        : Pan{self}, self_mass{self}, name{std::move(n)},
+          left{std::in_place_type<Pan>},
+          right{std::in_place_type<Pan>} {}
+
+    /// @brief Number of sides, two unless extra sides were added.
+    [[nodiscard]] std::size_t side_count() const { return 2 + extra_sides.size(); }
+
+    /// @brief The side at @p i: 0 is left, 1 is right, then the extra sides.
+    pan_or_scale& side(std::size_t i) { return i == 0 ? left : i == 1 ? right : extra_sides[i - 2]; }
+
+    /// @brief The side at @p i: 0 is left, 1 is right, then the extra sides.
+    [[nodiscard]] const pan_or_scale& side(std::size_t i) const {
+        return i == 0 ? left : i == 1 ? right : extra_sides[i - 2];
+    }
+
+    /**
+     * @brief Resolves a mutable pan_or_scale variant to a reference to the underlying Pan.
+     * @param side A variant holding either a Pan or weak_ptr to Scale.
+     * @return Reference to the resolved Pan.
+     */
+    static Pan& resolve_side(pan_or_scale& side) {
+        return std::holds_alternative<Pan>(side)
+            ? std::get<Pan>(side)
+            : *std::get<std::weak_ptr<Scale>>(side).lock();
+    }
+
+    /**
+     * @brief Resolves a const pan_or_scale variant to a reference to the underlying Pan.
+     * @param side A variant holding either a Pan or weak_ptr to Scale.
+     * @return Const reference to the resolved Pan.
+     */
+    static const Pan& resolve_side(const pan_or_scale& side) {
+        return std::holds_alternative<Pan>(side)
+            ? std::get<Pan>(side)
+            : *std::get<std::weak_ptr<Scale>>(side).lock();
+    }
+};
+
+/**
+ * @brief Fixed-point notation of masses: N decimal places, stored as integers scaled by 10^N.
+ *
+ * Only parsing and printing know about the decimal point; in between, masses stay plain
+ * integers, so balancing remains exact and runs through the same integer kernels. With
+ * zero places, the default, masses read and print as whole numbers exactly as before.
+ */
+struct mass_format {
+    static constexpr unsigned max_decimals{6}; ///< Keeps a kilogram, 10^decimals units, well inside int.
+
+    static constexpr std::size_t max_chars{24};  ///< Buffer size that fits any write().
+    static constexpr std::size_t max_width{12};  ///< Longest output of write(), e.g. `-2147.483647`.
+
+    unsigned decimals{}; ///< Digits after the decimal point.
+
+    /// @brief Number of units in one whole mass, i.e. 10^decimals.
+    [[nodiscard]] constexpr int unit() const {
+        int u = 1;
+        for (unsigned i = 0; i < decimals; ++i) u *= 10;
+        return u;
+    }
+
+    /**
+     * @brief Converts a decimal token such as `12.345` to units.
+     *
+     * Reads digits up to the first character that is neither a digit nor the first dot,
+     * like std::stoi() does for whole numbers, so digits beyond the configured places are
+     * cut off.
+     * @param token The token; expected to start with a digit.
+     * @return The mass in units, or nothing if it does not fit an int.
+     */
+    [[nodiscard]] constexpr std::optional<int> parse(std::string_view token) const {
+        constexpr std::int64_t limit = std::numeric_limits<int>::max();
+        std::int64_t value = 0;
+        std::size_t i = 0;
+        auto digit = [&](std::size_t at) { return at < token.size() && token[at] >= '0' && token[at] <= '9'; };
+        for (; digit(i); ++i) {
+            value = value * 10 + (token[i] - '0');
+            if (value > limit) return std::nullopt;
+        }
+
+        unsigned places = 0;
+        if (i < token.size() && token[i] == '.') {
+            for (++i; digit(i) && places < decimals; ++i, ++places) value = value * 10 + (token[i] - '0');
+        }
+        for (; places < decimals; ++places) value *= 10;
+        if (value > limit) return std::nullopt;
+        return static_cast<int>(value);
+    }
+
+    /**
+     * @brief Writes @p mass in decimal notation, without allocating.
+     * @param first Start of the output buffer.
+     * @param last End of the buffer; max_chars bytes always suffice.
+     * @return One past the last character written.
+     */
+    template <std::integral Mass>
+    char* write(char* first, char* last, Mass mass) const {
+        if (decimals == 0) return std::to_chars(first, last, mass).ptr;
+        auto magnitude = static_cast<std::uint64_t>(mass);
+        if (mass < 0) {
+            *first++ = '-';
+            magnitude = 0 - magnitude;
+        }
+        const auto u = static_cast<std::uint64_t>(unit());
+        first = std::to_chars(first, last, magnitude / u).ptr;
+        *first++ = '.';
+        auto fraction = magnitude % u;
+        for (auto i = decimals; i-- > 0; fraction /= 10) first[i] = static_cast<char>('0' + fraction % 10);
+        return first + decimals;
+    }
+
+    /**
+     * @brief Writes @p mass to @p os in decimal notation.
+     */
+    void print(std::ostream& os, int mass) const {
+        std::array<char, max_chars> buffer;
+        const auto* end = write(buffer.data(), buffer.data() + buffer.size(), mass);
+        os.write(buffer.data(), end - buffer.data());
+    }
+};
+
+/**
+ * @brief Parses a CSV line of format "name,left,right" and returns trimmed tokens.
+ * @param line The input line string.
+ * @return Tuple containing name, left, and right strings.
+ */
+inline std::tuple<std::string, std::string, std::string> parse_line(const std::string& line) {
+    auto parts = line
+        | std::views::split(',')
+        | std::views::transform([](auto&& r) {
+            std::string token(&*r.begin(), std::ranges::distance(r));
+            std::erase_if(token, ::isspace);
+            return token;
+        });
+
+    auto it = parts.begin();
+    const auto name  = it != parts.end() ? *it++ : "";
+    const auto left  = it != parts.end() ? *it++ : "";
+    const auto right = it != parts.end() ? *it++ : "";
+    return {name, left, right};
+}
+
+/**
+ * @brief Parses a CSV line of format "name,side,side[,side...]" and returns trimmed tokens.
+ * @param line The input line string.
+ * @return The name followed by at least two side tokens, missing ones being empty;
+ *         empty trailing tokens beyond the second side are dropped.
+ */
+inline std::vector<std::string> parse_fields(const std::string& line) {
+    std::vector<std::string> fields;
+    for (auto&& r : line | std::views::split(',')) {
+        std::string token(&*r.begin(), std::ranges::distance(r));
+        std::erase_if(token, ::isspace);
+        fields.push_back(std::move(token));
+    }
+    while (fields.size() > 3 && fields.back().empty()) fields.pop_back();
+    if (fields.size() < 3) fields.resize(3);
+    return fields;
+}
+
+/**
+ * @brief True if one of @p tokens is a mass, i.e. starts with a digit, too large for an int.
+ */
+inline bool has_invalid_mass(std::span<const std::string> tokens, const mass_format& format) {
+    return std::ranges::any_of(tokens, [&](const std::string& token) {
+        return !token.empty() && std::isdigit(static_cast<unsigned char>(token.front())) && !format.parse(token);
+    });
+}
+
+/**
+ * @brief Parses input stream to construct a list of interconnected scales.
+ * @param infile Input stream containing scale definitions.
+ * @param scales_list Output vector to hold the constructed scales.
+ * @param format Notation of the masses in the input.
+ */
+inline void parse_scales(std::istream& infile, std::vector<scale_wrapper>& scales_list,
+                         const mass_format& format = {}) {
+    scales_list.clear();
+    std::unordered_map<std::string, scale_wrapper> known_scales;
+
+    auto get_or_create_scale = [&](const std::string& name) -> scale_wrapper {
+        if (auto it = known_scales.find(name); it != known_scales.end()) {
+            return it->second;
+        }
+        auto scale = std::make_shared<Scale>(name, format.unit());
+        known_scales[name] = scale;
+        scales_list.push_back(scale);
+        return scale;
+    };
+
+    auto assign_side = [&](auto& side, const std::string& token) {
+        if (!token.empty() && std::isdigit(token.front())) {
+            side.template emplace<Pan>(*format.parse(token));
+        } else if (!token.empty()) {
+            side.template emplace<std::weak_ptr<Scale>>(get_or_create_scale(token));
+        }
+    };
+
+    std::string line;
+    for (int line_number = 0;std::getline(infile, line); ++line_number) {
+        if (line.empty() || line.front() == '#') continue; // skip comment lines.
+
+        const auto fields = parse_fields(line);
+        const auto& name = fields.front();
+        const auto sides = std::span{fields}.subspan(1);
+
+        // Validate the parsed scales parameters
+        if (name.empty() || std::ranges::find(sides, name) != sides.end() || has_invalid_mass(sides, format)) {
+            std::cerr << "Invalid line " << line_number << ": " << std::quoted(line) << '\n';
+            continue;
+        }
+
+        // Add/update the referenced scale.
+        auto scale = get_or_create_scale(name);
+        if (scale->side_count() < sides.size()) scale->extra_sides.resize(sides.size() - 2);
+        for (std::size_t i = 0; i < sides.size(); ++i) assign_side(scale->side(i), sides[i]);
+    }
+}
+
+/**
+ * @brief Tops every side up to the heaviest one: balances[i] = max(masses) - masses[i].
+ *
+ * Written as two branch-free loops over contiguous arrays so that the compiler turns both
+ * the max reduction and the subtraction into SIMD code for wide scales.
+ * @param masses Mass on each side.
+ * @param balances Receives the counterweight for each side; same size as @p masses.
+ * @return The heaviest side's mass.
+ */
+inline int balance_sides(std::span<const int> masses, std::span<int> balances) {
+    int heaviest = std::numeric_limits<int>::min();
+    for (const auto m : masses) heaviest = m > heaviest ? m : heaviest;
+    for (std::size_t i = 0; i < masses.size(); ++i) balances[i] = heaviest - masses[i];
+    return heaviest;
+}
+
+/**
+ * @brief Balances a scale with more than two sides; see balance_scale().
+ *
+ * Up to inline_sides sides are gathered into arrays on the stack and run through
+ * balance_sides(); wider scales take a max pass and a subtract pass over the sides in
+ * place. Either way nothing is allocated.
+ * @param scale The scale to balance.
+ */
+inline void balance_many_sides(Scale& scale) {
+    constexpr std::size_t inline_sides{64};
+    const auto k = scale.side_count();
+    int heaviest = std::numeric_limits<int>::min();
+    if (k <= inline_sides) {
+        std::array<Pan*, inline_sides> pans;
+        std::array<int, inline_sides> masses;
+        std::array<int, inline_sides> balances;
+        for (std::size_t i = 0; i < k; ++i) {
+            pans[i] = &Scale::resolve_side(scale.side(i));
+            masses[i] = pans[i]->mass;
+        }
+        heaviest = balance_sides(std::span{masses}.first(k), std::span{balances}.first(k));
+        for (std::size_t i = 0; i < k; ++i) pans[i]->balance_mass = balances[i];
+    } else {
+        for (std::size_t i = 0; i < k; ++i) heaviest = std::max(heaviest, Scale::resolve_side(scale.side(i)).mass);
+        for (std::size_t i = 0; i < k; ++i) {
+            auto& pan = Scale::resolve_side(scale.side(i));
+            pan.balance_mass = heaviest - pan.mass;
+        }
+    }
+    scale.mass = scale.self_mass + static_cast<int>(k) * heaviest;
+}
+
+/**
+ * @brief Balances a single scale whose sides are already balanced.
+ *
+ * Sets the counterweight on the lighter side, clears it on the heavier one and stores the
+ * scale's total mass, so calling it again after a side changed recomputes from scratch.
+ * @param scale The scale to balance.
+ */
+inline void balance_scale(Scale& scale) {
+    if (!scale.extra_sides.empty()) {
+        balance_many_sides(scale);
+        return;
+    }
+    auto& left_pan = Scale::resolve_side(scale.left);
+    auto& right_pan = Scale::resolve_side(scale.right);
+
+    left_pan.balance_mass = right_pan.mass > left_pan.mass ? right_pan.mass - left_pan.mass : 0;
+    right_pan.balance_mass = left_pan.mass > right_pan.mass ? left_pan.mass - right_pan.mass : 0;
+
+    scale.mass = scale.self_mass + left_pan.mass + right_pan.mass
+               + left_pan.balance_mass + right_pan.balance_mass;
+}
+
+/**
+ * @brief Balances all scales by computing and assigning necessary counterweights.
+ *
+ * Walks the scales from the last one back and balances each only after the scales it
+ * holds, so any listing order works; input that lists every scale before the scales it
+ * holds is balanced in plain reverse order. Links closing a cycle are not followed.
+ * @param scales_list A span of scales to balance.
+ */
+inline void balance_each_scale(std::span<scale_wrapper> scales_list) {
+    std::unordered_set<const Scale*> visited;
+    visited.reserve(scales_list.size());
+    std::vector<std::pair<Scale*, std::size_t>> stack; // a scale and the next side to descend into
+    for (const auto& scale : scales_list | std::views::reverse) {
+        if (!visited.insert(scale.get()).second) continue;
+        stack.emplace_back(scale.get(), 0);
+        while (!stack.empty()) {
+            auto& [node, next_side] = stack.back();
+            if (next_side == node->side_count()) {
+                balance_scale(*node);
+                stack.pop_back();
+                continue;
+            }
+            const auto& side = node->side(next_side++);
+            if (!std::holds_alternative<std::weak_ptr<Scale>>(side)) continue;
+            const auto child = std::get<std::weak_ptr<Scale>>(side).lock();
+            if (child && visited.insert(child.get()).second) stack.emplace_back(child.get(), 0);
+        }
+    }
+}
+
+/**
+ * @brief Outputs the balancing result of one scale as a CSV row.
+ * @param os The output stream.
+ * @param scale The balanced scale.
+ * @param format Notation of the printed masses.
+ */
+inline void report_scale(std::ostream& os, const Scale& scale, const mass_format& format = {}) {
+    os << scale.name;
+    for (std::size_t i = 0; i < scale.side_count(); ++i) {
+        os.put(',');
+        format.print(os, Scale::resolve_side(scale.side(i)).balance_mass);
+    }
+    os.put('\n');
+}
+
+/**
+ * @brief Outputs the balancing results for each scale to an output stream.
+ * @param os The output stream.
+ * @param scales_list The list of scales to report on.
+ * @param format Notation of the printed masses.
+ */
+inline void report_changes(std::ostream& os, std::span<scale_wrapper> scales_list, const mass_format& format = {}) {
+    for (const auto& scale : scales_list) {
+        report_scale(os, *scale, format);
+    }
+}
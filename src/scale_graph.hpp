@@ -0,0 +1,747 @@
+/**
+ * @file scale_graph.hpp
+ * @brief A balanced scale graph that supports structural edits.
+ *
+ * scale_graph owns a balanced set of scales together with a name table and a parent link
+ * per scale, which the plain scales list lacks. Moving a sub-assembly to a different
+ * scale (link) or taking it off its scale (cut) rebalances only the ancestors of the
+ * changed sides, walking up the parent links and stopping at the first scale whose total
+ * mass did not change, since nothing above it can change either.
+ *
+ * The walk is bounded by the depth of the tree, and the depth is in turn bounded by the
+ * width of the mass type: a scale weighs at least one more than twice its heaviest child,
+ * so a scale d levels above a pan already weighs 2^(d+1) - 1. Any tree whose masses do not
+ * overflow is therefore at most as deep as the mass type has bits, and every edit costs
+ * O(log M) for a root mass M. The graph makes sure masses never overflow: scales that do
+ * not balance within int are refused when the graph is built, and every edit first
+ * computes the new masses up the edited path, in 64 bits, and is refused if one of them
+ * exceeds max_mass. No tree is thus deeper than 31 levels, and every walk up the parent
+ * links, to rebalance, to check for cycles or to find a root, takes at most 31 steps.
+ *
+ * Whole scale definitions can be added, have a side replaced or be removed. Each edit is
+ * validated locally: a new child must not already hang elsewhere and must not be an
+ * ancestor of its new parent, which only needs a walk up from the edited scale. Removed
+ * scales leave a null hole in the scales list so that indices stay stable; compact()
+ * squeezes the holes out and relocates the remaining scales, after which indices change.
+ *
+ * An imbalance_index of the scales by required balance, partitioned by tree, follows the
+ * edits lazily: rebalancing marks a scale and a structural edit marks the top of the moved
+ * subtree, both in O(1), and refresh_imbalances() updates the marked ones. A burst of
+ * weight edits along the same path therefore costs one index update per changed scale,
+ * not per edit, and a moved subtree is only relabelled if its tree differs from the one
+ * it is filed under, once per refresh: moves within a tree, such as a cut followed by a
+ * link, and subtrees moved back before the next query relabel nothing.
+ *
+ * On request, the graph also journals which scales each edit touched, for change
+ * subscribers; see journal_changes() and take_changes().
+ */
+
+#pragma once
+
+#include "compaction.hpp"
+#include "imbalance_index.hpp"
+
+#include <array>
+#include <optional>
+#include <string_view>
+
+/**
+ * @brief Names of the first two sides of a scale; further sides are numbered from 2 on.
+ */
+struct scale_side {
+    enum : std::uint32_t { left = 0, right = 1 };
+};
+
+/**
+ * @brief A balanced scale graph with parent links, a name table and structural edits.
+ */
+class scale_graph {
+public:
+    static constexpr std::uint32_t no_scale{~std::uint32_t{0}}; ///< Marks a missing scale.
+
+    /**
+     * @brief Where a scale hangs: its parent and the parent's side holding it.
+     */
+    struct attachment {
+        std::uint32_t parent{no_scale}; ///< The parent scale, or no_scale for a root.
+        std::uint32_t side{};           ///< The parent's side holding the scale.
+    };
+
+    /// Heaviest mass a scale may reach; edits that would go beyond it are refused.
+    static constexpr std::int64_t max_mass{std::numeric_limits<int>::max()};
+
+    scale_graph() = default;
+
+    /**
+     * @brief Takes ownership of parsed scales and balances them.
+     *
+     * The scales must form a forest. If a scale hangs from more than one side, the scales
+     * form a cycle or a mass does not fit in int, the problem is reported on std::cerr and
+     * the graph is left empty and not valid().
+     * @param scales_list The scales, in output order.
+     * @param format Notation of the masses in edits and reports.
+     */
+    explicit scale_graph(std::vector<scale_wrapper> scales_list, const mass_format& format = {})
+        : scales_{std::move(scales_list)}, format_{format} {
+        const auto links = index_scales();
+        const auto shape = profile_shape(links);
+        if (!is_forest(links, shape)) {
+            *this = scale_graph{};
+            valid_ = false;
+            return;
+        }
+        for (const auto i : shape.order) {
+            if (balanced_mass(*scales_[i]) > max_mass) {
+                std::cerr << "Mass overflow in scale " << std::quoted(scales_[i]->name) << '\n';
+                *this = scale_graph{};
+                valid_ = false;
+                return;
+            }
+            balance_scale(*scales_[i]);
+        }
+        index_imbalances(shape);
+        count_scale_bytes();
+    }
+
+    /// @brief False if the scales given to the constructor were refused.
+    [[nodiscard]] bool valid() const { return valid_; }
+
+    /// @brief The scales, in output order; removed scales are null.
+    [[nodiscard]] std::span<const scale_wrapper> scales() const { return scales_; }
+
+    /// @brief Number of slots in the scales list, including holes.
+    [[nodiscard]] std::size_t size() const { return scales_.size(); }
+
+    /// @brief Notation of the masses in edits and reports.
+    [[nodiscard]] const mass_format& format() const { return format_; }
+
+    /// @brief Number of holes left by removed scales.
+    [[nodiscard]] std::size_t holes() const { return holes_; }
+
+    /**
+     * @brief Approximate heap bytes held by the graph: scales, names, links and indexes.
+     *
+     * Kept current by the edits, so it costs O(1); allocator overhead is not counted.
+     */
+    [[nodiscard]] std::size_t memory_bytes() const {
+        constexpr auto pointer = sizeof(void*);
+        return scale_bytes_ + scales_.capacity() * sizeof(scale_wrapper) + parents_.capacity() * sizeof(attachment)
+            + names_.size() * (sizeof(decltype(names_)::value_type) + 2 * pointer) + names_.bucket_count() * pointer
+            + stale_.capacity() + (rebalanced_.capacity() + moved_.capacity()) * sizeof(std::uint32_t) + touched_flag_.capacity()
+            + touched_.capacity() * sizeof(std::uint32_t) + imbalances_.memory_bytes();
+    }
+
+    /// @brief The scale at @p index.
+    [[nodiscard]] const Scale& scale(std::uint32_t index) const { return *scales_[index]; }
+
+    /**
+     * @brief Looks up a scale by name.
+     * @return Its index, or std::nullopt if there is no such scale.
+     */
+    [[nodiscard]] std::optional<std::uint32_t> find(std::string_view name) const {
+        if (auto it = names_.find(name); it != names_.end()) return it->second;
+        return std::nullopt;
+    }
+
+    /// @brief Where the scale at @p index hangs.
+    [[nodiscard]] attachment parent(std::uint32_t index) const { return parents_[index]; }
+
+    /// @brief The top-level scale of the tree holding @p index.
+    [[nodiscard]] std::uint32_t root_of(std::uint32_t index) const {
+        while (parents_[index].parent != no_scale) index = parents_[index].parent;
+        return index;
+    }
+
+    /**
+     * @brief The scales ordered by required balance, per tree, as of the last
+     *        refresh_imbalances().
+     */
+    [[nodiscard]] const imbalance_index& imbalances() const { return imbalances_; }
+
+    /// @brief True if some rebalanced or moved scales are not yet refiled in imbalances().
+    [[nodiscard]] bool imbalances_stale() const { return !rebalanced_.empty() || !moved_.empty(); }
+
+    /**
+     * @brief Scales touched by edits since the last take_changes().
+     */
+    struct changes {
+        /// @brief A removed scale and where it hung.
+        struct removal {
+            std::string name;               ///< Name of the removed scale.
+            std::uint32_t parent{no_scale}; ///< Its parent at removal, which may be gone since.
+        };
+
+        std::vector<std::uint32_t> touched; ///< Live scales that were created or rebalanced, each once.
+        std::vector<removal> removed;       ///< The scales removed, in order.
+    };
+
+    /**
+     * @brief Starts or stops journaling the scales that edits touch; off by default.
+     */
+    void journal_changes(bool on) {
+        journaling_ = on;
+        if (!on) static_cast<void>(take_changes());
+    }
+
+    /**
+     * @brief Hands over and clears the journal of touched scales.
+     *
+     * compact() drops the journal, since it invalidates the indices in it; take the
+     * changes before compacting.
+     */
+    changes take_changes() {
+        changes taken;
+        for (const auto index : touched_) {
+            touched_flag_[index] = 0;
+            if (scales_[index]) taken.touched.push_back(index);
+        }
+        touched_.clear();
+        taken.removed = std::move(removed_);
+        removed_.clear();
+        return taken;
+    }
+
+    /**
+     * @brief Refiles every scale rebalanced since the last call, in O(log N) each, and
+     *        every subtree moved to another tree since, in O(log N) per scale.
+     */
+    void refresh_imbalances() {
+        for (const auto top : moved_) {
+            stale_[top] &= ~stale_tree;
+            if (top >= scales_.size() || !scales_[top]) continue;
+            // Scales below a moved subtree top only change trees with it, or are marked themselves
+            if (const auto root = root_of(top); imbalances_.tree(top) != root) refile_subtree(top, root);
+        }
+        moved_.clear();
+        for (const auto index : rebalanced_) {
+            stale_[index] &= ~stale_balance;
+            if (index < scales_.size() && scales_[index]) imbalances_.update(index, required_balance(*scales_[index]));
+        }
+        rebalanced_.clear();
+    }
+
+    /**
+     * @brief True if @p ancestor is @p node or one of the scales it hangs from.
+     */
+    [[nodiscard]] bool is_ancestor(std::uint32_t ancestor, std::uint32_t node) const {
+        for (; node != no_scale; node = parents_[node].parent) {
+            if (node == ancestor) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Hangs the subtree of @p child on a side of @p parent.
+     *
+     * The child is first cut from its current parent. Whatever the side held before is
+     * replaced; a scale held there becomes a root.
+     * @return False, leaving the graph unchanged, if the edit would create a cycle or make
+     *         a mass exceed max_mass.
+     */
+    bool link(std::uint32_t child, std::uint32_t parent, std::uint32_t side) {
+        if (is_ancestor(child, parent) || side >= scales_[parent]->side_count()) return false;
+        const auto from = parents_[child];
+        cut(child); // only ever lightens, and may lighten the new parent's path
+        if (!fits(parent, mass_with(parent, side, scales_[child]->mass))) {
+            if (from.parent != no_scale) {
+                attach(child, from.parent, from.side);
+                rebalance_from(from.parent);
+            }
+            return false;
+        }
+        attach(child, parent, side);
+        rebalance_from(parent);
+        return true;
+    }
+
+    /**
+     * @brief Takes the subtree of @p child off its parent, leaving an empty pan behind.
+     *
+     * Does nothing for a root.
+     */
+    void cut(std::uint32_t child) {
+        const auto [parent, side] = parents_[child];
+        if (parent == no_scale) return;
+        detach_side(parent, side);
+        side_of(parent, side).emplace<Pan>();
+        rebalance_from(parent);
+    }
+
+    /**
+     * @brief Adds a new root scale, like a `name,side,side[,side...]` input line.
+     *
+     * Sides name existing root scales or masses; unknown names create empty scales, as
+     * parse_scales() does, and empty tokens leave a side as an empty pan. An empty scale
+     * created that way is a placeholder that a later add() defines in place, wherever it
+     * hangs, just like a later input line would.
+     * @return The scale's index, or std::nullopt, leaving the graph unchanged, if the name
+     *         is taken by a scale that is not a placeholder, a side is invalid or a mass
+     *         would exceed max_mass.
+     */
+    std::optional<std::uint32_t> add(const std::string& name, std::span<const std::string> sides) {
+        if (name.empty() || std::ranges::find(sides, name) != sides.end()) return std::nullopt;
+        if (has_repeated_scale(sides) || has_invalid_mass(sides, format_)) return std::nullopt;
+        if (const auto existing = find(name)) {
+            if (!is_placeholder(*existing) || !set(*existing, sides)) return std::nullopt;
+            return existing;
+        }
+        std::vector<std::int64_t> masses(std::max<std::size_t>(sides.size(), 2), 0);
+        for (std::size_t i = 0; i < sides.size(); ++i) {
+            if (!sides[i].empty() && !is_mass(sides[i])) {
+                if (const auto child = find(sides[i]); child && parents_[*child].parent != no_scale) return std::nullopt;
+            }
+            if (!sides[i].empty()) masses[i] = token_mass(sides[i]);
+        }
+        if (balanced_mass(format_.unit(), masses) > max_mass) return std::nullopt;
+
+        const auto index = create(name);
+        if (sides.size() > 2) resize_sides(*scales_[index], sides.size() - 2);
+        for (std::uint32_t i = 0; i < sides.size(); ++i) {
+            if (!sides[i].empty()) place(index, i, sides[i]);
+        }
+        rebalance_from(index);
+        return index;
+    }
+
+    /**
+     * @brief Adds a new two-sided root scale; see add().
+     */
+    std::optional<std::uint32_t> add(const std::string& name, const std::string& left, const std::string& right) {
+        const std::array<std::string, 2> sides{left, right};
+        return add(name, sides);
+    }
+
+    /**
+     * @brief Replaces one side of a scale with a mass or another scale.
+     * @param index The scale to edit.
+     * @param side The side to replace.
+     * @param token A mass, or the name of a root scale; unknown names create empty scales.
+     * @return False, leaving the graph unchanged, if the named scale already hangs from
+     *         another side, the edit would create a cycle or a mass would exceed max_mass.
+     *         A side past the last one adds empty pans up to it.
+     */
+    bool replace_side(std::uint32_t index, std::uint32_t side, const std::string& token) {
+        if (token.empty()) return false;
+        if (!can_hold(index, side, token)) return false;
+        if (!fits(index, mass_with(index, side, token_mass(token)))) return false;
+        place(index, side, token);
+        rebalance_from(index);
+        return true;
+    }
+
+    /**
+     * @brief Replaces several sides of a scale at once, like a redefining input line.
+     *
+     * A scale this one already holds may move to another of its sides, so two children
+     * can swap sides; a side it leaves and that is not set itself becomes an empty pan.
+     * @param index The scale to edit.
+     * @param sides New sides, left first; empty tokens keep the current side.
+     * @return False, leaving the graph unchanged, if any side is invalid or a mass would
+     *         exceed max_mass.
+     */
+    bool set(std::uint32_t index, std::span<const std::string> sides) {
+        if (has_repeated_scale(sides)) return false;
+        auto masses = side_masses(index);
+        if (sides.size() > masses.size()) masses.resize(sides.size(), 0);
+        std::vector<std::uint32_t> vacated; // sides whose scale moves to another side
+        for (std::uint32_t i = 0; i < sides.size(); ++i) {
+            if (sides[i].empty()) continue;
+            if (const auto from = held_on(index, sides[i]); from && *from != i) {
+                vacated.push_back(*from);
+            } else if (!can_hold(index, i, sides[i])) {
+                return false;
+            }
+            masses[i] = token_mass(sides[i]);
+        }
+        for (const auto side : vacated) {
+            if (side >= sides.size() || sides[side].empty()) masses[side] = 0;
+        }
+        if (!fits(index, balanced_mass(scales_[index]->self_mass, masses))) return false;
+        // All sides change before the one rebalancing walk, which only sees the final masses
+        for (const auto side : vacated) {
+            detach_side(index, side);
+            side_of(index, side).emplace<Pan>();
+        }
+        for (std::uint32_t i = 0; i < sides.size(); ++i) {
+            if (!sides[i].empty()) place(index, i, sides[i]);
+        }
+        rebalance_from(index);
+        return true;
+    }
+
+    /**
+     * @brief Replaces the left and right side of a scale at once; see set().
+     */
+    bool set(std::uint32_t index, const std::string& left, const std::string& right) {
+        const std::array<std::string, 2> sides{left, right};
+        return set(index, sides);
+    }
+
+    /**
+     * @brief True for a scale that was only named as a side and never defined: all its
+     *        sides are empty pans. add() may still define it.
+     */
+    [[nodiscard]] bool is_placeholder(std::uint32_t index) const {
+        const auto& scale = *scales_[index];
+        for (std::size_t i = 0; i < scale.side_count(); ++i) {
+            const auto* pan = std::get_if<Pan>(&scale.side(i));
+            if (!pan || pan->mass != 0) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Checks whether a side of a scale may take a token, looking only at the scales
+     *        around the edit.
+     * @return True for masses that fit an int, unknown names, the scale already held there,
+     *         and root scales that are not an ancestor of @p index.
+     */
+    [[nodiscard]] bool can_hold(std::uint32_t index, std::uint32_t side, const std::string& token) const {
+        if (token.empty()) return true;
+        if (is_mass(token)) return format_.parse(token).has_value();
+        const auto existing = find(token);
+        if (!existing) return true;
+        const auto [parent, held_on] = parents_[*existing];
+        if (parent == index && held_on == side) return true;
+        return parent == no_scale && !is_ancestor(*existing, index);
+    }
+
+    /**
+     * @brief Retires a scale.
+     *
+     * Its parent's side becomes an empty pan and the scales it held become roots. The
+     * scale's slot turns into a hole until the next compact().
+     */
+    void remove(std::uint32_t index) {
+        if (journaling_) removed_.push_back({scales_[index]->name, parents_[index].parent});
+        cut(index);
+        for (std::uint32_t side = 0; side < scales_[index]->side_count(); ++side) detach_side(index, side);
+        imbalances_.erase(index);
+        names_.erase(scales_[index]->name);
+        scale_bytes_ -= scale_bytes(*scales_[index]);
+        scales_[index].reset();
+        ++holes_;
+    }
+
+    /**
+     * @brief The live scales relocated into one arena, as compact() leaves them, without
+     *        changing the graph.
+     *
+     * Only reads the graph, so it can run while queries go on; a graph built from the
+     * result, in the same format, equals this one after compact().
+     */
+    [[nodiscard]] std::vector<scale_wrapper> compacted_scales() const {
+        std::vector<scale_wrapper> live;
+        live.reserve(scales_.size() - holes_);
+        for (const auto& scale : scales_) {
+            if (scale) live.push_back(scale);
+        }
+        return compact_scales(live);
+    }
+
+    /**
+     * @brief Drops the holes left by removed scales and relocates the rest into one arena
+     *        laid out in balancing order; see compact_scales(). Invalidates all indices.
+     */
+    void compact() {
+        scales_ = compacted_scales();
+        count_scale_bytes();
+        holes_ = 0;
+        rebalanced_.clear();
+        moved_.clear();
+        touched_.clear();
+        touched_flag_.assign(scales_.size(), 0);
+        index_imbalances(profile_shape(index_scales()));
+    }
+
+    /**
+     * @brief Rebalances @p index and its ancestors after one of its sides changed.
+     * @return Number of scales rebalanced.
+     */
+    std::size_t rebalance_from(std::uint32_t index) {
+        std::size_t count = 0;
+        for (auto node = index; node != no_scale; node = parents_[node].parent) {
+            auto& scale = *scales_[node];
+            const auto previous_mass = scale.mass;
+            balance_scale(scale);
+            mark_rebalanced(node);
+            ++count;
+            if (scale.mass == previous_mass) break; // nothing above can change
+        }
+        return count;
+    }
+
+    /**
+     * @brief Writes the balancing results of all scales, as report_changes() does.
+     */
+    void report(std::ostream& os) const {
+        for (const auto& scale : scales_) {
+            if (scale) report_scale(os, *scale, format_);
+        }
+    }
+
+    /**
+     * @brief True if a side token denotes a mass rather than a scale name, as in parse_scales().
+     */
+    static bool is_mass(const std::string& token) {
+        return !token.empty() && std::isdigit(static_cast<unsigned char>(token.front()));
+    }
+
+    /**
+     * @brief True if the same scale name appears on more than one of @p sides.
+     */
+    static bool has_repeated_scale(std::span<const std::string> sides) {
+        for (std::size_t i = 0; i < sides.size(); ++i) {
+            if (sides[i].empty() || is_mass(sides[i])) continue;
+            if (std::ranges::find(sides.subspan(i + 1), sides[i]) != sides.end()) return true;
+        }
+        return false;
+    }
+
+private:
+    /// Rebuilds the name table and parent links from the scales list.
+    scale_links index_scales() {
+        auto links = link_scales(scales_);
+        parents_.assign(scales_.size(), {});
+        names_.clear();
+        names_.reserve(scales_.size());
+        for (std::uint32_t i = 0; i < scales_.size(); ++i) {
+            names_.emplace(scales_[i]->name, i);
+            const auto children = links.children(i);
+            for (std::uint32_t side = 0; side < children.size(); ++side) {
+                const auto child = children[side];
+                if (child != scale_links::no_child && parents_[child].parent == no_scale) parents_[child] = {i, side};
+            }
+        }
+        return links;
+    }
+
+    /// Queues a rebalanced scale for refresh_imbalances() and take_changes().
+    void mark_rebalanced(std::uint32_t index) {
+        mark_touched(index);
+        if (stale_.size() <= index) stale_.resize(scales_.size());
+        if (stale_[index] & stale_balance) return;
+        stale_[index] |= stale_balance;
+        rebalanced_.push_back(index);
+    }
+
+    /// Queues the top of a subtree that changed parents for refresh_imbalances().
+    void mark_moved(std::uint32_t top) {
+        if (stale_.size() <= top) stale_.resize(scales_.size());
+        if (stale_[top] & stale_tree) return;
+        stale_[top] |= stale_tree;
+        moved_.push_back(top);
+    }
+
+    /// Journals a created or rebalanced scale for take_changes().
+    void mark_touched(std::uint32_t index) {
+        if (!journaling_) return;
+        if (touched_flag_.size() <= index) touched_flag_.resize(scales_.size());
+        if (touched_flag_[index]) return;
+        touched_flag_[index] = 1;
+        touched_.push_back(index);
+    }
+
+    /// Files every scale in the imbalance index under its root; parents come later in the order.
+    void index_imbalances(const shape_profile& shape) {
+        imbalances_.clear();
+        stale_.assign(scales_.size(), 0);
+        std::vector<std::uint32_t> roots(scales_.size(), no_scale);
+        for (const auto i : shape.order | std::views::reverse) {
+            const auto parent = parents_[i].parent;
+            roots[i] = parent == no_scale ? i : roots[parent] != no_scale ? roots[parent] : root_of(i);
+            imbalances_.set(i, roots[i], required_balance(*scales_[i]));
+        }
+    }
+
+    /// Refiles the subtree of @p top under the tree rooted at @p tree.
+    void refile_subtree(std::uint32_t top, std::uint32_t tree) {
+        std::vector<std::uint32_t> stack{top};
+        while (!stack.empty()) {
+            const auto node = stack.back();
+            stack.pop_back();
+            imbalances_.move(node, tree);
+            const auto& scale = *scales_[node];
+            for (std::uint32_t side = 0; side < scale.side_count(); ++side) {
+                const auto& held = scale.side(side);
+                if (!std::holds_alternative<std::weak_ptr<Scale>>(held)) continue;
+                const auto child_scale = std::get<std::weak_ptr<Scale>>(held).lock();
+                const auto child = child_scale ? find(child_scale->name) : std::nullopt;
+                if (child && parents_[*child].parent == node && parents_[*child].side == side) stack.push_back(*child);
+            }
+        }
+    }
+
+    /// Mass of a scale weighing @p self once balanced over sides of @p side_masses, in 64 bits.
+    static std::int64_t balanced_mass(std::int64_t self, std::span<const std::int64_t> side_masses) {
+        return self + static_cast<std::int64_t>(side_masses.size()) * std::ranges::max(side_masses);
+    }
+
+    /// Mass of @p scale once balanced over its current sides, in 64 bits.
+    static std::int64_t balanced_mass(const Scale& scale) {
+        std::int64_t heaviest = std::numeric_limits<std::int64_t>::min();
+        for (std::size_t i = 0; i < scale.side_count(); ++i) {
+            heaviest = std::max<std::int64_t>(heaviest, Scale::resolve_side(scale.side(i)).mass);
+        }
+        return scale.self_mass + static_cast<std::int64_t>(scale.side_count()) * heaviest;
+    }
+
+    /// Reports the first scale held by two sides, or whose children lead back to it.
+    bool is_forest(const scale_links& links, const shape_profile& shape) const {
+        std::vector<std::uint8_t> held(links.size(), 0);
+        for (const auto child : links.side_child) {
+            if (child == scale_links::no_child) continue;
+            if (held[child]++) {
+                std::cerr << "Scale " << std::quoted(scales_[child]->name) << " hangs from more than one side\n";
+                return false;
+            }
+        }
+        // Every child sits below its parent, except on a cycle, which profile_shape() cuts open
+        for (std::uint32_t i = 0; i < links.size(); ++i) {
+            for (const auto child : links.children(i)) {
+                if (child != scale_links::no_child && shape.height[child] >= shape.height[i]) {
+                    std::cerr << "Cycle through scale " << std::quoted(scales_[i]->name) << '\n';
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// The side of scale @p index holding the scale named @p token, if it holds it.
+    [[nodiscard]] std::optional<std::uint32_t> held_on(std::uint32_t index, const std::string& token) const {
+        if (is_mass(token)) return std::nullopt;
+        const auto existing = find(token);
+        if (!existing || parents_[*existing].parent != index) return std::nullopt;
+        return parents_[*existing].side;
+    }
+
+    /// Current masses of the sides of scale @p index.
+    [[nodiscard]] std::vector<std::int64_t> side_masses(std::uint32_t index) const {
+        const auto& scale = *scales_[index];
+        std::vector<std::int64_t> masses(scale.side_count());
+        for (std::size_t i = 0; i < masses.size(); ++i) masses[i] = Scale::resolve_side(scale.side(i)).mass;
+        return masses;
+    }
+
+    /// Mass a side would weigh holding @p token: a mass, a scale, or a new empty scale.
+    [[nodiscard]] std::int64_t token_mass(const std::string& token) const {
+        if (is_mass(token)) return *format_.parse(token);
+        const auto existing = find(token);
+        return existing ? scales_[*existing]->mass : format_.unit();
+    }
+
+    /// Mass scale @p index would weigh once rebalanced with @p side weighing @p side_mass;
+    /// a side past the last one adds empty pans up to it.
+    [[nodiscard]] std::int64_t mass_with(std::uint32_t index, std::uint32_t side, std::int64_t side_mass) const {
+        const auto& scale = *scales_[index];
+        std::int64_t heaviest = side_mass;
+        for (std::uint32_t i = 0; i < scale.side_count(); ++i) {
+            if (i != side) heaviest = std::max<std::int64_t>(heaviest, Scale::resolve_side(scale.side(i)).mass);
+        }
+        const auto sides = std::max<std::size_t>(scale.side_count(), side + std::size_t{1});
+        return scale.self_mass + static_cast<std::int64_t>(sides) * heaviest;
+    }
+
+    /**
+     * True if scale @p index, once weighing @p mass, and every scale it hangs from stay
+     * within max_mass once rebalanced; the walk stops where a mass is unchanged.
+     */
+    [[nodiscard]] bool fits(std::uint32_t index, std::int64_t mass) const {
+        for (auto node = index; mass <= max_mass;) {
+            const auto [parent, side] = parents_[node];
+            if (parent == no_scale || mass == scales_[node]->mass) return true;
+            mass = mass_with(parent, side, mass);
+            node = parent;
+        }
+        return false;
+    }
+
+    /// Puts a mass or a scale on a side without rebalancing; a side past the last one adds
+    /// empty pans up to it. The token must have passed can_hold().
+    void place(std::uint32_t index, std::uint32_t side, const std::string& token) {
+        auto& scale = *scales_[index];
+        if (side >= scale.side_count()) resize_sides(scale, side - 1);
+        if (is_mass(token)) {
+            detach_side(index, side);
+            side_of(index, side).emplace<Pan>(*format_.parse(token));
+            return;
+        }
+        const auto existing = find(token);
+        if (existing && parents_[*existing].parent == index) return; // already in place
+        attach(existing ? *existing : create(token), index, side);
+    }
+
+    /// Hangs the root scale @p child on a side of @p parent, without rebalancing.
+    void attach(std::uint32_t child, std::uint32_t parent, std::uint32_t side) {
+        detach_side(parent, side);
+        side_of(parent, side).emplace<std::weak_ptr<Scale>>(scales_[child]);
+        parents_[child] = {parent, side};
+        mark_moved(child);
+    }
+
+    /// Appends a new, balanced root scale with empty pans.
+    std::uint32_t create(const std::string& name) {
+        const auto index = static_cast<std::uint32_t>(scales_.size());
+        auto& scale = scales_.emplace_back(std::make_shared<Scale>(name, format_.unit()));
+        balance_scale(*scale);
+        scale_bytes_ += scale_bytes(*scale);
+        parents_.emplace_back();
+        names_.emplace(scale->name, index);
+        imbalances_.set(index, index, required_balance(*scale));
+        mark_touched(index);
+        return index;
+    }
+
+    pan_or_scale& side_of(std::uint32_t index, std::uint32_t side) { return scales_[index]->side(side); }
+
+    /// Heap bytes of one scale: the object with its control block, its name and its extra sides.
+    static std::size_t scale_bytes(const Scale& scale) {
+        const auto name = scale.name.capacity() > std::string{}.capacity() ? scale.name.capacity() + 1 : 0;
+        return sizeof(Scale) + 2 * sizeof(void*) + name + scale.extra_sides.capacity() * sizeof(pan_or_scale);
+    }
+
+    void count_scale_bytes() {
+        scale_bytes_ = 0;
+        for (const auto& scale : scales_) {
+            if (scale) scale_bytes_ += scale_bytes(*scale);
+        }
+    }
+
+    /// Gives @p scale @p extra sides beyond left and right, keeping the byte count.
+    void resize_sides(Scale& scale, std::size_t extra) {
+        scale_bytes_ -= scale_bytes(scale);
+        scale.extra_sides.resize(extra);
+        scale_bytes_ += scale_bytes(scale);
+    }
+
+    /// Turns the scale held on a side, if any, into a root.
+    void detach_side(std::uint32_t index, std::uint32_t side) {
+        const auto& held = side_of(index, side);
+        if (!std::holds_alternative<std::weak_ptr<Scale>>(held)) return;
+        const auto scale = std::get<std::weak_ptr<Scale>>(held).lock();
+        if (!scale) return;
+        if (const auto it = names_.find(scale->name); it != names_.end()) {
+            parents_[it->second] = {};
+            scale->balance_mass = 0;
+            mark_moved(it->second);
+        }
+    }
+
+    std::vector<scale_wrapper> scales_;
+    mass_format format_;
+    std::vector<attachment> parents_;
+    std::unordered_map<std::string_view, std::uint32_t> names_;
+    std::size_t holes_{0};
+    bool valid_{true};
+    std::size_t scale_bytes_{0}; ///< scale_bytes() of the live scales.
+    imbalance_index imbalances_;
+    enum : std::uint8_t { stale_balance = 1, stale_tree = 2 }; ///< Bits of stale_.
+    std::vector<std::uint8_t> stale_;       ///< Per scale: queued in rebalanced_ and/or moved_.
+    std::vector<std::uint32_t> rebalanced_; ///< Scales to refile on the next refresh.
+    std::vector<std::uint32_t> moved_;      ///< Tops of subtrees to refile on the next refresh.
+    bool journaling_{false};
+    std::vector<std::uint8_t> touched_flag_; ///< Per scale: journaled in touched_.
+    std::vector<std::uint32_t> touched_;     ///< Journal of touched scales.
+    std::vector<changes::removal> removed_;  ///< Journal of removed scales.
+};
@@ -0,0 +1,542 @@
+/**
+ * @file scale_server.hpp
+ * @brief Line-oriented command interface to a scale_graph for incremental deployments.
+ *
+ * Each request is one line and each response ends with a newline:
+ *     GET name                 -> name,left_balance_mass,right_balance_mass
+ *     REPORT                   -> one row per scale, as report_changes(), then OK
+ *     ADD name,side,side...    -> OK, adds a scale, or defines one so far only named as a side
+ *     SET name,side,side...    -> OK, replaces the non-empty sides of a scale
+ *     REMOVE name              -> OK, retires a scale
+ *     LINK child parent side   -> OK, moves a subtree onto a side (left, right or a number) of parent
+ *     CUT child                -> OK, takes a subtree off its parent
+ *     STATS                    -> one latency line per path, as latency_stats::report(), then OK
+ *     ABOVE mass [name]        -> `name,required_balance` for every scale needing more than mass, then OK
+ *     RANGE low high [name]    -> the same for required balances in [low, high], then OK
+ *     TOP k [name]             -> the k scales needing the most counterweight, heaviest first, then OK
+ *     SUBSCRIBE name [subtree] -> OK, pushes the changes of a scale, or of its whole subtree
+ *     SUBSCRIBE *              -> OK, pushes the changes of every scale
+ *     UNSUBSCRIBE name         -> OK, stops pushing the changes of name (or *)
+ *     RELOAD file...           -> OK, starts replacing the whole graph with the scales of the files
+ *     RELOAD topology file     -> OK, the same from a binary topology file
+ * Failed requests answer `ERROR <reason>` and leave the graph unchanged.
+ *
+ * ABOVE and RANGE list the lightest match first. With a name, the three imbalance queries
+ * only search the tree holding that scale. They are answered from the graph's
+ * imbalance_index, in O(log N + k) for k matches.
+ *
+ * Subscriptions belong to a client, a serve() stream. Its change records (see
+ * change_feed.hpp), `CHANGE name,balance...` and `REMOVED name`, are pushed onto the same
+ * stream between responses, coalesced per scale over the notify window. A change-data-
+ * capture file can receive every change for offline consumers.
+ *
+ * RELOAD parses and balances the new graph on a background thread, with the concurrent
+ * file parser or the topology loader, while queries and edits go on against the old one.
+ * The new graph is then swapped in under the exclusive lock, which takes O(1), and the old
+ * one is freed on the background thread after the swap, once no reader holds it any more.
+ * Edits applied during a reload are lost with the old graph. Subscribers receive a
+ * `RELOADED` record after the swap, and STATS adds a `reload` line once there was one.
+ *
+ * Once removed scales leave holes in half of the scales list, the graph is compacted on a
+ * background thread, too: it copies the live scales into a fresh arena under the shared
+ * lock, builds the compacted graph without any lock, and then swaps it in under the
+ * exclusive lock, replaying the edits applied since the copy. Queries and edits therefore
+ * never wait for more than the copy. A reload that swaps in its graph first discards the
+ * compacted one.
+ *
+ * Both run on threads of their own unless run_background_with() hands them to an executor,
+ * such as the shared pool of a tenant_host, which may also refuse a reloaded graph.
+ *
+ * Requests may be handled from several threads: queries share a lock, edits take it
+ * exclusively. The latency of every query and edit, including the wait for the lock, is
+ * recorded, as is every compaction of the graph.
+ */
+
+#pragma once
+
+#include "change_feed.hpp"
+#include "latency_histogram.hpp"
+#include "parallel_ingest.hpp"
+#include "scale_graph.hpp"
+#include "topology_file.hpp"
+
+#include <charconv>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
+
+/**
+ * @brief Serves queries and edits against one scale graph.
+ */
+class scale_server {
+public:
+    /// Holes are compacted away once they make up this share of the scales list.
+    static constexpr double compaction_threshold{0.5};
+
+    static constexpr std::uint32_t no_client{0}; ///< A requester without a push channel.
+
+    /**
+     * @brief Where reloads and compactions run; see run_background_with().
+     */
+    struct background_config {
+        std::function<void(std::function<void()>)> run; ///< Runs a task; empty for a thread per task.
+        unsigned reload_threads{};                      ///< Threads parsing a reload; 0 for one per core.
+        std::function<bool(const scale_graph&)> admit;  ///< Refuses a reloaded graph by returning false.
+    };
+
+    /**
+     * @brief Serves @p graph.
+     * @param notify_window How long change records are coalesced before they are pushed.
+     * @param recording How the request latencies are counted.
+     */
+    explicit scale_server(scale_graph graph, std::chrono::milliseconds notify_window = {},
+                          latency_recording recording = latency_recording::per_thread)
+        : graph_{std::move(graph)}, hub_{notify_window}, stats_{recording} {
+        graph_.journal_changes(true);
+    }
+
+    /**
+     * @brief Hands reloads and compactions to @p config.run instead of threads of their own.
+     *
+     * Call before the first request. The server must outlive the tasks it hands over.
+     */
+    void run_background_with(background_config config) { background_ = std::move(config); }
+
+    /**
+     * @brief Handles one request line.
+     * @param request The request, without the trailing newline.
+     * @param client The client subscriptions are made for, as connected by serve().
+     * @return The response, ending with a newline.
+     */
+    std::string handle(std::string_view request, std::uint32_t client = no_client) {
+        const auto space = request.find(' ');
+        const auto verb = request.substr(0, space);
+        const auto args = space == std::string_view::npos ? std::string_view{} : request.substr(space + 1);
+
+        if (verb == "STATS") return stats();
+        if (verb == "SUBSCRIBE" || verb == "UNSUBSCRIBE") return subscription(verb, args, client);
+        if (verb == "RELOAD") return reload(args);
+        if (verb == "GET" || verb == "REPORT") {
+            const latency_timer timer{stats_, latency_path::query};
+            std::shared_lock guard{lock_};
+            return verb == "GET" ? get(args) : report();
+        }
+        if (verb == "ABOVE" || verb == "RANGE" || verb == "TOP") {
+            const latency_timer timer{stats_, latency_path::query};
+            {
+                std::shared_lock guard{lock_};
+                if (!graph_.imbalances_stale()) return imbalance_query(verb, args);
+            }
+            // Refile the scales rebalanced since the last imbalance query first
+            std::scoped_lock guard{lock_};
+            graph_.refresh_imbalances();
+            return imbalance_query(verb, args);
+        }
+        std::string response;
+        {
+            const latency_timer timer{stats_, latency_path::update};
+            const queued_edit queued{pending_edits_};
+            std::scoped_lock guard{lock_};
+            const bool logging = logging_edits();
+            response = edit(verb, args);
+            if (response.empty()) return error("unknown command");
+            if (logging && response == ok()) log_edit(request);
+            publish();
+        }
+        if (hub_.window().count() == 0) hub_.flush();
+        return response;
+    }
+
+    /**
+     * @brief Appends every change to @p path, one `<unix_ms> <record>` line each.
+     * @return False if the file cannot be opened.
+     */
+    bool capture_changes(const std::string& path) { return hub_.capture_to(path); }
+
+    /// @brief Pushes the pending change records now, without waiting for the window.
+    void flush_changes() { hub_.flush(); }
+
+    /**
+     * @brief Waits until no reload is running.
+     * @return True if the last reload, if any, swapped its graph in.
+     */
+    bool wait_for_reload() {
+        std::unique_lock lock{reload_mutex_};
+        reload_done_.wait(lock, [&] { return !reloading_; });
+        return last_reload_ok_ || reloads_ + reload_failures_ == 0;
+    }
+
+    /**
+     * @brief Waits until no compaction is running.
+     */
+    void wait_for_compaction() {
+        std::unique_lock lock{compaction_mutex_};
+        compaction_done_.wait(lock, [&] { return !compacting_; });
+    }
+
+    /// @brief Latencies of the requests handled so far.
+    [[nodiscard]] const latency_stats& latencies() const { return stats_; }
+
+    /// @brief Edits currently waiting for the graph lock or being applied.
+    [[nodiscard]] std::uint64_t queue_depth() const { return pending_edits_.load(std::memory_order_relaxed); }
+
+    /// @brief Number of scales in the graph, not counting holes.
+    [[nodiscard]] std::size_t scale_count() const {
+        std::shared_lock guard{lock_};
+        return graph_.size() - graph_.holes();
+    }
+
+    /// @brief Approximate heap bytes held by the graph; see scale_graph::memory_bytes().
+    [[nodiscard]] std::size_t memory_bytes() const {
+        std::shared_lock guard{lock_};
+        return graph_.memory_bytes();
+    }
+
+    /**
+     * @brief Runs the graph against a stream of requests until it ends.
+     *
+     * Several streams may be served at once, from different threads; each is a client of
+     * its own, whose change records are pushed onto its response stream. Its pending
+     * records are pushed when the stream ends.
+     * @param in The request stream.
+     * @param out The response stream, flushed after every response and record batch.
+     */
+    void serve(std::istream& in, std::ostream& out) {
+        std::mutex writing;
+        const auto client = hub_.connect([&](std::span<const std::string> records) {
+            std::lock_guard lock{writing};
+            for (const auto& record : records) out << record << '\n';
+            out << std::flush;
+        });
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line.front() == '#') continue;
+            const auto response = handle(line, client);
+            std::lock_guard lock{writing};
+            out << response << std::flush;
+        }
+        hub_.disconnect(client);
+    }
+
+private:
+    /// Counts an edit as queued for as long as it lives.
+    struct queued_edit {
+        explicit queued_edit(std::atomic<std::uint64_t>& count) : count_{count} { count_.fetch_add(1, std::memory_order_relaxed); }
+        ~queued_edit() { count_.fetch_sub(1, std::memory_order_relaxed); }
+        std::atomic<std::uint64_t>& count_;
+    };
+
+    static std::string error(std::string_view reason) { return "ERROR " + std::string{reason} + '\n'; }
+    static std::string ok() { return "OK\n"; }
+
+    std::string get(std::string_view name) const {
+        const auto index = graph_.find(name);
+        if (!index) return error("unknown scale");
+        std::ostringstream os;
+        report_scale(os, graph_.scale(*index), graph_.format());
+        return os.str();
+    }
+
+    std::string report() const {
+        std::ostringstream os;
+        graph_.report(os);
+        os << ok();
+        return os.str();
+    }
+
+    std::string imbalance_query(std::string_view verb, std::string_view args) const {
+        std::istringstream is{std::string{args}};
+        std::string first, second, tree_name;
+        is >> first;
+        if (verb == "RANGE") is >> second;
+        is >> tree_name;
+
+        const auto& format = graph_.format();
+        auto tree = imbalance_index::no_tree;
+        if (!tree_name.empty()) {
+            const auto index = graph_.find(tree_name);
+            if (!index) return error("unknown scale");
+            tree = graph_.imbalances().tree(*index);
+        }
+
+        std::vector<imbalance_index::hit> hits;
+        if (verb == "TOP") {
+            std::size_t k = 0;
+            if (std::from_chars(first.data(), first.data() + first.size(), k).ec != std::errc{}) return error("invalid count");
+            hits = graph_.imbalances().top(k, tree);
+        } else if (!scale_graph::is_mass(first) || !format.parse(first)
+                   || (verb == "RANGE" && (!scale_graph::is_mass(second) || !format.parse(second)))) {
+            return error("invalid mass");
+        } else if (verb == "ABOVE") {
+            hits = graph_.imbalances().above(*format.parse(first), tree);
+        } else {
+            hits = graph_.imbalances().range(*format.parse(first), *format.parse(second), tree);
+        }
+
+        std::ostringstream os;
+        for (const auto& hit : hits) {
+            os << graph_.scale(hit.scale).name << ',';
+            format.print(os, hit.balance);
+            os << '\n';
+        }
+        os << ok();
+        return os.str();
+    }
+
+    std::string subscription(std::string_view verb, std::string_view args, std::uint32_t client) {
+        if (client == no_client) return error("no push channel");
+        std::istringstream is{std::string{args}};
+        std::string name, mode;
+        is >> name >> mode;
+        if (name.empty() || (!mode.empty() && (mode != "subtree" || verb == "UNSUBSCRIBE"))) return error("invalid subscription");
+        if (verb == "UNSUBSCRIBE") {
+            if (name == "*") return hub_.watch_all(client, false) ? ok() : error("not subscribed");
+            return hub_.unwatch(client, name) ? ok() : error("not subscribed");
+        }
+        if (name == "*") {
+            hub_.watch_all(client);
+            return ok();
+        }
+        return hub_.watch(client, name, mode == "subtree") ? ok() : error("no push channel");
+    }
+
+    /// Queues change records for the scales the last edit touched; needs the exclusive lock.
+    void publish() {
+        auto changes = graph_.take_changes();
+        if (hub_.active()) hub_.collect(graph_, changes);
+    }
+
+    std::string reload(std::string_view args) {
+        std::istringstream is{std::string{args}};
+        std::vector<std::string> files{std::istream_iterator<std::string>{is}, {}};
+        const bool topology = !files.empty() && files.front() == "topology";
+        if (topology) files.erase(files.begin());
+        if (files.empty() || (topology && files.size() != 1)) return error("invalid reload");
+
+        std::lock_guard lock{reload_mutex_};
+        if (reloading_) return error("reload in progress");
+        reloading_ = true;
+        run_in_background(reloader_, [this, files = std::move(files), topology] { run_reload(files, topology); });
+        return ok();
+    }
+
+    /// Loads and balances the new graph, swaps it in and frees the old one; runs in the background.
+    void run_reload(const std::vector<std::string>& files, bool topology) {
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<scale_wrapper> scales_list;
+        mass_format format;
+        {
+            std::shared_lock guard{lock_};
+            format = graph_.format();
+        }
+        bool loaded = false;
+        if (topology) {
+            const mapped_file file{files.front()};
+            const topology_view view{file.bytes()};
+            if (view.valid()) {
+                load_topology(view, scales_list);
+                format = view.format();
+                loaded = true;
+            } else {
+                std::cerr << "Cannot load topology: " << std::quoted(files.front()) << '\n';
+            }
+        } else {
+            const auto threads = background_.reload_threads ? background_.reload_threads : std::thread::hardware_concurrency();
+            loaded = parse_scale_files(files, scales_list, std::max(1u, threads), format);
+        }
+
+        scale_graph fresh;
+        if (loaded) {
+            fresh = scale_graph{std::move(scales_list), format};
+            loaded = fresh.valid() && (!background_.admit || background_.admit(fresh));
+        }
+        if (loaded) {
+            fresh.journal_changes(true);
+            {
+                std::scoped_lock guard{lock_};
+                std::swap(graph_, fresh);
+                ++generation_; // a running compaction copied the old graph
+            }
+            hub_.broadcast("RELOADED");
+            if (hub_.window().count() == 0) hub_.flush();
+            // fresh now holds the old graph, which is freed here, outside the lock
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        std::lock_guard lock{reload_mutex_};
+        ++(loaded ? reloads_ : reload_failures_);
+        last_reload_ok_ = loaded;
+        last_reload_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        reloading_ = false;
+        reload_done_.notify_all();
+    }
+
+    std::string stats() const {
+        std::ostringstream os;
+        stats_.report(os);
+        {
+            std::lock_guard lock{reload_mutex_};
+            if (reloading_ || reloads_ || reload_failures_) {
+                os << "reload count=" << reloads_ << " failed=" << reload_failures_ << " running=" << reloading_
+                   << " last_ms=" << last_reload_ms_ << '\n';
+            }
+        }
+        os << ok();
+        return os.str();
+    }
+
+    std::string add(std::string_view definition) {
+        const auto fields = parse_fields(std::string{definition});
+        if (const auto index = graph_.find(fields.front()); index && !graph_.is_placeholder(*index)) {
+            return error("scale exists");
+        }
+        return graph_.add(fields.front(), std::span{fields}.subspan(1)) ? ok() : error("invalid definition");
+    }
+
+    std::string set(std::string_view definition) {
+        const auto fields = parse_fields(std::string{definition});
+        const auto sides = std::span{fields}.subspan(1);
+        const auto index = graph_.find(fields.front());
+        if (!index) return error("unknown scale");
+        if (std::ranges::find(sides, fields.front()) != sides.end()) return error("invalid definition");
+        return graph_.set(*index, sides) ? ok() : error("invalid definition");
+    }
+
+    std::string remove(std::string_view name) {
+        const auto index = graph_.find(name);
+        if (!index) return error("unknown scale");
+        graph_.remove(*index);
+        if (graph_.holes() > compaction_threshold * static_cast<double>(graph_.size())) start_compaction();
+        return ok();
+    }
+
+    /// Applies one edit request; needs the exclusive lock. Returns nothing for an unknown verb.
+    std::string edit(std::string_view verb, std::string_view args) {
+        if (verb == "ADD") return add(args);
+        if (verb == "SET") return set(args);
+        if (verb == "REMOVE") return remove(args);
+        if (verb == "LINK") return link(args);
+        if (verb == "CUT") return cut(args);
+        return {};
+    }
+
+    bool logging_edits() {
+        std::lock_guard lock{compaction_mutex_};
+        return logging_edits_;
+    }
+
+    void log_edit(std::string_view request) {
+        std::lock_guard lock{compaction_mutex_};
+        if (logging_edits_) edit_log_.emplace_back(request);
+    }
+
+    /// Starts compacting the graph in the background, unless that already runs; needs the exclusive lock.
+    void start_compaction() {
+        std::lock_guard lock{compaction_mutex_};
+        if (compacting_) return;
+        compacting_ = true;
+        run_in_background(compactor_, [this, generation = generation_] { run_compaction(generation); });
+    }
+
+    /// Runs @p task with background_.run, or else on @p thread, whose previous task is done.
+    template <typename Task>
+    void run_in_background(std::jthread& thread, Task task) {
+        if (background_.run) {
+            background_.run(std::move(task));
+            return;
+        }
+        if (thread.joinable()) thread.join();
+        thread = std::jthread{std::move(task)};
+    }
+
+    /// Builds the compacted graph, swaps it in and frees the old one; runs in the background.
+    void run_compaction(std::uint64_t generation) {
+        const latency_timer timer{stats_, latency_path::recompute};
+        std::vector<scale_wrapper> compacted;
+        mass_format format;
+        {
+            // Edits wait for the copy only; the ones applied after it are logged for replay
+            std::shared_lock guard{lock_};
+            compacted = graph_.compacted_scales();
+            format = graph_.format();
+            std::lock_guard lock{compaction_mutex_};
+            logging_edits_ = true;
+        }
+        scale_graph fresh{std::move(compacted), format};
+        {
+            std::scoped_lock guard{lock_};
+            std::vector<std::string> edits;
+            {
+                std::lock_guard lock{compaction_mutex_};
+                edits.swap(edit_log_);
+                logging_edits_ = false;
+            }
+            if (generation == generation_) {
+                std::swap(graph_, fresh);
+                // The edits were published when they were first applied, so the replay is not journaled
+                for (const auto& request : edits) {
+                    const auto space = request.find(' ');
+                    edit(std::string_view{request}.substr(0, space),
+                         space == std::string::npos ? std::string_view{} : std::string_view{request}.substr(space + 1));
+                }
+                graph_.journal_changes(true);
+            }
+        }
+        {
+            std::lock_guard lock{compaction_mutex_};
+            compacting_ = false;
+        }
+        compaction_done_.notify_all();
+        // fresh now holds the old graph, which is freed here, outside the lock
+    }
+
+    std::string link(std::string_view args) {
+        std::istringstream is{std::string{args}};
+        std::string child, parent, side;
+        is >> child >> parent >> side;
+        const auto c = graph_.find(child);
+        const auto p = graph_.find(parent);
+        if (!c || !p) return error("unknown scale");
+        std::uint32_t s = 0;
+        if (side == "left") s = scale_side::left;
+        else if (side == "right") s = scale_side::right;
+        else if (std::from_chars(side.data(), side.data() + side.size(), s).ec != std::errc{}) return error("invalid side");
+        if (s >= graph_.scale(*p).side_count()) return error("invalid side");
+        if (graph_.is_ancestor(*c, *p)) return error("cycle");
+        return graph_.link(*c, *p, s) ? ok() : error("mass overflow");
+    }
+
+    std::string cut(std::string_view name) {
+        const auto index = graph_.find(name);
+        if (!index) return error("unknown scale");
+        graph_.cut(*index);
+        return ok();
+    }
+
+    scale_graph graph_;
+    change_hub hub_;
+    mutable std::shared_mutex lock_;
+    latency_stats stats_;
+    std::atomic<std::uint64_t> pending_edits_{0};
+    mutable std::mutex reload_mutex_; ///< Guards the reload state below.
+    std::condition_variable reload_done_;
+    bool reloading_{};
+    bool last_reload_ok_{};
+    std::uint64_t reloads_{};
+    std::uint64_t reload_failures_{};
+    std::int64_t last_reload_ms_{};
+    std::uint64_t generation_{}; ///< Graphs swapped in by reloads; guarded by lock_.
+    background_config background_;
+    std::mutex compaction_mutex_; ///< Guards the compaction state below.
+    std::condition_variable compaction_done_;
+    bool compacting_{};
+    bool logging_edits_{};              ///< The compaction copied the graph; later edits are logged.
+    std::vector<std::string> edit_log_; ///< Edits to replay on the compacted graph.
+    // Declared last, so a running reload or compaction finishes before the rest goes
+    std::jthread reloader_;
+    std::jthread compactor_;
+};
@@ -5,187 +5,366 @@
  * This application models a recursive system of mechanical scales where each scale
  * can hold either a physical weight (Pan) or another scale on its left and right sides.
  *
- * The input is a series of CSV lines (from stdin) of the form:
+ * The input is a series of CSV lines (from stdin, or from the files named on the command line) of the form:
  *     scale_name,left_side,right_side
- * where each side can either be a numeric weight or the name of another scale.
+ * where each side can either be a numeric weight or the name of another scale. Scales may
+ * list further sides after the right one.
  *
  * The program parses this input into a tree of interconnected Scale and Pan objects.
  * It then computes the additional balancing mass needed on each side to ensure equilibrium.
  *
  * The results are output as CSV lines (to stdout) showing:
  *     scale_name,left_balance_mass,right_balance_mass
+ *
+ * Usage: scaleblancer [options] [FILE...]
+ *
+ * Files are parsed concurrently into one namespace, as if they had been concatenated.
+ *
+ * Command line options:
+ *     --save-topology FILE   also write the parsed graph as a binary topology file
+ *     --load-topology FILE   read the graph from a topology file instead of stdin
+ *     --lookup NAME          print the definition of NAME from the topology and exit
+ *     --tree NAME            with --load-topology, load, balance and report only the tree holding NAME
+ *     --engine NAME          balancing engine: auto (default), sequential or level
+ *     --threads N            thread count for the level engine (default: chosen by the cost model)
+ *     --cost-model FILE      read cost model coefficients written by --calibrate
+ *     --calibrate FILE       fit the cost model to this machine, write it to FILE and exit
+ *     --verbose              log the shape profile and the engine choice to stderr
+ *     --stream               write report rows as soon as all rows before them are final
+ *     --fused                format each report row right after balancing its scale, then write all at once
+ *     --compact              relocate the parsed graph into one arena in balancing order
+ *     --root NAME            print the top-level scale NAME belongs to and exit
+ *     --depth NAME           print how deep NAME hangs below its top-level scale and exit
+ *     --lca NAME NAME        print the lowest common parent of two scales and exit
+ *     --serve                balance the scales from FILE... or --load-topology, then answer
+ *                            incremental edit and query commands from stdin (see scale_server.hpp);
+ *                            request latency percentiles are printed to stderr when stdin ends
+ *     --decimals N           read and print masses with N decimal places (0 to 6, default 0);
+ *                            a scale's own mass stays 1
+ *     --metrics-file FILE    keep FILE updated with metrics in the Prometheus text format
+ *     --metrics-interval MS  refresh period of the metrics file (default 1000)
+ *     --io-uring             read FILE... in batches through io_uring, for many small files;
+ *                            falls back to plain reads where io_uring is unavailable
+ *     --pipeline NAME        parse, balance and report stdin or FILE... with a flat pipeline instead of
+ *                            the scale graph: minimal (fewest features, fastest) or checked (overflow
+ *                            checks, metrics and the level engine); see pipeline.hpp
+ *     --gzip                 write the report gzip-compressed, in blocks compressed on all threads
+ *     --gzip-level N         compression level of --gzip, 1 to 9 (default 6); implies --gzip
+ *     --notify-window MS     with --serve, coalesce pushed change records over MS milliseconds
+ *                            (default 0: push after every edit)
+ *     --cdc-file FILE        with --serve, append every change record to FILE, stamped in Unix ms
+ *     --tenant NAME=FILE     with --serve, host the scales of FILE as tenant NAME; repeat for more tenants
+ *                            or files. Commands then start with the tenant name (see tenant_host.hpp)
+ *     --tenant-max-scales N  refuse a tenant's ADD and SET once it has N scales
+ *     --tenant-max-memory B  refuse a tenant's ADD and SET once its graph holds about B bytes
+ *     --tenant-max-queue N   refuse a tenant's requests while N of them are queued
  */
 
-#include <iostream>
-#include <iomanip>
-#include <memory>
-#include <string>
-#include <unordered_map>
-#include <variant>
-#include <vector>
-#include <ranges>
+#include "scale.hpp"
+#include "ancestry_index.hpp"
+#include "compaction.hpp"
+#include "compressed_output.hpp"
+#include "engine.hpp"
+#include "fused_report.hpp"
+#include "parallel_ingest.hpp"
+#include "pipeline.hpp"
+#include "report_stream.hpp"
+#include "run_metrics.hpp"
+#include "scale_server.hpp"
+#include "tenant_host.hpp"
+#include "topology_file.hpp"
+#include "uring_ingest.hpp"
 
-/**
- * @brief Represents a pan with weight and optional counterbalance.
- */
-struct Pan {
-    static constexpr int default_mass{0}; ///< Default mass for a pan (0).
-    int mass{};           ///< Weight placed on the pan.
-    int balance_mass{};   ///< Additional mass added for balancing.
-
-    /**
-     * @brief Constructs a Pan with optional initial weight.
-     * @param kg Initial mass (default is 0).
-     */
-    explicit Pan(int kg = default_mass) : mass{kg} {}
-};
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <optional>
 
 /**
- * @brief A scale can can hold either a Pan or a weak reference to another Scale.
+ * @brief A root, depth or lowest-common-ancestor query given on the command line.
  */
-
-struct Scale;
-using scale_wrapper = std::shared_ptr<Scale>;
-using pan_or_scale = std::variant<Pan, std::weak_ptr<Scale>>;
+struct ancestry_query {
+    std::string kind;   ///< "root", "depth" or "lca".
+    std::string first;  ///< The queried scale.
+    std::string second; ///< The other scale of an lca query.
+};
 
 /**
- * @brief Represents a composite scale which can contain Pans or other Scales on each side.
+ * @brief Command line options of the application.
  */
-struct Scale final : Pan {
-    static constexpr int default_mass{1}; ///< Default self-mass for a Scale.
-    std::string name;                     ///< Identifier of the scale.
-    pan_or_scale left;                    ///< Left side: Pan or linked Scale.
-    pan_or_scale right;                   ///< Right side: Pan or linked Scale.
-
-    /**
-     * @brief Constructs a Scale with a name.
-     * @param n The name of the scale.
-     */
-    explicit Scale(std::string n)
-        : Pan{default_mass}, name{std::move(n)},
-          left{std::in_place_type<Pan>},
-          right{std::in_place_type<Pan>} {}
-
-    /**
-     * @brief Resolves a mutable pan_or_scale variant to a reference to the underlying Pan.
-     * @param side A variant holding either a Pan or weak_ptr to Scale.
-     * @return Reference to the resolved Pan.
-     */
-    static Pan& resolve_side(pan_or_scale& side) {
-        return std::holds_alternative<Pan>(side)
-            ? std::get<Pan>(side)
-            : *std::get<std::weak_ptr<Scale>>(side).lock();
-    }
-
-    /**
-     * @brief Resolves a const pan_or_scale variant to a reference to the underlying Pan.
-     * @param side A variant holding either a Pan or weak_ptr to Scale.
-     * @return Const reference to the resolved Pan.
-     */
-    static const Pan& resolve_side(const pan_or_scale& side) {
-        return std::holds_alternative<Pan>(side)
-            ? std::get<Pan>(side)
-            : *std::get<std::weak_ptr<Scale>>(side).lock();
-    }
+struct options {
+    std::string save_topology;        ///< Path to write the parsed topology to, if any.
+    std::string load_topology;        ///< Path to read the topology from instead of stdin.
+    std::vector<std::string> lookups; ///< Scale names to look up in the loaded topology.
+    std::vector<std::string> trees;   ///< Load only the trees holding these scales from the topology.
+    balance_engine engine{balance_engine::automatic}; ///< Requested balancing engine.
+    unsigned threads{};               ///< Requested thread count, 0 to let the cost model decide.
+    std::string cost_model;           ///< Path of a calibrated cost model, if any.
+    std::string calibrate;            ///< Path to write a freshly calibrated cost model to.
+    bool verbose{};                   ///< Log the engine choice to stderr.
+    bool stream{};                    ///< Stream report rows while balancing.
+    bool fused{};                     ///< Format report rows during the balancing pass.
+    std::vector<std::string> inputs;  ///< Input files; stdin is read if there are none.
+    bool compact{};                   ///< Compact the graph before balancing.
+    std::vector<ancestry_query> ancestry; ///< Ancestry queries to answer instead of balancing.
+    bool serve{};                     ///< Serve incremental commands from stdin.
+    mass_format format;               ///< Fixed-point notation of input and output masses.
+    std::string metrics_file;         ///< Path of the metrics file, if any.
+    std::chrono::milliseconds metrics_interval{1000}; ///< Refresh period of the metrics file.
+    bool io_uring{};                  ///< Batch the reads of the input files through io_uring.
+    std::string pipeline;             ///< Flat pipeline to run instead of the scale graph, if any.
+    bool gzip{};                      ///< Compress the report.
+    gzip_options compression;         ///< Level and block size of the compressed report.
+    std::chrono::milliseconds notify_window{}; ///< Coalescing window of pushed change records.
+    std::string cdc_file;             ///< Path of the change-data-capture file, if any.
+    std::map<std::string, std::vector<std::string>> tenants; ///< Input files of each hosted tenant.
+    tenant_limits limits;             ///< Limits of every hosted tenant.
 };
 
 /**
- * @brief Parses a CSV line of format "name,left,right" and returns trimmed tokens.
- * @param line The input line string.
- * @return Tuple containing name, left, and right strings.
+ * @brief Parses the command line.
+ * @param args The arguments, excluding the program name.
+ * @return The options, or std::nullopt after reporting a usage error.
  */
-inline std::tuple<std::string, std::string, std::string> parse_line(const std::string& line) {
-    auto parts = line
-        | std::views::split(',')
-        | std::views::transform([](auto&& r) {
-            std::string token(&*r.begin(), std::ranges::distance(r));
-            std::erase_if(token, ::isspace);
-            return token;
-        });
+inline std::optional<options> parse_options(std::span<char* const> args) {
+    options opts;
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const std::string_view arg{args[i]};
+        auto value = [&]() -> const char* { return i + 1 < args.size() ? args[++i] : nullptr; };
 
-    auto it = parts.begin();
-    const auto name  = it != parts.end() ? *it++ : "";
-    const auto left  = it != parts.end() ? *it++ : "";
-    const auto right = it != parts.end() ? *it++ : "";
-    return {name, left, right};
+        const char* v = nullptr;
+        if (arg == "--save-topology" && (v = value())) {
+            opts.save_topology = v;
+        } else if (arg == "--load-topology" && (v = value())) {
+            opts.load_topology = v;
+        } else if (arg == "--lookup" && (v = value())) {
+            opts.lookups.emplace_back(v);
+        } else if (arg == "--tree" && (v = value())) {
+            opts.trees.emplace_back(v);
+        } else if (arg == "--engine" && (v = value()) && parse_engine(v)) {
+            opts.engine = *parse_engine(v);
+        } else if (arg == "--threads" && (v = value()) && std::atoi(v) > 0) {
+            opts.threads = static_cast<unsigned>(std::atoi(v));
+        } else if (arg == "--cost-model" && (v = value())) {
+            opts.cost_model = v;
+        } else if (arg == "--calibrate" && (v = value())) {
+            opts.calibrate = v;
+        } else if (arg == "--verbose") {
+            opts.verbose = true;
+        } else if (arg == "--stream") {
+            opts.stream = true;
+        } else if (arg == "--fused") {
+            opts.fused = true;
+        } else if (arg == "--compact") {
+            opts.compact = true;
+        } else if ((arg == "--root" || arg == "--depth") && (v = value())) {
+            opts.ancestry.push_back({std::string{arg.substr(2)}, v, {}});
+        } else if (arg == "--serve") {
+            opts.serve = true;
+        } else if (arg == "--decimals" && (v = value()) && std::isdigit(static_cast<unsigned char>(*v))
+                   && static_cast<unsigned>(std::atoi(v)) <= mass_format::max_decimals) {
+            opts.format.decimals = static_cast<unsigned>(std::atoi(v));
+        } else if (arg == "--metrics-file" && (v = value())) {
+            opts.metrics_file = v;
+        } else if (arg == "--metrics-interval" && (v = value()) && std::atoi(v) > 0) {
+            opts.metrics_interval = std::chrono::milliseconds{std::atoi(v)};
+        } else if (arg == "--io-uring") {
+            opts.io_uring = true;
+        } else if (arg == "--pipeline" && (v = value())
+                   && (v == std::string_view{"minimal"} || v == std::string_view{"checked"})) {
+            opts.pipeline = v;
+        } else if (arg == "--gzip") {
+            opts.gzip = true;
+        } else if (arg == "--gzip-level" && (v = value()) && std::atoi(v) >= 1 && std::atoi(v) <= 9) {
+            opts.gzip = true;
+            opts.compression.level = std::atoi(v);
+        } else if (arg == "--notify-window" && (v = value()) && std::isdigit(static_cast<unsigned char>(*v))) {
+            opts.notify_window = std::chrono::milliseconds{std::atoi(v)};
+        } else if (arg == "--cdc-file" && (v = value())) {
+            opts.cdc_file = v;
+        } else if (arg == "--tenant" && (v = value()) && std::strchr(v, '=') && *v != '=') {
+            const std::string_view tenant{v};
+            const auto equals = tenant.find('=');
+            opts.tenants[std::string{tenant.substr(0, equals)}].emplace_back(tenant.substr(equals + 1));
+        } else if (arg == "--tenant-max-scales" && (v = value()) && std::atoll(v) > 0) {
+            opts.limits.max_scales = static_cast<std::size_t>(std::atoll(v));
+        } else if (arg == "--tenant-max-memory" && (v = value()) && std::atoll(v) > 0) {
+            opts.limits.max_memory_bytes = static_cast<std::size_t>(std::atoll(v));
+        } else if (arg == "--tenant-max-queue" && (v = value()) && std::atoll(v) > 0) {
+            opts.limits.max_queue = static_cast<std::size_t>(std::atoll(v));
+        } else if (arg == "--lca" && i + 2 < args.size()) {
+            opts.ancestry.push_back({"lca", args[i + 1], args[i + 2]});
+            i += 2;
+        } else if (!arg.starts_with("--")) {
+            opts.inputs.emplace_back(arg);
+        } else {
+            std::cerr << "Invalid argument: " << std::quoted(arg) << '\n';
+            return std::nullopt;
+        }
+    }
+    if (!opts.lookups.empty() && opts.load_topology.empty()) {
+        std::cerr << "--lookup requires --load-topology\n";
+        return std::nullopt;
+    }
+    if (!opts.trees.empty() && opts.load_topology.empty()) {
+        std::cerr << "--tree requires --load-topology\n";
+        return std::nullopt;
+    }
+    if ((opts.notify_window.count() > 0 || !opts.cdc_file.empty()) && !opts.serve) {
+        std::cerr << "--notify-window and --cdc-file require --serve\n";
+        return std::nullopt;
+    }
+    if (!opts.tenants.empty()
+        && (!opts.serve || !opts.inputs.empty() || !opts.load_topology.empty() || !opts.cdc_file.empty()
+            || opts.notify_window.count() > 0)) {
+        std::cerr << "--tenant requires --serve and replaces FILE..., --load-topology and change capture\n";
+        return std::nullopt;
+    }
+    if (opts.gzip && !gzip_supported) {
+        std::cerr << "--gzip is not available: built without zlib\n";
+        return std::nullopt;
+    }
+    if (opts.gzip && (!opts.lookups.empty() || !opts.ancestry.empty() || opts.serve)) {
+        std::cerr << "--gzip only compresses the report, not --lookup, --root, --depth, --lca or --serve output\n";
+        return std::nullopt;
+    }
+    if (!opts.pipeline.empty()
+        && (!opts.load_topology.empty() || !opts.save_topology.empty() || !opts.ancestry.empty() || opts.serve
+            || opts.stream || opts.fused || opts.compact || opts.io_uring)) {
+        std::cerr << "--pipeline only reads text input and writes the report\n";
+        return std::nullopt;
+    }
+    return opts;
 }
 
 /**
- * @brief Parses input stream to construct a list of interconnected scales.
- * @param infile Input stream containing scale definitions.
- * @param scales_list Output vector to hold the constructed scales.
+ * @brief Prints the definition of each looked-up scale straight from the topology index.
+ * @param os The output stream.
+ * @param topology The mapped topology.
+ * @param names The scale names to look up.
+ * @return True if every name was found.
  */
-inline void parse_scales(std::istream& infile, std::vector<scale_wrapper>& scales_list) {
-    scales_list.clear();
-    std::unordered_map<std::string, scale_wrapper> known_scales;
-
-    auto get_or_create_scale = [&](const std::string& name) -> scale_wrapper {
-        if (auto it = known_scales.find(name); it != known_scales.end()) {
-            return it->second;
-        }
-        auto scale = std::make_shared<Scale>(name);
-        known_scales[name] = scale;
-        scales_list.push_back(scale);
-        return scale;
-    };
-
-    auto assign_side = [&](auto& side, const std::string& token) {
-        if (!token.empty() && std::isdigit(token.front())) {
-            side.template emplace<Pan>(std::stoi(token));
-        } else if (!token.empty()) {
-            side.template emplace<std::weak_ptr<Scale>>(get_or_create_scale(token));
-        }
+inline bool report_lookups(std::ostream& os, const topology_view& topology, std::span<const std::string> names) {
+    bool all_found = true;
+    const auto format = topology.format();
+    auto print_side = [&](std::int64_t mass, std::uint32_t child) {
+        os << ',';
+        if (child < topology.size()) os << topology.name(child);
+        else format.print(os, static_cast<int>(mass));
     };
-
-    std::string line;
-    for (int line_number = 0;std::getline(infile, line); ++line_number) {
-        if (line.empty() || line.front() == '#') continue; // skip comment lines.
-
-        const auto [name, left, right] = parse_line(line);
-
-        // Validate the parsed scales parameters
-        if (name.empty() || left == name || right == name) {
-            std::cerr << "Invalid line " << line_number << ": " << std::quoted(line) << '\n';
+    for (const auto& name : names) {
+        const auto node = topology.find(name);
+        if (!node) {
+            std::cerr << "Unknown scale: " << std::quoted(name) << '\n';
+            all_found = false;
             continue;
         }
-
-        // Add/update the referenced scale.
-        auto scale = get_or_create_scale(name);
-        assign_side(scale->left, left);
-        assign_side(scale->right, right);
+        const auto& n = topology.node(*node);
+        os << name;
+        print_side(n.left_mass, n.left_child);
+        print_side(n.right_mass, n.right_child);
+        for (const auto& side : topology.extra_sides(*node)) print_side(side.mass, side.child);
+        os << '\n';
     }
+    return all_found;
 }
 
 /**
- * @brief Balances all scales by computing and assigning necessary counterweights.
- * @param scales_list A span of scales to balance.
+ * @brief Loads only the trees of a topology that the queries touch.
+ *
+ * Names are found through the topology index and mapped to their component, so only
+ * those components' records are read.
+ * @param topology The mapped topology.
+ * @param opts Supplies the --tree names, which must exist, and the ancestry queries, whose
+ *        unknown names are left for report_ancestry() to report.
+ * @param scales_list Output vector receiving the scales of the touched trees.
+ * @return False if a --tree name is unknown.
  */
-inline void balance_each_scale(std::span<scale_wrapper> scales_list) {
-    for (const auto& scale : scales_list | std::views::reverse) {
-        auto& left_pan = Scale::resolve_side(scale->left);
-        auto& right_pan = Scale::resolve_side(scale->right);
-
-        if (left_pan.mass > right_pan.mass)
-            right_pan.balance_mass = left_pan.mass - right_pan.mass;
-        else if (right_pan.mass > left_pan.mass)
-            left_pan.balance_mass = right_pan.mass - left_pan.mass;
+inline bool load_queried_trees(const topology_view& topology, const options& opts,
+                               std::vector<scale_wrapper>& scales_list) {
+    std::vector<std::uint32_t> components;
+    auto add_tree = [&](const std::string& name) {
+        const auto node = topology.find(name);
+        const auto component = node ? topology.component_of(*node) : std::nullopt;
+        if (component) components.push_back(*component);
+        return component.has_value();
+    };
 
-        scale->mass += left_pan.mass + right_pan.mass
-                     + left_pan.balance_mass + right_pan.balance_mass;
+    bool all_found = true;
+    for (const auto& name : opts.trees) {
+        if (add_tree(name)) continue;
+        std::cerr << "Unknown scale: " << std::quoted(name) << '\n';
+        all_found = false;
     }
+    for (const auto& query : opts.ancestry) {
+        add_tree(query.first);
+        if (query.kind == "lca") add_tree(query.second);
+    }
+    load_components(topology, components, scales_list);
+    return all_found;
 }
 
 /**
- * @brief Outputs the balancing results for each scale to an output stream.
+ * @brief Answers ancestry queries as CSV rows `root,NAME,ROOT`, `depth,NAME,DEPTH` and
+ *        `lca,NAME,NAME,ANCESTOR`, the ancestor being empty for scales of different trees.
  * @param os The output stream.
- * @param scales_list The list of scales to report on.
+ * @param scales_list The parsed scales.
+ * @param queries The queries to answer.
+ * @return True if every queried scale exists.
  */
-inline void report_changes(std::ostream& os, std::span<scale_wrapper> scales_list) {
-    for (const auto& scale : scales_list) {
-        const auto& left_pan = Scale::resolve_side(scale->left);
-        const auto& right_pan = Scale::resolve_side(scale->right);
-        os << scale->name << ',' << left_pan.balance_mass << ',' << right_pan.balance_mass << '\n';
+inline bool report_ancestry(std::ostream& os, std::span<const scale_wrapper> scales_list,
+                            std::span<const ancestry_query> queries) {
+    const ancestry_index index{link_scales(scales_list)};
+    const auto by_name = index_by_name(scales_list);
+    auto find = [&](const std::string& name) -> std::optional<std::uint32_t> {
+        if (auto it = by_name.find(name); it != by_name.end()) return it->second;
+        std::cerr << "Unknown scale: " << std::quoted(name) << '\n';
+        return std::nullopt;
+    };
+
+    bool all_found = true;
+    for (const auto& query : queries) {
+        const auto a = find(query.first);
+        const auto b = query.kind == "lca" ? find(query.second) : a;
+        if (!a || !b) {
+            all_found = false;
+            continue;
+        }
+        if (query.kind == "root") {
+            os << "root," << query.first << ',' << scales_list[index.root(*a)]->name << '\n';
+        } else if (query.kind == "depth") {
+            os << "depth," << query.first << ',' << index.depth(*a) << '\n';
+        } else {
+            const auto ancestor = index.lca(*a, *b);
+            os << "lca," << query.first << ',' << query.second << ','
+               << (ancestor ? std::string_view{scales_list[*ancestor]->name} : "") << '\n';
+        }
     }
+    return all_found;
+}
+
+/**
+ * @brief Runs a flat pipeline over the input files, or stdin if there are none.
+ * @param pipeline The pipeline, configured for the run.
+ * @param inputs The input files, read in turn into one namespace.
+ * @param os Receives the report.
+ * @return The exit code.
+ */
+template <typename Pipeline>
+int run_pipeline(Pipeline& pipeline, std::span<const std::string> inputs, std::ostream& os = std::cout) {
+    if (inputs.empty()) pipeline.parse(std::cin);
+    for (const auto& path : inputs) {
+        std::ifstream in{path};
+        if (!in) {
+            std::cerr << "Cannot open input: " << std::quoted(path) << '\n';
+            return 1;
+        }
+        pipeline.parse(in);
+    }
+    if (!pipeline.balance()) return 1;
+    pipeline.report(os);
+    os.flush();
+    return 0;
 }
 
 /**
@@ -194,18 +373,203 @@ inline void report_changes(std::ostream& os, std::span<scale_wrapper> scales_lis
  * Reads input from standard input, constructs and balances a set of interconnected scales,
  * then writes the balancing results to standard output.
  */
-int main()
+int main(int argc, char* argv[])
 {
+    const auto opts = parse_options({argv + 1, static_cast<std::size_t>(argc > 0 ? argc - 1 : 0)});
+    if (!opts) return 2;
+
+    const unsigned max_threads = opts->threads ? opts->threads : std::max(1u, std::thread::hardware_concurrency());
+    if (!opts->calibrate.empty()) {
+        std::ofstream out{opts->calibrate};
+        calibrate_cost_model(max_threads).save(out);
+        return out ? 0 : 1;
+    }
+
+    cost_model model;
+    if (!opts->cost_model.empty()) {
+        std::ifstream in{opts->cost_model};
+        const auto loaded = cost_model::load(in);
+        if (!loaded) {
+            std::cerr << "Cannot load cost model: " << std::quoted(opts->cost_model) << '\n';
+            return 1;
+        }
+        model = *loaded;
+    }
+
+    // Keep the metrics file up to date for the rest of the run, including a server's lifetime
+    using clock = std::chrono::steady_clock;
+    run_metrics metrics;
+    std::atomic<std::uint64_t> graph_scales{0};
+    std::optional<scale_server> server;
+    std::atomic<const scale_server*> serving{nullptr};
+    std::optional<metrics_exporter> exporter;
+    if (!opts->metrics_file.empty()) {
+        exporter.emplace(opts->metrics_file, opts->metrics_interval, metrics, [&] {
+            metrics_sample sample{graph_scales.load(std::memory_order_relaxed)};
+            if (const auto* s = serving.load(std::memory_order_acquire)) {
+                sample.graph_scales = s->scale_count();
+                sample.queue_depth = s->queue_depth();
+                sample.latencies = &s->latencies();
+            }
+            return sample;
+        });
+    }
+    run_metrics* const counting = exporter ? &metrics : nullptr;
+
+    // The report goes to stdout, through the parallel compressor with --gzip
+    std::ostream report{std::cout.rdbuf()};
+#if SCALEBLANCER_HAS_ZLIB
+    std::optional<parallel_gzip_streambuf> compressor;
+    if (opts->gzip) report.rdbuf(&compressor.emplace(std::cout, max_threads, opts->compression));
+#endif
+    auto finish_report = [&](int status) {
+        report.flush();
+#if SCALEBLANCER_HAS_ZLIB
+        if (compressor && !compressor->close()) {
+            std::cerr << "Cannot write the compressed report\n";
+            return 1;
+        }
+#endif
+        return status;
+    };
+
+    if (opts->pipeline == "minimal") {
+        minimal_pipeline pipeline{opts->format};
+        return finish_report(run_pipeline(pipeline, opts->inputs, report));
+    }
+    if (opts->pipeline == "checked") {
+        checked_pipeline pipeline{opts->format, {&metrics}, {max_threads}};
+        return finish_report(run_pipeline(pipeline, opts->inputs, report));
+    }
+
+    if (!opts->tenants.empty()) {
+        // Every tenant's graph is parsed from its own files into its own namespace
+        tenant_host host{max_threads};
+        for (const auto& [name, files] : opts->tenants) {
+            std::vector<scale_wrapper> tenant_scales;
+            if (!parse_scale_files(files, tenant_scales, max_threads, opts->format, counting)) return 1;
+            scale_graph graph{std::move(tenant_scales), opts->format};
+            if (!graph.valid()) return 1;
+            if (!host.create(name, std::move(graph), opts->limits)) {
+                std::cerr << "Invalid tenant name: " << std::quoted(name) << '\n';
+                return 1;
+            }
+        }
+        host.serve(std::cin, std::cout);
+        host.report(std::cerr);
+        return 0;
+    }
+
     std::vector<scale_wrapper> scales_list;
+    auto format = opts->format;
+    const auto parse_start = clock::now();
 
-    // Parse input lines to build the list of interconnected scales
-    parse_scales(std::cin, scales_list);
+    if (!opts->load_topology.empty()) {
+        // Map the topology file; lookups are answered from its index without building the graph
+        const mapped_file file{opts->load_topology};
+        const topology_view topology{file.bytes()};
+        if (!topology.valid()) {
+            std::cerr << "Cannot load topology: " << std::quoted(opts->load_topology) << '\n';
+            return 1;
+        }
+        if (!opts->lookups.empty()) return report_lookups(std::cout, topology, opts->lookups) ? 0 : 1;
+        if (!opts->trees.empty() || !opts->ancestry.empty()) {
+            // Only the trees holding the named scales are read from the file
+            if (!load_queried_trees(topology, *opts, scales_list)) return 1;
+        } else {
+            load_topology(topology, scales_list);
+        }
+        format = topology.format(); // the stored masses are in the units they were parsed with
+    } else if (!opts->inputs.empty()) {
+        // Parse all input files concurrently into one namespace
+        const auto parse_files = opts->io_uring ? parse_scale_files_batched : parse_scale_files;
+        if (!parse_files(opts->inputs, scales_list, max_threads, format, counting)) return 1;
+    } else if (!opts->serve) {
+        // Parse input lines to build the list of interconnected scales
+        counting_streambuf counted_input{*std::cin.rdbuf(), metrics};
+        std::istream input{&counted_input};
+        parse_scales(counting ? input : std::cin, scales_list, format);
+    }
+    metrics.add_elapsed(run_counter::parse_ns, parse_start);
+    graph_scales.store(scales_list.size(), std::memory_order_relaxed);
+
+    if (!opts->save_topology.empty()) {
+        std::ofstream out{opts->save_topology, std::ios::binary};
+        if (!write_topology(out, scales_list, format)) {
+            std::cerr << "Cannot write topology: " << std::quoted(opts->save_topology) << '\n';
+            return 1;
+        }
+    }
+
+    if (opts->serve) {
+        // Stdin carries commands; the initial graph came from files or a topology
+        scale_graph graph{std::move(scales_list), format};
+        if (!graph.valid()) return 1;
+        server.emplace(std::move(graph), opts->notify_window);
+        if (!opts->cdc_file.empty() && !server->capture_changes(opts->cdc_file)) {
+            std::cerr << "Cannot open change capture file: " << std::quoted(opts->cdc_file) << '\n';
+            return 1;
+        }
+        serving.store(&*server, std::memory_order_release);
+        server->serve(std::cin, std::cout);
+        server->latencies().report(std::cerr);
+        return 0;
+    }
+
+    if (!opts->ancestry.empty()) return report_ancestry(std::cout, scales_list, opts->ancestry) ? 0 : 1;
+
+    if (opts->compact) scales_list = compact_scales(scales_list);
+
+    // Profile the graph, on all threads for large graphs, and let the cost model pick the
+    // engine, unless one was requested
+    const auto shape = profile_shape(scales_list, max_threads);
+    auto choice = choose_engine(shape, model, max_threads);
+    if (opts->engine != balance_engine::automatic) {
+        choice.engine = opts->engine;
+        choice.threads = opts->engine == balance_engine::sequential ? 1 : max_threads;
+        choice.predicted_ns = model.predict(shape, choice.engine, choice.threads);
+    }
+    if (shape.shared_count > 0 && choice.engine == balance_engine::level_parallel && choice.threads > 1) {
+        // visit_levels() keeps shared children in the sequential order
+        std::cerr << "Scales held by more than one side: balancing sequentially instead of "
+                  << engine_name(choice.engine) << " on " << choice.threads << " threads\n";
+    }
+    if (opts->verbose) {
+        std::cerr << "shape: nodes=" << shape.node_count << " roots=" << shape.root_count
+                  << " depth=" << shape.depth() << " max_width=" << shape.max_width()
+                  << " shared=" << shape.shared_count << '\n'
+                  << "engine: " << engine_name(choice.engine) << " threads=" << choice.threads
+                  << " predicted_us=" << choice.predicted_ns / 1000 << '\n';
+    }
+
+    if (opts->stream) {
+        // Balance and write each row as soon as every row before it is final; counted as balancing
+        const auto stream_start = clock::now();
+        balance_and_stream(report, scales_list, shape, choice, format);
+        const auto status = finish_report(0);
+        metrics.add_elapsed(run_counter::balance_ns, stream_start);
+        return status;
+    }
+
+    if (opts->fused) {
+        // Format each row while its scale is still in cache; the report is one final write
+        const auto fused_start = clock::now();
+        balance_and_format(report, scales_list, shape, choice, format);
+        const auto status = finish_report(0);
+        metrics.add_elapsed(run_counter::balance_ns, fused_start);
+        return status;
+    }
 
     // Compute necessary balancing masses for each scale
-    balance_each_scale(scales_list);
+    const auto balance_start = clock::now();
+    balance_with(scales_list, shape, choice);
+    metrics.add_elapsed(run_counter::balance_ns, balance_start);
 
     // Output the balancing results to standard output
-    report_changes(std::cout, scales_list);
+    const auto report_start = clock::now();
+    report_changes(report, scales_list, format);
+    const auto status = finish_report(0);
+    metrics.add_elapsed(run_counter::report_ns, report_start);
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,102 @@
+/**
+ * @file scaling_bench.cpp
+ * @brief scaleblancer_scaling - strong- and weak-scaling curves of the parse, order and balance phases.
+ *
+ * Sweeps every thread count from 1 to --threads over generated inputs of each shape and
+ * writes one CSV row per point, with speedup and efficiency relative to one thread. See
+ * scaling_bench.hpp for how the points are measured.
+ *
+ * Usage: scaleblancer_scaling [options]
+ *
+ * Command line options:
+ *     --threads N            highest thread count (default: all cores)
+ *     --scales N             total scales for strong scaling, scales per thread for weak (default 65536)
+ *     --shapes LIST          comma-separated shapes: chain (chains of 24 scales),binary,random,forest
+ *                            (default: all)
+ *     --phase parse|order|balance
+ *                            sweep only one phase (default: all three)
+ *     --repetitions N        runs per point, the fastest counts (default 3)
+ *     --seed N               seed of the random shape (default 1)
+ *     --output FILE          write the CSV to FILE instead of stdout
+ */
+
+#include "scaling_bench.hpp"
+
+#include <fstream>
+
+/**
+ * @brief Command line options of the scaling harness.
+ */
+struct scaling_options {
+    scaling_config config; ///< What to sweep.
+    std::string output;    ///< CSV file; stdout if empty.
+};
+
+/**
+ * @brief Parses the command line.
+ * @param args The arguments, excluding the program name.
+ * @return The options, or std::nullopt after reporting a usage error.
+ */
+inline std::optional<scaling_options> parse_scaling_options(std::span<char* const> args) {
+    scaling_options opts;
+    auto& config = opts.config;
+    config.max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const std::string_view arg{args[i]};
+        auto value = [&]() -> const char* { return i + 1 < args.size() ? args[++i] : nullptr; };
+
+        const char* v = nullptr;
+        if (arg == "--threads" && (v = value()) && std::atoi(v) > 0) {
+            config.max_threads = static_cast<unsigned>(std::atoi(v));
+        } else if (arg == "--scales" && (v = value()) && std::atoll(v) > 0) {
+            config.scales = static_cast<std::size_t>(std::atoll(v));
+        } else if (arg == "--shapes" && (v = value())) {
+            config.shapes.clear();
+            std::istringstream names{v};
+            for (std::string name; std::getline(names, name, ',');) {
+                const auto shape = parse_scaling_shape(name);
+                if (!shape) {
+                    std::cerr << "Unknown shape: " << std::quoted(name) << '\n';
+                    return std::nullopt;
+                }
+                config.shapes.push_back(*shape);
+            }
+        } else if (arg == "--phase" && (v = value())
+                   && (v == std::string_view{"parse"} || v == std::string_view{"order"} || v == std::string_view{"balance"})) {
+            config.parse = v == std::string_view{"parse"};
+            config.order = v == std::string_view{"order"};
+            config.balance = v == std::string_view{"balance"};
+        } else if (arg == "--repetitions" && (v = value()) && std::atoi(v) > 0) {
+            config.repetitions = std::atoi(v);
+        } else if (arg == "--seed" && (v = value())) {
+            config.seed = static_cast<std::uint64_t>(std::atoll(v));
+        } else if (arg == "--output" && (v = value())) {
+            opts.output = v;
+        } else {
+            std::cerr << "Invalid argument: " << std::quoted(arg) << '\n';
+            return std::nullopt;
+        }
+    }
+    return opts;
+}
+
+/**
+ * @brief Entry point of the scaling harness.
+ */
+int main(int argc, char* argv[])
+{
+    const auto opts = parse_scaling_options({argv + 1, static_cast<std::size_t>(argc > 0 ? argc - 1 : 0)});
+    if (!opts) return 2;
+
+    if (opts->output.empty()) {
+        write_scaling_csv(std::cout, opts->config);
+        return 0;
+    }
+    std::ofstream out{opts->output};
+    if (!out) {
+        std::cerr << "Cannot open output: " << std::quoted(opts->output) << '\n';
+        return 1;
+    }
+    write_scaling_csv(out, opts->config);
+    return out ? 0 : 1;
+}
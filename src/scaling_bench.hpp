@@ -0,0 +1,239 @@
+/**
+ * @file scaling_bench.hpp
+ * @brief Strong- and weak-scaling sweeps of the parse, order and balance phases.
+ *
+ * For every input shape and phase, the sweep times the phase at each thread count from
+ * one up to the configured maximum:
+ * - strong scaling keeps the total work fixed, so the ideal time falls as 1/threads;
+ *   speedup is T(1) / T(n) and efficiency is speedup / n;
+ * - weak scaling keeps the work per thread fixed, so the ideal time stays flat; speedup
+ *   is the scaled speedup n * T(1) / T(n) and efficiency is T(1) / T(n).
+ *
+ * Parsing splits the generated input into one stream per thread and runs the concurrent
+ * ingestion; ordering links and profiles the parsed scales end to end, as the application
+ * does before balancing; balancing runs the level-parallel engine, or the sequential one
+ * for a single thread. Every point is the best of a few repetitions, and all points of one run are
+ * written as CSV rows, so a scaling cliff shows up as a drop in one column.
+ *
+ * Inputs that are balanced must keep their masses within int, which caps their depth at
+ * synthetic_depth_limit levels: the chain shape is a forest of chains that deep, and the
+ * random shape stops growing at that depth. Each row records the depth of its input.
+ */
+
+#pragma once
+
+#include "engine.hpp"
+#include "parallel_ingest.hpp"
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <sstream>
+
+/**
+ * @brief Input shapes swept by the harness.
+ */
+enum class scaling_shape : std::uint8_t { chain, binary, random, forest };
+
+/// @brief All shapes, in sweep order.
+inline constexpr std::array all_scaling_shapes{scaling_shape::chain, scaling_shape::binary, scaling_shape::random,
+                                               scaling_shape::forest};
+
+/**
+ * @brief Lower-case name of a shape, as used on the command line and in the CSV.
+ */
+constexpr std::string_view scaling_shape_name(scaling_shape shape) {
+    switch (shape) {
+        case scaling_shape::chain: return "chain";
+        case scaling_shape::binary: return "binary";
+        case scaling_shape::random: return "random";
+        case scaling_shape::forest: return "forest";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Parses a shape name as accepted by `--shapes`.
+ */
+inline std::optional<scaling_shape> parse_scaling_shape(std::string_view name) {
+    for (const auto shape : all_scaling_shapes) {
+        if (scaling_shape_name(shape) == name) return shape;
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Builds @p n scales of the given shape.
+ * @param shape The shape.
+ * @param n Number of scales.
+ * @param seed Seed of the random shape.
+ */
+inline std::vector<scale_wrapper> make_scaling_input(scaling_shape shape, std::size_t n, std::uint64_t seed) {
+    constexpr std::size_t forest_tree_size{1024};
+    switch (shape) {
+        case scaling_shape::chain: return make_chains(n, synthetic_depth_limit);
+        case scaling_shape::binary: return make_binary_tree(n);
+        case scaling_shape::random: return make_random_tree(n, seed);
+        case scaling_shape::forest: return make_forest(n, (n + forest_tree_size - 1) / forest_tree_size);
+    }
+    return {};
+}
+
+/**
+ * @brief Writes one input line per scale, naming sub-scales and printing pan masses.
+ * @param scales_list The scales, in the order their lines are written.
+ * @return The lines, each ending in a newline.
+ */
+inline std::vector<std::string> scale_input_lines(std::span<const scale_wrapper> scales_list) {
+    std::vector<std::string> lines;
+    lines.reserve(scales_list.size());
+    for (const auto& scale : scales_list) {
+        std::string line = scale->name;
+        for (std::size_t i = 0; i < scale->side_count(); ++i) {
+            const auto& side = scale->side(i);
+            line += ',';
+            line += std::holds_alternative<Pan>(side) ? std::to_string(std::get<Pan>(side).mass)
+                                                      : std::get<std::weak_ptr<Scale>>(side).lock()->name;
+        }
+        line += '\n';
+        lines.push_back(std::move(line));
+    }
+    return lines;
+}
+
+/**
+ * @brief Parameters of a scaling sweep.
+ */
+struct scaling_config {
+    unsigned max_threads{1};                ///< Highest thread count of the sweep.
+    std::size_t scales{1 << 16};            ///< Total scales (strong) or scales per thread (weak).
+    int repetitions{3};                     ///< Runs per point; the fastest one counts.
+    std::uint64_t seed{1};                  ///< Seed of the random shape.
+    bool parse{true};                       ///< Sweep the parse phase.
+    bool order{true};                       ///< Sweep the order phase.
+    bool balance{true};                     ///< Sweep the balance phase.
+    std::vector<scaling_shape> shapes{all_scaling_shapes.begin(), all_scaling_shapes.end()}; ///< Shapes to sweep.
+};
+
+/**
+ * @brief One measured point of a sweep.
+ */
+struct scaling_point {
+    bool weak{};              ///< Weak scaling if true, strong scaling otherwise.
+    std::string_view phase;   ///< "parse", "order" or "balance".
+    scaling_shape shape{};    ///< Input shape.
+    std::size_t depth{};      ///< Levels of the input.
+    unsigned threads{};       ///< Thread count.
+    std::size_t scales{};     ///< Total scales processed.
+    double seconds{};         ///< Best wall time.
+    double speedup{};         ///< Speedup over one thread; scaled speedup for weak scaling.
+    double efficiency{};      ///< Speedup per thread.
+};
+
+/// @brief Header of the CSV written by write_scaling_csv().
+inline constexpr std::string_view scaling_csv_header{
+    "scaling,phase,shape,depth,threads,scales,seconds,scales_per_second,speedup,efficiency"};
+
+/**
+ * @brief Writes @p point as one CSV row matching scaling_csv_header.
+ */
+inline void write_scaling_row(std::ostream& os, const scaling_point& point) {
+    os << (point.weak ? "weak" : "strong") << ',' << point.phase << ',' << scaling_shape_name(point.shape) << ','
+       << point.depth << ',' << point.threads << ',' << point.scales << ',' << point.seconds << ','
+       << static_cast<double>(point.scales) / std::max(point.seconds, 1e-9) << ',' << point.speedup << ','
+       << point.efficiency << '\n';
+}
+
+/**
+ * @brief Best wall time of @p run in seconds over @p repetitions runs.
+ */
+template <typename Run>
+double best_seconds(int repetitions, Run&& run) {
+    double best = std::numeric_limits<double>::max();
+    for (int r = 0; r < std::max(repetitions, 1); ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+/**
+ * @brief Times the concurrent ingestion of @p lines split into @p threads streams.
+ */
+inline double time_parse(std::span<const std::string> lines, unsigned threads, int repetitions) {
+    std::vector<std::string> texts(threads);
+    for (std::size_t i = 0; i < lines.size(); ++i) texts[i * threads / lines.size()] += lines[i];
+    std::vector<scale_wrapper> scales_list;
+    return best_seconds(repetitions, [&] {
+        std::vector<std::istringstream> streams(texts.begin(), texts.end());
+        std::vector<std::istream*> inputs;
+        for (auto& stream : streams) inputs.push_back(&stream);
+        parse_scale_streams(inputs, {}, scales_list, threads);
+    });
+}
+
+/**
+ * @brief Times linking and profiling @p scales_list with @p threads threads.
+ */
+inline double time_order(std::span<const scale_wrapper> scales_list, unsigned threads, int repetitions) {
+    return best_seconds(repetitions, [&] { profile_shape(scales_list, threads); });
+}
+
+/**
+ * @brief Times balancing @p scales_list with @p threads threads.
+ */
+inline double time_balance(std::span<scale_wrapper> scales_list, unsigned threads, int repetitions) {
+    const auto shape = profile_shape(scales_list);
+    const engine_choice choice{threads > 1 ? balance_engine::level_parallel : balance_engine::sequential, threads};
+    return best_seconds(repetitions, [&] { balance_with(scales_list, shape, choice); });
+}
+
+/**
+ * @brief Runs the strong- and weak-scaling sweeps.
+ * @param config What to sweep.
+ * @param on_point Called with every point as soon as it is measured.
+ */
+inline void run_scaling(const scaling_config& config, const std::function<void(const scaling_point&)>& on_point) {
+    const auto max_threads = std::max(config.max_threads, 1u);
+    auto time_phase = [&](std::string_view phase, scaling_shape shape, std::size_t n, unsigned threads,
+                          std::size_t& depth) {
+        auto scales_list = make_scaling_input(shape, n, config.seed);
+        depth = profile_shape(scales_list).depth();
+        if (phase == "parse") return time_parse(scale_input_lines(scales_list), threads, config.repetitions);
+        if (phase == "order") return time_order(scales_list, threads, config.repetitions);
+        return time_balance(scales_list, threads, config.repetitions);
+    };
+
+    for (const bool weak : {false, true}) {
+        for (const auto shape : config.shapes) {
+            for (const std::string_view phase : {"parse", "order", "balance"}) {
+                if ((phase == "parse" && !config.parse) || (phase == "order" && !config.order)
+                    || (phase == "balance" && !config.balance)) continue;
+                double single = 0;
+                for (unsigned threads = 1; threads <= max_threads; ++threads) {
+                    const auto n = weak ? config.scales * threads : config.scales;
+                    std::size_t depth = 0;
+                    const auto seconds = time_phase(phase, shape, n, threads, depth);
+                    if (threads == 1) single = seconds;
+                    const auto ratio = single / std::max(seconds, 1e-9);
+                    scaling_point point{weak, phase, shape, depth, threads, n, seconds, 0, 0};
+                    point.speedup = weak ? ratio * threads : ratio;
+                    point.efficiency = weak ? ratio : ratio / threads;
+                    on_point(point);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs the sweeps and writes every point as CSV, header first.
+ */
+inline void write_scaling_csv(std::ostream& os, const scaling_config& config) {
+    os << scaling_csv_header << '\n';
+    run_scaling(config, [&](const scaling_point& point) {
+        write_scaling_row(os, point);
+        os.flush();
+    });
+}
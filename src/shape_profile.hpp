@@ -0,0 +1,459 @@
+/**
+ * @file shape_profile.hpp
+ * @brief Index-based links and a cheap shape analysis of a parsed scale graph.
+ *
+ * The profile records how many scales there are, how many are roots and how they spread
+ * over levels, where a scale's level is its height above the pans (a scale holding only
+ * pans is on level 0). Every scale only depends on scales of lower levels, so grouping the
+ * scales by level also yields a valid bottom-up balancing order.
+ *
+ * profile_shape() computes the levels with one depth-first pass. profile_shape_parallel()
+ * computes the same profile on a pool of threads by peeling the graph from the pans up:
+ * each frontier holds the scales whose children are all done, and finishing a scale
+ * decrements an atomic counter of pending children on each of its parents, so the last
+ * child to finish puts a parent on the next frontier. link_scales_parallel() builds the
+ * links on the same kind of pool, so ordering a large graph has no serial pass left.
+ */
+
+#pragma once
+
+#include "scale.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief Child links of every scale, expressed as indices into the scales list.
+ *
+ * The sides are stored in compressed-sparse-row form: one flat array holds the child of
+ * every side, scale after scale, and an offsets array marks where each scale's sides begin.
+ */
+struct scale_links {
+    static constexpr std::uint32_t no_child{~std::uint32_t{0}}; ///< Marks a side holding a pan.
+
+    std::vector<std::uint32_t> side_offsets{0}; ///< Sides of scale i are [side_offsets[i], side_offsets[i + 1]).
+    std::vector<std::uint32_t> side_child;      ///< Child scale on each side, or no_child.
+
+    /// @brief Number of scales.
+    [[nodiscard]] std::size_t size() const { return side_offsets.size() - 1; }
+
+    /// @brief The child on each side of scale @p i, left first.
+    [[nodiscard]] std::span<const std::uint32_t> children(std::size_t i) const {
+        return std::span{side_child}.subspan(side_offsets[i], side_offsets[i + 1] - side_offsets[i]);
+    }
+};
+
+/**
+ * @brief Resolves the weak child references of every scale into list indices.
+ * @param scales_list The scales, in output order.
+ * @return The links; children outside the list are reported as pans.
+ */
+inline scale_links link_scales(std::span<const scale_wrapper> scales_list) {
+    std::unordered_map<const Scale*, std::uint32_t> index_of;
+    index_of.reserve(scales_list.size());
+    for (std::uint32_t i = 0; i < scales_list.size(); ++i) index_of.emplace(scales_list[i].get(), i);
+
+    auto child_of = [&](const pan_or_scale& side) {
+        if (std::holds_alternative<Pan>(side)) return scale_links::no_child;
+        const auto it = index_of.find(std::get<std::weak_ptr<Scale>>(side).lock().get());
+        return it != index_of.end() ? it->second : scale_links::no_child;
+    };
+
+    scale_links links;
+    links.side_offsets.reserve(scales_list.size() + 1);
+    links.side_child.reserve(2 * scales_list.size());
+    for (const auto& scale : scales_list) {
+        for (std::size_t i = 0; i < scale->side_count(); ++i) links.side_child.push_back(child_of(scale->side(i)));
+        links.side_offsets.push_back(static_cast<std::uint32_t>(links.side_child.size()));
+    }
+    return links;
+}
+
+/**
+ * @brief Computes the same links as link_scales() on a pool of threads.
+ *
+ * Every thread takes an even share of the list. It routes the index of each of its scales
+ * to the thread owning that scale's address, and each thread builds the pointer map of
+ * the addresses it owns. Then the threads resolve the sides of their own shares against
+ * all the maps, and write them at offsets from a prefix sum of their side counts.
+ * @param scales_list The scales, in output order.
+ * @param threads Number of threads, including the calling one.
+ * @return The links; children outside the list are reported as pans.
+ */
+inline scale_links link_scales_parallel(std::span<const scale_wrapper> scales_list, unsigned threads) {
+    const auto n = scales_list.size();
+    threads = std::max(threads, 1u);
+    if (threads == 1 || n == 0) return link_scales(scales_list);
+
+    using index_entry = std::pair<const Scale*, std::uint32_t>;
+    // outboxes[t][u]: the scales of thread t's share whose address thread u owns, by index
+    std::vector<std::vector<std::vector<index_entry>>> outboxes(threads, std::vector<std::vector<index_entry>>(threads));
+    std::vector<std::unordered_map<const Scale*, std::uint32_t>> index_of(threads);
+    auto owner = [&](const Scale* scale) { return (reinterpret_cast<std::uintptr_t>(scale) / alignof(Scale)) % threads; };
+
+    scale_links links;
+    links.side_offsets.resize(n + 1);
+    std::vector<std::size_t> thread_sides(threads + 1);
+    std::barrier sync{static_cast<std::ptrdiff_t>(threads)};
+    const auto chunk = (n + threads - 1) / threads;
+
+    auto worker = [&](unsigned t) {
+        const auto begin = std::min(n, t * chunk);
+        const auto end = std::min(n, begin + chunk);
+
+        std::size_t sides = 0;
+        for (auto i = begin; i < end; ++i) {
+            const auto* scale = scales_list[i].get();
+            outboxes[t][owner(scale)].emplace_back(scale, static_cast<std::uint32_t>(i));
+            sides += scale->side_count();
+        }
+        thread_sides[t + 1] = sides;
+        sync.arrive_and_wait();
+
+        // Outboxes are read in list order, so a scale listed twice keeps its first index
+        auto& owned = index_of[t];
+        std::size_t routed = 0;
+        for (unsigned u = 0; u < threads; ++u) routed += outboxes[u][t].size();
+        owned.reserve(routed);
+        for (unsigned u = 0; u < threads; ++u) {
+            for (const auto& [scale, i] : outboxes[u][t]) owned.emplace(scale, i);
+        }
+        if (t == 0) {
+            for (unsigned u = 0; u < threads; ++u) thread_sides[u + 1] += thread_sides[u];
+            links.side_child.resize(thread_sides[threads]);
+        }
+        sync.arrive_and_wait();
+
+        auto child_of = [&](const pan_or_scale& side) {
+            if (std::holds_alternative<Pan>(side)) return scale_links::no_child;
+            const auto child = std::get<std::weak_ptr<Scale>>(side).lock();
+            const auto& map = index_of[owner(child.get())];
+            const auto it = map.find(child.get());
+            return it != map.end() ? it->second : scale_links::no_child;
+        };
+        auto at = thread_sides[t];
+        for (auto i = begin; i < end; ++i) {
+            const auto& scale = *scales_list[i];
+            for (std::size_t k = 0; k < scale.side_count(); ++k) links.side_child[at++] = child_of(scale.side(k));
+            links.side_offsets[i + 1] = static_cast<std::uint32_t>(at);
+        }
+    };
+
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+        worker(0);
+    }
+    return links;
+}
+
+/**
+ * @brief Shape statistics and level decomposition of a scale graph.
+ */
+struct shape_profile {
+    std::size_t node_count{};                 ///< Number of scales.
+    std::size_t root_count{};                 ///< Scales that hang from no other scale.
+    std::size_t shared_count{};               ///< Scales held by more than one side.
+    std::vector<std::size_t> width;           ///< Number of scales on each level.
+    std::vector<std::uint32_t> order;         ///< Scale indices grouped by level, bottom-up.
+    std::vector<std::size_t> level_offsets;   ///< Level l is order[level_offsets[l], level_offsets[l + 1]).
+    std::vector<std::uint32_t> height;        ///< Level of each scale, by index.
+
+    /// @brief Number of levels, i.e. the height of the tallest tree.
+    [[nodiscard]] std::size_t depth() const { return width.size(); }
+
+    /// @brief Number of scales on the widest level.
+    [[nodiscard]] std::size_t max_width() const {
+        return width.empty() ? 0 : std::ranges::max(width);
+    }
+};
+
+/**
+ * @brief Computes the shape profile of a graph in O(N) without recursion.
+ *
+ * Links closing a cycle are ignored, so malformed input still yields a complete order.
+ * @param links The child links from link_scales().
+ * @return The profile.
+ */
+inline shape_profile profile_shape(const scale_links& links) {
+    const auto n = links.size();
+    enum : std::uint8_t { unvisited, open, done };
+    std::vector<std::uint8_t> state(n, unvisited);
+    std::vector<std::uint32_t> level(n, 0);
+    std::vector<std::uint8_t> parent_sides(n, 0); // saturates at 2
+
+    shape_profile shape;
+    shape.node_count = n;
+
+    std::vector<std::uint32_t> stack;
+    for (std::uint32_t start = 0; start < n; ++start) {
+        if (state[start] != unvisited) continue;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            const auto node = stack.back();
+            if (state[node] == unvisited) {
+                state[node] = open;
+                for (const auto child : links.children(node)) {
+                    if (child != scale_links::no_child && state[child] == unvisited) stack.push_back(child);
+                }
+                continue;
+            }
+            stack.pop_back();
+            if (state[node] == done) continue;
+
+            std::uint32_t height = 0;
+            for (const auto child : links.children(node)) {
+                if (child != scale_links::no_child && state[child] == done) {
+                    height = std::max(height, level[child] + 1);
+                }
+            }
+            level[node] = height;
+            state[node] = done;
+        }
+    }
+
+    for (const auto child : links.side_child) {
+        if (child != scale_links::no_child && parent_sides[child] < 2) ++parent_sides[child];
+    }
+    shape.root_count = static_cast<std::size_t>(std::ranges::count(parent_sides, 0));
+    shape.shared_count = static_cast<std::size_t>(std::ranges::count(parent_sides, 2));
+
+    // Counting sort of the scales by level; stable, so each level keeps the input order.
+    for (const auto l : level) {
+        if (l >= shape.width.size()) shape.width.resize(l + 1);
+        ++shape.width[l];
+    }
+    shape.level_offsets.assign(shape.width.size() + 1, 0);
+    for (std::size_t l = 0; l < shape.width.size(); ++l) {
+        shape.level_offsets[l + 1] = shape.level_offsets[l] + shape.width[l];
+    }
+    shape.order.resize(n);
+    auto next = shape.level_offsets;
+    for (std::uint32_t i = 0; i < n; ++i) shape.order[next[level[i]]++] = i;
+    shape.height = std::move(level);
+    return shape;
+}
+
+/// Frontiers smaller than this are peeled by one thread, sparing a barrier per level.
+inline constexpr std::size_t parallel_frontier{1 << 12};
+
+/**
+ * @brief Computes the same profile as profile_shape() on a pool of threads.
+ *
+ * Works in passes over the scales split evenly between the threads: count each scale's
+ * children and, atomically, its parents; lay out the parent lists with a parallel prefix
+ * sum and fill them; then peel frontiers from the scales without children up, one level
+ * per frontier. Frontiers narrower than parallel_frontier, as on chains, are peeled by a
+ * single thread until they widen again. Finally, the scales are sorted by level with a
+ * parallel, stable counting sort, so the order matches profile_shape() exactly.
+ *
+ * A graph with a cycle never peels completely; it is then profiled by profile_shape().
+ * @param links The child links from link_scales().
+ * @param threads Number of threads, including the calling one.
+ * @return The profile.
+ */
+inline shape_profile profile_shape_parallel(const scale_links& links, unsigned threads) {
+    const auto n = links.size();
+    threads = std::max(threads, 1u);
+    if (threads == 1 || n == 0) return profile_shape(links);
+
+    // Per scale: children not yet done, then parents as counted and as filled in
+    const auto pending = std::make_unique_for_overwrite<std::uint32_t[]>(n);
+    const auto parent_fill = std::make_unique_for_overwrite<std::uint32_t[]>(n);
+    const auto parent_begin = std::make_unique_for_overwrite<std::uint32_t[]>(n + 1);
+    std::unique_ptr<std::uint32_t[]> parents;
+
+    shape_profile shape;
+    shape.node_count = n;
+    shape.height.resize(n);
+
+    // Written by thread 0 between barriers, read by all threads after them
+    std::vector<std::size_t> thread_totals(threads + 1);
+    std::vector<std::size_t> thread_roots(threads);
+    std::vector<std::size_t> thread_shared(threads);
+    std::array<std::vector<std::vector<std::uint32_t>>, 2> frontiers{
+        std::vector<std::vector<std::uint32_t>>(threads), std::vector<std::vector<std::uint32_t>>(threads)};
+    std::size_t round = 0;
+    std::size_t peeled = 0;
+    std::vector<std::vector<std::size_t>> histograms(threads);
+
+    std::barrier sync{static_cast<std::ptrdiff_t>(threads)};
+    const auto chunk = (n + threads - 1) / threads;
+
+    auto frontier_size = [&](std::size_t r) {
+        std::size_t total = 0;
+        for (const auto& part : frontiers[r % 2]) total += part.size();
+        return total;
+    };
+    // Finishes scale v on level h: the parents it completes go to out
+    auto finish = [&](std::uint32_t v, std::uint32_t h, std::vector<std::uint32_t>& out) {
+        for (auto k = parent_begin[v]; k < parent_begin[v + 1]; ++k) {
+            const auto p = parents[k];
+            if (std::atomic_ref{pending[p]}.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                shape.height[p] = h + 1;
+                out.push_back(p);
+            }
+        }
+    };
+
+    auto worker = [&](unsigned t) {
+        const auto begin = std::min(n, t * chunk);
+        const auto end = std::min(n, begin + chunk);
+
+        for (auto i = begin; i < end; ++i) parent_fill[i] = 0;
+        sync.arrive_and_wait();
+
+        // Count children and parents
+        for (auto i = begin; i < end; ++i) {
+            std::uint32_t children = 0;
+            for (const auto child : links.children(i)) {
+                if (child == scale_links::no_child) continue;
+                ++children;
+                std::atomic_ref{parent_fill[child]}.fetch_add(1, std::memory_order_relaxed);
+            }
+            pending[i] = children;
+        }
+        sync.arrive_and_wait();
+
+        // Prefix sum of the parent counts: chunk totals, then their offsets, then the chunks
+        std::size_t total = 0;
+        std::size_t roots = 0;
+        std::size_t shared = 0;
+        for (auto i = begin; i < end; ++i) {
+            total += parent_fill[i];
+            roots += parent_fill[i] == 0;
+            shared += parent_fill[i] > 1;
+        }
+        thread_totals[t + 1] = total;
+        thread_roots[t] = roots;
+        thread_shared[t] = shared;
+        sync.arrive_and_wait();
+        if (t == 0) {
+            for (unsigned u = 0; u < threads; ++u) thread_totals[u + 1] += thread_totals[u];
+            parents = std::make_unique_for_overwrite<std::uint32_t[]>(thread_totals[threads]);
+            parent_begin[n] = static_cast<std::uint32_t>(thread_totals[threads]);
+            shape.root_count = std::reduce(thread_roots.begin(), thread_roots.end());
+            shape.shared_count = std::reduce(thread_shared.begin(), thread_shared.end());
+        }
+        sync.arrive_and_wait();
+        auto offset = static_cast<std::uint32_t>(thread_totals[t]);
+        for (auto i = begin; i < end; ++i) {
+            parent_begin[i] = offset;
+            offset += std::exchange(parent_fill[i], offset);
+        }
+        sync.arrive_and_wait();
+
+        // Fill in the parent lists and seed the first frontier with the scales holding only pans
+        for (auto i = begin; i < end; ++i) {
+            for (const auto child : links.children(i)) {
+                if (child == scale_links::no_child) continue;
+                parents[std::atomic_ref{parent_fill[child]}.fetch_add(1, std::memory_order_relaxed)] = static_cast<std::uint32_t>(i);
+            }
+            if (pending[i] == 0) frontiers[0][t].push_back(static_cast<std::uint32_t>(i));
+        }
+        sync.arrive_and_wait();
+
+        // Peel one level per round
+        for (;;) {
+            const auto width = frontier_size(round);
+            if (width == 0) break;
+            auto& current = frontiers[round % 2];
+            auto& next = frontiers[(round + 1) % 2];
+            if (width < parallel_frontier) {
+                sync.arrive_and_wait(); // every thread has seen this round before thread 0 moves on
+                if (t == 0) {
+                    // Peel alone until the frontier is wide enough to share again
+                    for (auto w = width; w > 0 && w < parallel_frontier; w = frontier_size(round)) {
+                        auto& out = frontiers[(round + 1) % 2];
+                        for (auto& part : out) part.clear();
+                        for (const auto& part : frontiers[round % 2]) {
+                            for (const auto v : part) finish(v, static_cast<std::uint32_t>(round), out[0]);
+                        }
+                        peeled += w;
+                        shape.width.push_back(w);
+                        ++round;
+                    }
+                }
+            } else {
+                // This thread's share of the frontier, as one range over all its parts
+                next[t].clear();
+                const auto share = (width + threads - 1) / threads;
+                auto skip = std::min(width, t * share);
+                auto left = std::min(width - skip, share);
+                for (const auto& part : current) {
+                    if (left == 0) break;
+                    if (skip >= part.size()) {
+                        skip -= part.size();
+                        continue;
+                    }
+                    const auto take = std::min(left, part.size() - skip);
+                    for (auto k = skip; k < skip + take; ++k) finish(part[k], static_cast<std::uint32_t>(round), next[t]);
+                    left -= take;
+                    skip = 0;
+                }
+                sync.arrive_and_wait();
+                if (t == 0) {
+                    peeled += width;
+                    shape.width.push_back(width);
+                    ++round;
+                }
+            }
+            sync.arrive_and_wait();
+        }
+        if (peeled != n) return; // a cycle: left to profile_shape()
+
+        // Stable counting sort by level: per-chunk histograms, their offsets, then the scatter
+        auto& histogram = histograms[t];
+        histogram.assign(shape.width.size(), 0);
+        for (auto i = begin; i < end; ++i) ++histogram[shape.height[i]];
+        sync.arrive_and_wait();
+        if (t == 0) {
+            shape.level_offsets.assign(shape.width.size() + 1, 0);
+            for (std::size_t l = 0; l < shape.width.size(); ++l) {
+                shape.level_offsets[l + 1] = shape.level_offsets[l] + shape.width[l];
+                auto at = shape.level_offsets[l];
+                for (auto& counts : histograms) at += std::exchange(counts[l], at);
+            }
+            shape.order.resize(n);
+        }
+        sync.arrive_and_wait();
+        for (auto i = begin; i < end; ++i) shape.order[histogram[shape.height[i]]++] = static_cast<std::uint32_t>(i);
+    };
+
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+        worker(0);
+    }
+    if (peeled != n) return profile_shape(links);
+    return shape;
+}
+
+/// Graphs smaller than this are profiled by one thread, which beats starting a pool.
+inline constexpr std::size_t parallel_profile_scales{1 << 16};
+
+/**
+ * @brief Convenience overload profiling a scales list directly.
+ */
+inline shape_profile profile_shape(std::span<const scale_wrapper> scales_list) {
+    return profile_shape(link_scales(scales_list));
+}
+
+/**
+ * @brief Profiles a scales list with up to @p threads threads; see link_scales_parallel()
+ *        and profile_shape_parallel().
+ */
+inline shape_profile profile_shape(std::span<const scale_wrapper> scales_list, unsigned threads) {
+    if (scales_list.size() < parallel_profile_scales) return profile_shape(scales_list);
+    return profile_shape_parallel(link_scales_parallel(scales_list, threads), threads);
+}
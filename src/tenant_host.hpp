@@ -0,0 +1,360 @@
+/**
+ * @file tenant_host.hpp
+ * @brief Hosts many independent, named scale graphs in one process on a shared thread pool.
+ *
+ * Each tenant is a scale_server of its own, with its own graph, name table and latency
+ * statistics, so tenants never see each other's scales. Requests are queued per tenant
+ * and run by one pool of threads for all tenants. The pool picks the runnable tenant that
+ * has used the least CPU time so far, like a fair-share scheduler: a tenant with a long
+ * backlog or expensive requests cannot starve the others, and a tenant that was idle
+ * starts level with the busiest one rather than catching up on its idle time. A tenant's
+ * requests run one at a time, in the order they were submitted.
+ *
+ * A tenant's reloads and compactions run on the pool as well, queued behind its requests
+ * and charged to it, but without holding up the requests that follow: its queries keep
+ * being answered from the current graph while a reload parses, on the one pool thread.
+ *
+ * Every tenant is accounted for separately: scales, approximate heap bytes of its graph
+ * and latency histograms, requests, rejected requests and the thread CPU time its requests
+ * and background work took. A tenant's requests run one at a time, so it keeps a single
+ * shared set of latency histograms rather than one per pool thread (see latency_stats). Limits cap the scales and memory of a tenant, checked before each ADD or SET and
+ * against a reloaded graph before it is swapped in, and the number of its queued requests,
+ * checked on submission. Limits are soft by one edit: an edit that starts below the limit
+ * may end above it, and only later growing edits are refused. A reload over a limit fails
+ * and counts as a rejected request.
+ */
+
+#pragma once
+
+#include "scale_server.hpp"
+
+#include <ctime>
+#include <deque>
+#include <future>
+#include <map>
+#include <set>
+#include <thread>
+
+/**
+ * @brief Per-tenant limits; zero means unlimited.
+ */
+struct tenant_limits {
+    std::size_t max_scales{};       ///< Scales, checked before ADD and SET and on RELOAD.
+    std::size_t max_memory_bytes{}; ///< Approximate graph heap bytes, checked before ADD and SET and on RELOAD.
+    std::size_t max_queue{};        ///< Requests queued and not yet run.
+};
+
+/**
+ * @brief What a tenant has used so far.
+ */
+struct tenant_usage {
+    std::size_t scales{};           ///< Scales in its graph.
+    std::size_t memory_bytes{};     ///< Approximate heap bytes of its graph and latency histograms.
+    std::uint64_t requests{};       ///< Requests run.
+    std::uint64_t rejected{};       ///< Requests refused by a limit.
+    std::chrono::nanoseconds cpu{}; ///< Thread CPU time of the requests and background work run.
+};
+
+/**
+ * @brief Serves many named scale graphs from one pool of threads.
+ */
+class tenant_host {
+public:
+    /**
+     * @param threads Size of the shared pool.
+     */
+    explicit tenant_host(unsigned threads) {
+        workers_.reserve(std::max(threads, 1u));
+        for (unsigned t = 0; t < std::max(threads, 1u); ++t) workers_.emplace_back([this] { work(); });
+    }
+
+    tenant_host(const tenant_host&) = delete;
+    tenant_host& operator=(const tenant_host&) = delete;
+
+    /// @brief Runs the queued requests, then stops the pool.
+    ~tenant_host() {
+        {
+            std::lock_guard lock{mutex_};
+            stopping_ = true;
+        }
+        ready_.notify_all();
+        workers_.clear();
+    }
+
+    /**
+     * @brief Adds a tenant serving @p graph.
+     * @return False if @p name is empty, contains a space or is taken.
+     */
+    bool create(const std::string& name, scale_graph graph, const tenant_limits& limits = {}) {
+        if (name.empty() || name.find(' ') != std::string::npos) return false;
+        std::lock_guard lock{mutex_};
+        if (tenants_.contains(name)) return false;
+        const auto t = std::make_shared<tenant>(std::move(graph), limits);
+        t->server.run_background_with({
+            [this, owner = std::weak_ptr{t}](std::function<void()> task) { submit_background(owner, std::move(task)); },
+            1, // the pool thread running the reload parses it
+            [self = t.get()](const scale_graph& fresh) { return self->admits(fresh); },
+        });
+        tenants_.emplace(name, t);
+        return true;
+    }
+
+    /**
+     * @brief Removes a tenant; its queued requests answer `ERROR unknown tenant`.
+     * @return False if there is no such tenant.
+     */
+    bool drop(std::string_view name) {
+        std::lock_guard lock{mutex_};
+        const auto it = tenants_.find(name);
+        if (it == tenants_.end()) return false;
+        const auto t = std::move(it->second);
+        tenants_.erase(it);
+        t->dropped = true;
+        runnable_.erase({t->vruntime, t});
+        for (auto& job : t->queue) job.done.set_value(error("unknown tenant"));
+        t->queue.clear();
+        return true;
+    }
+
+    /// @brief Names of the tenants, in order.
+    [[nodiscard]] std::vector<std::string> tenants() const {
+        std::lock_guard lock{mutex_};
+        std::vector<std::string> names;
+        for (const auto& [name, t] : tenants_) names.push_back(name);
+        return names;
+    }
+
+    /**
+     * @brief Queues a request for a tenant.
+     * @param name The tenant.
+     * @param request A scale_server request line.
+     * @return The future response; a refused request is answered right away.
+     */
+    std::future<std::string> submit(std::string_view name, std::string request) {
+        std::promise<std::string> done;
+        auto response = done.get_future();
+        {
+            std::lock_guard lock{mutex_};
+            const auto it = tenants_.find(name);
+            if (it == tenants_.end()) {
+                done.set_value(error("unknown tenant"));
+                return response;
+            }
+            const auto& t = it->second;
+            if (t->limits.max_queue && t->queue.size() >= t->limits.max_queue) {
+                t->rejected.fetch_add(1, std::memory_order_relaxed);
+                done.set_value(error("tenant queue full"));
+                return response;
+            }
+            t->queue.push_back({std::move(request), std::move(done), {}});
+            if (t->queue.size() == 1 && !t->running) {
+                // An idle tenant starts level with the others instead of catching up
+                t->vruntime = std::max(t->vruntime, floor_);
+                runnable_.emplace(t->vruntime, t);
+            }
+        }
+        ready_.notify_one();
+        return response;
+    }
+
+    /**
+     * @brief Runs a request for a tenant and waits for the response.
+     */
+    std::string handle(std::string_view name, std::string request) { return submit(name, std::move(request)).get(); }
+
+    /**
+     * @brief What a tenant has used so far.
+     * @return The usage, or std::nullopt if there is no such tenant.
+     */
+    [[nodiscard]] std::optional<tenant_usage> usage(std::string_view name) const {
+        std::shared_ptr<tenant> t;
+        {
+            std::lock_guard lock{mutex_};
+            const auto it = tenants_.find(name);
+            if (it == tenants_.end()) return std::nullopt;
+            t = it->second;
+        }
+        return t->usage();
+    }
+
+    /**
+     * @brief Prints one line per tenant:
+     *        `name scales=N memory_bytes=N requests=N rejected=N cpu_ns=N`.
+     */
+    void report(std::ostream& os) const {
+        for (const auto& name : tenants()) {
+            const auto u = usage(name);
+            if (!u) continue;
+            os << name << " scales=" << u->scales << " memory_bytes=" << u->memory_bytes << " requests=" << u->requests
+               << " rejected=" << u->rejected << " cpu_ns=" << u->cpu.count() << '\n';
+        }
+    }
+
+    /**
+     * @brief Runs requests from a stream until it ends.
+     *
+     * Each line is `tenant request`, or `TENANTS` for the report() lines followed by OK.
+     * Requests of all tenants run concurrently on the pool; responses are written in the
+     * order of the requests.
+     * @param in The request stream.
+     * @param out The response stream, flushed whenever it catches up with the requests.
+     */
+    void serve(std::istream& in, std::ostream& out) {
+        constexpr std::size_t max_in_flight = 1024;
+        std::deque<std::future<std::string>> responses;
+        auto write_ready = [&](bool wait) {
+            while (!responses.empty()
+                   && (wait || responses.front().wait_for(std::chrono::seconds{0}) == std::future_status::ready)) {
+                out << responses.front().get();
+                responses.pop_front();
+            }
+            out << std::flush;
+        };
+
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line.front() == '#') continue;
+            if (line == "TENANTS") {
+                write_ready(true); // report the usage after every earlier request
+                report(out);
+                out << "OK\n" << std::flush;
+                continue;
+            }
+            const auto space = line.find(' ');
+            responses.push_back(space == std::string::npos
+                ? submit(line, {})
+                : submit(std::string_view{line}.substr(0, space), line.substr(space + 1)));
+            write_ready(responses.size() >= max_in_flight);
+        }
+        write_ready(true);
+    }
+
+private:
+    struct job {
+        std::string request;
+        std::promise<std::string> done;
+        std::function<void()> task; ///< Background work of the tenant's server, instead of a request.
+    };
+
+    struct tenant {
+        tenant(scale_graph graph, const tenant_limits& tenant_limits)
+            : server{std::move(graph), {}, latency_recording::shared}, limits{tenant_limits} {}
+
+        /// Runs one request, unless it would grow the graph past a limit.
+        std::string run(std::string_view request) {
+            const auto verb = request.substr(0, request.find(' '));
+            if ((verb == "ADD" || verb == "SET")
+                && ((limits.max_scales && server.scale_count() >= limits.max_scales)
+                    || (limits.max_memory_bytes && memory_bytes() >= limits.max_memory_bytes))) {
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                return error("tenant limit");
+            }
+            return server.handle(request);
+        }
+
+        /// Heap bytes of the graph and the latency histograms.
+        [[nodiscard]] std::size_t memory_bytes() const { return server.memory_bytes() + server.latencies().memory_bytes(); }
+
+        /// True if a reloaded graph stays within the limits; counts a refusal as rejected.
+        bool admits(const scale_graph& fresh) {
+            if ((limits.max_scales && fresh.size() - fresh.holes() > limits.max_scales)
+                || (limits.max_memory_bytes && fresh.memory_bytes() + server.latencies().memory_bytes() > limits.max_memory_bytes)) {
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+        [[nodiscard]] tenant_usage usage() const {
+            return {server.scale_count(), memory_bytes(), requests.load(std::memory_order_relaxed),
+                    rejected.load(std::memory_order_relaxed),
+                    std::chrono::nanoseconds{cpu_ns.load(std::memory_order_relaxed)}};
+        }
+
+        scale_server server;
+        tenant_limits limits;
+        std::atomic<std::uint64_t> requests{0};
+        std::atomic<std::uint64_t> rejected{0};
+        std::atomic<std::uint64_t> cpu_ns{0};
+        // Guarded by the host's mutex
+        std::deque<job> queue;     ///< Requests not yet run, in order.
+        std::uint64_t vruntime{};  ///< CPU nanoseconds used, as the scheduler counts them.
+        bool running{};            ///< A worker is running one of its requests.
+        bool dropped{};            ///< No longer hosted; takes no more background work.
+    };
+
+    static std::string error(std::string_view reason) { return "ERROR " + std::string{reason} + '\n'; }
+
+    /// CPU time the calling thread has used.
+    static std::uint64_t thread_cpu_ns() {
+        timespec now{};
+        ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return static_cast<std::uint64_t>(now.tv_sec) * 1'000'000'000 + static_cast<std::uint64_t>(now.tv_nsec);
+    }
+
+    /// Queues background work of a tenant's server behind its requests.
+    void submit_background(const std::weak_ptr<tenant>& owner, std::function<void()> task) {
+        {
+            std::lock_guard lock{mutex_};
+            const auto t = owner.lock();
+            if (!t || t->dropped) return;
+            t->queue.push_back({{}, {}, std::move(task)});
+            if (t->queue.size() == 1 && !t->running) {
+                t->vruntime = std::max(t->vruntime, floor_);
+                runnable_.emplace(t->vruntime, t);
+            }
+        }
+        ready_.notify_one();
+    }
+
+    /// Worker loop: runs one request of the tenant that has used the least CPU time.
+    void work() {
+        std::unique_lock lock{mutex_};
+        for (;;) {
+            ready_.wait(lock, [&] { return stopping_ || !runnable_.empty(); });
+            if (runnable_.empty()) return;
+            auto next = runnable_.extract(runnable_.begin());
+            const auto t = std::move(next.value().second);
+            floor_ = std::max(floor_, t->vruntime);
+            auto [request, done, task] = std::move(t->queue.front());
+            t->queue.pop_front();
+            if (task) {
+                // Background work does not hold up the tenant's next requests
+                if (!t->queue.empty()) runnable_.emplace(t->vruntime, t);
+                lock.unlock();
+                ready_.notify_one();
+                const auto start = thread_cpu_ns();
+                task();
+                const auto spent = thread_cpu_ns() - start;
+                t->cpu_ns.fetch_add(spent, std::memory_order_relaxed);
+                lock.lock();
+                const auto queued = runnable_.erase({t->vruntime, t}) > 0;
+                t->vruntime += spent;
+                if (queued) runnable_.emplace(t->vruntime, t);
+                continue;
+            }
+            t->running = true;
+            lock.unlock();
+
+            const auto start = thread_cpu_ns();
+            auto response = t->run(request);
+            const auto spent = thread_cpu_ns() - start;
+            t->requests.fetch_add(1, std::memory_order_relaxed);
+            t->cpu_ns.fetch_add(spent, std::memory_order_relaxed);
+            done.set_value(std::move(response));
+
+            lock.lock();
+            t->running = false;
+            t->vruntime += spent;
+            if (!t->queue.empty()) runnable_.emplace(t->vruntime, t);
+        }
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_; ///< A tenant became runnable, or the pool must stop.
+    std::map<std::string, std::shared_ptr<tenant>, std::less<>> tenants_;
+    std::set<std::pair<std::uint64_t, std::shared_ptr<tenant>>> runnable_; ///< Tenants with queued requests, by CPU used.
+    std::uint64_t floor_{};                                                 ///< CPU used by the latest tenant picked.
+    bool stopping_{};
+    std::vector<std::jthread> workers_; ///< Declared last, so they stop first.
+};
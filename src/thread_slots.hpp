@@ -0,0 +1,97 @@
+/**
+ * @file thread_slots.hpp
+ * @brief One cache-line-aligned slot of state per thread, for contention-free counters.
+ *
+ * Hot paths update the slot of the calling thread only, so no two threads ever write the
+ * same cache line; readers visit all slots and combine them. A slot survives its thread,
+ * so nothing recorded is lost when a worker exits.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief Per-thread instances of @p Slot, created on first use by each thread.
+ *
+ * local() may be called from any number of threads; it only takes a lock the first time a
+ * thread uses a given instance, as long as the thread uses no more than cache_entries
+ * instances of the same Slot type in turn. Slot members written by their thread and read by
+ * for_each() must be atomics.
+ */
+template <typename Slot>
+class thread_slots {
+public:
+    /// Instances of one Slot type whose slots a thread finds without the lock.
+    static constexpr std::size_t cache_entries{8};
+
+    thread_slots() = default;
+    thread_slots(const thread_slots&) = delete;
+    thread_slots& operator=(const thread_slots&) = delete;
+
+    /**
+     * @brief The calling thread's slot.
+     */
+    Slot& local() {
+        // The calling thread's slots of its most recently used instances, most recent first,
+        // tagged with the owning instance.
+        thread_local std::array<cache_entry, cache_entries> cache{};
+        if (cache[0].owner == id_) return *cache[0].slot;
+        for (std::size_t i = 1; i < cache_entries; ++i) {
+            if (cache[i].owner == id_) {
+                std::rotate(cache.begin(), cache.begin() + static_cast<std::ptrdiff_t>(i), cache.begin() + static_cast<std::ptrdiff_t>(i) + 1);
+                return *cache[0].slot;
+            }
+        }
+
+        std::scoped_lock guard{lock_};
+        auto& owned = slots_[std::this_thread::get_id()];
+        if (!owned) owned = std::make_unique<padded>();
+        std::rotate(cache.begin(), cache.end() - 1, cache.end());
+        cache[0] = {id_, &owned->value};
+        return owned->value;
+    }
+
+    /**
+     * @brief Approximate heap bytes of the slots created so far and their table.
+     */
+    [[nodiscard]] std::size_t memory_bytes() const {
+        std::scoped_lock guard{lock_};
+        return slots_.size() * (sizeof(padded) + sizeof(typename decltype(slots_)::value_type) + 2 * sizeof(void*))
+            + slots_.bucket_count() * sizeof(void*);
+    }
+
+    /**
+     * @brief Calls @p visit with every slot created so far.
+     */
+    template <typename Visitor>
+    void for_each(Visitor&& visit) const {
+        std::scoped_lock guard{lock_};
+        for (const auto& [thread, slot] : slots_) visit(std::as_const(slot->value));
+    }
+
+private:
+    struct cache_entry {
+        std::uint64_t owner{0}; ///< id_ of the instance; 0 is never used.
+        Slot* slot{nullptr};
+    };
+
+    struct alignas(64) padded {
+        Slot value{};
+    };
+
+    static inline std::atomic<std::uint64_t> next_id_{1};
+
+    const std::uint64_t id_{next_id_++}; ///< Never reused, unlike the instance's address.
+    mutable std::mutex lock_;
+    std::unordered_map<std::thread::id, std::unique_ptr<padded>> slots_;
+};
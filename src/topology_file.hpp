@@ -0,0 +1,552 @@
+/**
+ * @file topology_file.hpp
+ * @brief Binary topology file with a persisted, mmap-able name index.
+ *
+ * A topology file stores the parsed scale graph as flat, fixed-width records so that it
+ * can be mapped into memory and used in place. Next to the node records it stores a name
+ * index: every name's 64-bit fingerprint, sorted, with a small bucket directory keyed on
+ * the fingerprint's top bits. A lookup hashes the name, jumps to its bucket and compares a
+ * handful of fingerprints, so queries work the moment the file is mapped, without first
+ * rebuilding a hash table.
+ *
+ * Nodes are grouped by connected component (a top-level tree with everything hanging from
+ * it), and a component directory records each group's root, node range and name byte
+ * range. The names and extra sides follow the same grouping, so loading a single tree with
+ * load_components() reads only that tree's records and the few index entries of the names
+ * looked up: on a mapped file, only those pages are faulted in, however large the archive.
+ * Components appear in the order of their first scale in the output, and a separate order
+ * table restores the exact output order when the whole graph is loaded.
+ *
+ * Layout (native endianness, every section 8-byte aligned):
+ *     topology_header
+ *     topology_node[node_count]              grouped by component, in output order within each
+ *     std::uint32_t[(1 << bucket_bits) + 1]  bucket directory into the index
+ *     name_index_entry[node_count]           sorted by fingerprint
+ *     char[names_size]                       concatenated names, in node order
+ *     topology_side[sides_count]             third and further sides, in node order
+ *     topology_component[component_count]    component directory, in node order
+ *     std::uint32_t[node_count]              node index of each output position
+ */
+
+#pragma once
+
+#include "scale.hpp"
+
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Fixed-size header at the start of a topology file.
+ */
+struct topology_header {
+    static constexpr std::array<char, 8> expected_magic{'S', 'B', 'T', 'O', 'P', 'O', '\0', '\1'};
+    static constexpr std::uint32_t current_version{4};
+
+    std::array<char, 8> magic{expected_magic}; ///< File signature.
+    std::uint32_t version{current_version};    ///< Format version.
+    std::uint16_t bucket_bits{};               ///< log2 of the bucket directory size.
+    std::uint16_t mass_decimals{};             ///< Fixed-point places of all masses; see mass_format.
+    std::uint64_t node_count{};                ///< Number of scales.
+    std::uint64_t nodes_offset{};              ///< Byte offset of the node records.
+    std::uint64_t buckets_offset{};            ///< Byte offset of the bucket directory.
+    std::uint64_t index_offset{};              ///< Byte offset of the sorted name index.
+    std::uint64_t names_offset{};              ///< Byte offset of the name blob.
+    std::uint64_t names_size{};                ///< Size of the name blob in bytes.
+    std::uint64_t sides_offset{};              ///< Byte offset of the extra side records.
+    std::uint64_t sides_count{};               ///< Number of extra side records.
+    std::uint64_t components_offset{};         ///< Byte offset of the component directory.
+    std::uint64_t component_count{};           ///< Number of connected components.
+    std::uint64_t order_offset{};              ///< Byte offset of the output order table.
+};
+
+/**
+ * @brief One scale as stored in a topology file.
+ *
+ * A side is either a pan, in which case the child is `no_child` and the mass holds its
+ * weight, or the index of another node. Sides beyond the second are stored in a separate
+ * array; those of node i run from its `extra_first` to the next node's.
+ */
+struct topology_node {
+    static constexpr std::uint32_t no_child{~std::uint32_t{0}};
+
+    std::int64_t left_mass{};             ///< Pan weight of the left side.
+    std::int64_t right_mass{};            ///< Pan weight of the right side.
+    std::uint32_t left_child{no_child};   ///< Node index of the left scale, if any.
+    std::uint32_t right_child{no_child};  ///< Node index of the right scale, if any.
+    std::uint64_t name_offset{};          ///< Offset of the name within the name blob.
+    std::uint32_t name_length{};          ///< Length of the name in bytes.
+    std::uint32_t extra_first{};          ///< Index of the node's first extra side record.
+};
+
+/**
+ * @brief A third or further side of a node, encoded like the sides in topology_node.
+ */
+struct topology_side {
+    std::int64_t mass{};                            ///< Pan weight, if the side holds a pan.
+    std::uint32_t child{topology_node::no_child};   ///< Node index of the scale, if any.
+    std::uint32_t reserved{};
+};
+
+/**
+ * @brief Directory entry of one connected component.
+ *
+ * The component's nodes are `node_count` consecutive records from `node_first`, and every
+ * side of them refers to a node within that range.
+ */
+struct topology_component {
+    std::uint32_t root{};         ///< Node index of the top-level scale, or of the first node if it has none.
+    std::uint32_t node_first{};   ///< Index of the component's first node.
+    std::uint32_t node_count{};   ///< Number of nodes in the component.
+    std::uint32_t reserved{};
+    std::uint64_t names_offset{}; ///< Offset of the component's names within the name blob.
+    std::uint64_t names_size{};   ///< Size of the component's names in bytes.
+};
+
+/**
+ * @brief Entry of the sorted name index.
+ */
+struct name_index_entry {
+    std::uint64_t fingerprint{}; ///< name_fingerprint() of the node's name.
+    std::uint32_t node{};        ///< Index of the node carrying that name.
+    std::uint32_t reserved{};
+};
+
+static_assert(sizeof(topology_header) == 104);
+static_assert(sizeof(topology_node) == 40);
+static_assert(sizeof(topology_side) == 16);
+static_assert(sizeof(topology_component) == 32);
+static_assert(sizeof(name_index_entry) == 16);
+
+/**
+ * @brief Computes the 64-bit fingerprint used by the persisted name index.
+ *
+ * FNV-1a followed by a murmur-style finalizer, so that the top bits used for bucketing
+ * are well mixed even for short, similar names.
+ */
+constexpr std::uint64_t name_fingerprint(std::string_view name) {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb3f91a2bc1b3ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * @brief Read-only view of a topology file held in memory or mapped from disk.
+ *
+ * The view never copies; all accessors read straight out of the underlying bytes.
+ */
+class topology_view {
+public:
+    topology_view() = default;
+
+    /**
+     * @brief Wraps a buffer holding a complete topology file.
+     * @param bytes The file contents; must be 8-byte aligned and outlive the view.
+     */
+    explicit topology_view(std::span<const std::byte> bytes) {
+        if (bytes.size() < sizeof(topology_header)) return;
+        const auto* header = reinterpret_cast<const topology_header*>(bytes.data());
+        if (header->magic != topology_header::expected_magic
+            || header->version != topology_header::current_version
+            || header->bucket_bits > 32 || header->mass_decimals > mass_format::max_decimals) return;
+
+        // Bound the count before any size is computed from it, so no product can wrap
+        const auto n = header->node_count;
+        if (n >= topology_node::no_child || n > bytes.size() / sizeof(topology_node)) return;
+        const auto buckets = (std::uint64_t{1} << header->bucket_bits) + 1;
+        auto fits = [&](std::uint64_t offset, std::uint64_t size) {
+            return offset % 8 == 0 && offset <= bytes.size() && size <= bytes.size() - offset;
+        };
+        if (!fits(header->nodes_offset, n * sizeof(topology_node))
+            || !fits(header->buckets_offset, buckets * sizeof(std::uint32_t))
+            || !fits(header->index_offset, n * sizeof(name_index_entry))
+            || header->names_offset > bytes.size()
+            || header->names_size > bytes.size() - header->names_offset
+            || header->sides_count >= topology_node::no_child
+            || !fits(header->sides_offset, header->sides_count * sizeof(topology_side))
+            || header->component_count > n
+            || !fits(header->components_offset, header->component_count * sizeof(topology_component))
+            || !fits(header->order_offset, n * sizeof(std::uint32_t))) return;
+
+        header_ = header;
+        nodes_ = {reinterpret_cast<const topology_node*>(bytes.data() + header->nodes_offset), n};
+        buckets_ = {reinterpret_cast<const std::uint32_t*>(bytes.data() + header->buckets_offset), buckets};
+        index_ = {reinterpret_cast<const name_index_entry*>(bytes.data() + header->index_offset), n};
+        names_ = {reinterpret_cast<const char*>(bytes.data() + header->names_offset), header->names_size};
+        sides_ = {reinterpret_cast<const topology_side*>(bytes.data() + header->sides_offset), header->sides_count};
+        components_ = {reinterpret_cast<const topology_component*>(bytes.data() + header->components_offset),
+                       header->component_count};
+        order_ = {reinterpret_cast<const std::uint32_t*>(bytes.data() + header->order_offset), n};
+    }
+
+    /// @brief True if the buffer held a well-formed topology file.
+    [[nodiscard]] bool valid() const { return header_ != nullptr; }
+
+    /// @brief Notation of the stored masses, which are kept in fixed-point units.
+    [[nodiscard]] mass_format format() const { return {valid() ? header_->mass_decimals : 0u}; }
+
+    /// @brief Number of scales stored in the file.
+    [[nodiscard]] std::size_t size() const { return nodes_.size(); }
+
+    /// @brief The node record at @p i.
+    [[nodiscard]] const topology_node& node(std::size_t i) const { return nodes_[i]; }
+
+    /// @brief The name of the node at @p i.
+    [[nodiscard]] std::string_view name(std::size_t i) const {
+        const auto& n = nodes_[i];
+        if (n.name_offset > names_.size() || n.name_length > names_.size() - n.name_offset) return {};
+        return names_.substr(n.name_offset, n.name_length);
+    }
+
+    /// @brief The sides of the node at @p i beyond its left and right one.
+    [[nodiscard]] std::span<const topology_side> extra_sides(std::size_t i) const {
+        const std::size_t first = std::min<std::size_t>(nodes_[i].extra_first, sides_.size());
+        const std::size_t last = i + 1 < nodes_.size() ? nodes_[i + 1].extra_first : sides_.size();
+        return sides_.subspan(first, std::clamp(last, first, sides_.size()) - first);
+    }
+
+    /// @brief Number of connected components.
+    [[nodiscard]] std::size_t component_count() const { return components_.size(); }
+
+    /// @brief The directory entry of component @p c.
+    [[nodiscard]] const topology_component& component(std::size_t c) const { return components_[c]; }
+
+    /**
+     * @brief The component holding the node at @p node, found by bisecting the directory.
+     * @return Its index, or std::nullopt if no component covers the node.
+     */
+    [[nodiscard]] std::optional<std::uint32_t> component_of(std::uint32_t node) const {
+        const auto it = std::ranges::upper_bound(components_, node, {}, &topology_component::node_first);
+        if (it == components_.begin()) return std::nullopt;
+        const auto& c = *std::prev(it);
+        if (node - c.node_first >= c.node_count) return std::nullopt;
+        return static_cast<std::uint32_t>(std::prev(it) - components_.begin());
+    }
+
+    /// @brief The node index of the scale at output position @p position.
+    [[nodiscard]] std::uint32_t node_at(std::size_t position) const { return order_[position]; }
+
+    /**
+     * @brief Finds the node carrying @p name using the persisted index.
+     * @return Its node index, or std::nullopt if no scale has that name.
+     */
+    [[nodiscard]] std::optional<std::uint32_t> find(std::string_view name) const {
+        if (!valid()) return std::nullopt;
+        const auto fp = name_fingerprint(name);
+        const auto bucket = header_->bucket_bits == 0 ? 0 : fp >> (64 - header_->bucket_bits);
+        const auto first = std::min<std::size_t>(buckets_[bucket], index_.size());
+        const auto last = std::clamp<std::size_t>(buckets_[bucket + 1], first, index_.size());
+
+        const auto range = index_.subspan(first, last - first);
+        auto it = std::ranges::lower_bound(range, fp, {}, &name_index_entry::fingerprint);
+        for (; it != range.end() && it->fingerprint == fp; ++it) {
+            if (it->node < nodes_.size() && this->name(it->node) == name) return it->node;
+        }
+        return std::nullopt;
+    }
+
+private:
+    const topology_header* header_{};
+    std::span<const topology_node> nodes_;
+    std::span<const std::uint32_t> buckets_;
+    std::span<const name_index_entry> index_;
+    std::string_view names_;
+    std::span<const topology_side> sides_;
+    std::span<const topology_component> components_;
+    std::span<const std::uint32_t> order_;
+};
+
+/**
+ * @brief Writes the scale graph, with its name index, as a topology file.
+ * @param os Binary output stream.
+ * @param scales_list The scales to store, in output order.
+ * @param format Notation the masses were parsed with; recorded so loading restores it.
+ * @return False if the graph is too large for the format or the stream failed.
+ */
+inline bool write_topology(std::ostream& os, std::span<const scale_wrapper> scales_list,
+                           const mass_format& format = {}) {
+    if (scales_list.size() >= topology_node::no_child) return false;
+    std::size_t extra_sides = 0;
+    for (const auto& scale : scales_list) extra_sides += scale->extra_sides.size();
+    if (extra_sides >= topology_node::no_child) return false;
+
+    std::unordered_map<const Scale*, std::uint32_t> position_of;
+    position_of.reserve(scales_list.size());
+    for (std::uint32_t i = 0; i < scales_list.size(); ++i) position_of.emplace(scales_list[i].get(), i);
+    auto child_position = [&](const pan_or_scale& side) -> std::optional<std::uint32_t> {
+        if (std::holds_alternative<Pan>(side)) return std::nullopt;
+        const auto it = position_of.find(std::get<std::weak_ptr<Scale>>(side).lock().get());
+        return it != position_of.end() ? std::optional{it->second} : std::nullopt;
+    };
+
+    // Union the scales along their links, with each set represented by its earliest position.
+    std::vector<std::uint32_t> set(scales_list.size());
+    std::vector<bool> held(scales_list.size());
+    for (std::uint32_t i = 0; i < set.size(); ++i) set[i] = i;
+    auto find_set = [&](std::uint32_t i) {
+        while (set[i] != i) i = set[i] = set[set[i]];
+        return i;
+    };
+    for (std::uint32_t i = 0; i < scales_list.size(); ++i) {
+        for (std::size_t s = 0; s < scales_list[i]->side_count(); ++s) {
+            const auto child = child_position(scales_list[i]->side(s));
+            if (!child) continue;
+            held[*child] = true;
+            const auto a = find_set(i), b = find_set(*child);
+            set[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    // Number the nodes component by component, keeping the output order within each.
+    std::vector<std::uint32_t> members_before(scales_list.size() + 1);
+    for (std::uint32_t i = 0; i < set.size(); ++i) ++members_before[find_set(i) + 1];
+    std::vector<topology_component> components;
+    for (std::uint32_t r = 0; r < set.size(); ++r) {
+        const auto count = members_before[r + 1];
+        members_before[r + 1] = members_before[r] + count;
+        if (count > 0) components.push_back({topology_node::no_child, members_before[r], count, 0, 0, 0});
+    }
+    std::vector<std::uint32_t> node_of_position(scales_list.size());
+    std::vector<std::uint32_t> position_of_node(scales_list.size());
+    for (std::uint32_t i = 0; i < set.size(); ++i) {
+        const auto node = members_before[find_set(i)]++;
+        node_of_position[i] = node;
+        position_of_node[node] = i;
+    }
+
+    std::vector<topology_node> nodes(scales_list.size());
+    std::vector<topology_side> sides;
+    std::vector<name_index_entry> index(scales_list.size());
+    std::string names;
+
+    auto store_side = [&](const pan_or_scale& side, std::int64_t& mass, std::uint32_t& child) {
+        if (std::holds_alternative<Pan>(side)) mass = std::get<Pan>(side).mass;
+        else if (const auto position = child_position(side)) child = node_of_position[*position];
+    };
+
+    auto component = components.begin();
+    for (std::uint32_t n = 0; n < nodes.size(); ++n) {
+        if (n == component->node_first + component->node_count) ++component;
+        if (n == component->node_first) component->names_offset = names.size();
+        const auto& scale = *scales_list[position_of_node[n]];
+        auto& node = nodes[n];
+        store_side(scale.left, node.left_mass, node.left_child);
+        store_side(scale.right, node.right_mass, node.right_child);
+        node.extra_first = static_cast<std::uint32_t>(sides.size());
+        for (const auto& side : scale.extra_sides) {
+            auto& stored = sides.emplace_back();
+            store_side(side, stored.mass, stored.child);
+        }
+        node.name_offset = names.size();
+        node.name_length = static_cast<std::uint32_t>(scale.name.size());
+        names += scale.name;
+        index[n] = {name_fingerprint(scale.name), n};
+        if (component->root == topology_node::no_child && !held[position_of_node[n]]) component->root = n;
+        component->names_size = names.size() - component->names_offset;
+    }
+    for (auto& c : components) {
+        if (c.root == topology_node::no_child) c.root = c.node_first; // a cycle without a top
+    }
+    std::ranges::sort(index, [](const auto& a, const auto& b) {
+        return a.fingerprint != b.fingerprint ? a.fingerprint < b.fingerprint : a.node < b.node;
+    });
+
+    // Roughly one index entry per bucket keeps lookups to a single probe on average.
+    topology_header header;
+    header.bucket_bits = static_cast<std::uint16_t>(std::min<std::size_t>(24, std::bit_width(index.size())));
+    header.mass_decimals = static_cast<std::uint16_t>(format.decimals);
+    std::vector<std::uint32_t> buckets((std::size_t{1} << header.bucket_bits) + 1);
+    {
+        std::size_t entry = 0;
+        for (std::size_t b = 0; b + 1 < buckets.size(); ++b) {
+            buckets[b] = static_cast<std::uint32_t>(entry);
+            while (entry < index.size()
+                   && (header.bucket_bits == 0 || index[entry].fingerprint >> (64 - header.bucket_bits) == b)) {
+                ++entry;
+            }
+        }
+        buckets.back() = static_cast<std::uint32_t>(index.size());
+    }
+
+    auto align8 = [](std::uint64_t offset) { return (offset + 7) & ~std::uint64_t{7}; };
+    header.node_count = nodes.size();
+    header.nodes_offset = sizeof(topology_header);
+    header.buckets_offset = header.nodes_offset + nodes.size() * sizeof(topology_node);
+    header.index_offset = align8(header.buckets_offset + buckets.size() * sizeof(std::uint32_t));
+    header.names_offset = header.index_offset + index.size() * sizeof(name_index_entry);
+    header.names_size = names.size();
+    header.sides_offset = align8(header.names_offset + names.size());
+    header.sides_count = sides.size();
+    header.components_offset = header.sides_offset + sides.size() * sizeof(topology_side);
+    header.component_count = components.size();
+    header.order_offset = header.components_offset + components.size() * sizeof(topology_component);
+
+    auto write_bytes = [&](const void* data, std::size_t size) {
+        os.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+    auto pad_to = [&](std::uint64_t offset, std::uint64_t written) {
+        static constexpr std::array<char, 8> zeros{};
+        write_bytes(zeros.data(), offset - written);
+    };
+    write_bytes(&header, sizeof(header));
+    write_bytes(nodes.data(), nodes.size() * sizeof(topology_node));
+    write_bytes(buckets.data(), buckets.size() * sizeof(std::uint32_t));
+    pad_to(header.index_offset, header.buckets_offset + buckets.size() * sizeof(std::uint32_t));
+    write_bytes(index.data(), index.size() * sizeof(name_index_entry));
+    write_bytes(names.data(), names.size());
+    pad_to(header.sides_offset, header.names_offset + names.size());
+    write_bytes(sides.data(), sides.size() * sizeof(topology_side));
+    write_bytes(components.data(), components.size() * sizeof(topology_component));
+    write_bytes(node_of_position.data(), node_of_position.size() * sizeof(std::uint32_t));
+    return static_cast<bool>(os);
+}
+
+/**
+ * @brief Builds the scales of the nodes in [@p first, @p first + @p count) and links them.
+ *
+ * Sides referring to nodes outside the range are loaded as pans.
+ * @return The scales in node order.
+ */
+inline std::vector<scale_wrapper> load_node_range(const topology_view& topology, std::uint32_t first,
+                                                  std::uint32_t count) {
+    std::vector<scale_wrapper> scales_list;
+    scales_list.reserve(count);
+    for (std::uint32_t i = first; i < first + count; ++i) {
+        scales_list.push_back(std::make_shared<Scale>(std::string{topology.name(i)}, topology.format().unit()));
+    }
+
+    auto load_side = [&](pan_or_scale& side, std::int64_t mass, std::uint32_t child) {
+        if (child - first < count) {
+            side.emplace<std::weak_ptr<Scale>>(scales_list[child - first]);
+        } else {
+            side.emplace<Pan>(static_cast<int>(mass));
+        }
+    };
+    for (std::uint32_t i = 0; i < count; ++i) {
+        const auto& node = topology.node(first + i);
+        load_side(scales_list[i]->left, node.left_mass, node.left_child);
+        load_side(scales_list[i]->right, node.right_mass, node.right_child);
+        const auto extra = topology.extra_sides(first + i);
+        scales_list[i]->extra_sides.resize(extra.size());
+        for (std::size_t s = 0; s < extra.size(); ++s) {
+            load_side(scales_list[i]->extra_sides[s], extra[s].mass, extra[s].child);
+        }
+    }
+    return scales_list;
+}
+
+/**
+ * @brief Rebuilds the scale graph stored in a topology file.
+ * @param topology A valid topology view.
+ * @param scales_list Output vector receiving the scales in their original output order.
+ */
+inline void load_topology(const topology_view& topology, std::vector<scale_wrapper>& scales_list) {
+    auto by_node = load_node_range(topology, 0, static_cast<std::uint32_t>(topology.size()));
+    scales_list.clear();
+    scales_list.reserve(by_node.size());
+    for (std::size_t position = 0; position < by_node.size(); ++position) {
+        const auto node = topology.node_at(position);
+        if (node < by_node.size() && by_node[node]) scales_list.push_back(std::move(by_node[node]));
+    }
+}
+
+/**
+ * @brief Rebuilds only some connected components of a topology file.
+ *
+ * Reads nothing but the records and names of those components.
+ * @param topology A valid topology view.
+ * @param components Component indices; repeated ones are loaded once.
+ * @param scales_list Output vector receiving the scales component by component, in
+ *        output order within each.
+ */
+inline void load_components(const topology_view& topology, std::span<const std::uint32_t> components,
+                            std::vector<scale_wrapper>& scales_list) {
+    std::vector<std::uint32_t> sorted(components.begin(), components.end());
+    std::ranges::sort(sorted);
+    const auto repeated = std::ranges::unique(sorted);
+    sorted.erase(repeated.begin(), repeated.end());
+
+    scales_list.clear();
+    for (const auto c : sorted) {
+        if (c >= topology.component_count()) continue;
+        const auto& component = topology.component(c);
+        if (component.node_first > topology.size() || component.node_count > topology.size() - component.node_first) {
+            continue;
+        }
+        auto tree = load_node_range(topology, component.node_first, component.node_count);
+        std::ranges::move(tree, std::back_inserter(scales_list));
+    }
+}
+
+/**
+ * @brief Read-only memory mapping of a whole file.
+ */
+class mapped_file {
+public:
+    mapped_file() = default;
+
+    /**
+     * @brief Maps @p path read-only; check valid() for success.
+     * @param path The file to map.
+     */
+    explicit mapped_file(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                data_ = static_cast<const std::byte*>(data);
+                size_ = static_cast<std::size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) noexcept
+        : data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)} {}
+    mapped_file& operator=(mapped_file&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+    ~mapped_file() { unmap(); }
+
+    /// @brief True if the file was mapped.
+    [[nodiscard]] bool valid() const { return data_ != nullptr; }
+
+    /// @brief The mapped bytes.
+    [[nodiscard]] std::span<const std::byte> bytes() const { return {data_, size_}; }
+
+private:
+    void unmap() {
+        if (data_) ::munmap(const_cast<std::byte*>(data_), size_);
+    }
+
+    const std::byte* data_{};
+    std::size_t size_{};
+};
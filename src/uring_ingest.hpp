@@ -0,0 +1,478 @@
+/**
+ * @file uring_ingest.hpp
+ * @brief Batched ingestion of many small input files through io_uring.
+ *
+ * With tens of thousands of small files, opening, reading and closing each one costs more
+ * than parsing it. The loader keeps up to a queue depth of files in flight in one io_uring
+ * instance: opens, reads and closes are queued in the submission ring and submitted
+ * together, so a single io_uring_enter() call covers many files. Reads land in a pool of
+ * registered buffers, and a file that fits in one buffer is parsed straight from it by a
+ * parser worker, which then hands the buffer back; larger files are gathered into a string
+ * first.
+ *
+ * The ring is driven through the raw system calls, so no liburing is needed. Where
+ * io_uring is unavailable (old kernels, seccomp filters, non-Linux builds), the loader
+ * falls back to parse_scale_files() with plain reads. Results are identical either way.
+ */
+
+#pragma once
+
+#include "parallel_ingest.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <optional>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define SCALEBLANCER_HAS_IO_URING 1
+#endif
+
+/**
+ * @brief Input stream reading from a block of memory it does not own.
+ */
+class memory_streambuf : public std::streambuf {
+public:
+    /**
+     * @brief Reads the @p size bytes at @p data.
+     */
+    memory_streambuf(const char* data, std::size_t size) {
+        auto* begin = const_cast<char*>(data); // the get area is never written to
+        setg(begin, begin, begin + size);
+    }
+};
+
+#ifdef SCALEBLANCER_HAS_IO_URING
+
+/**
+ * @brief Minimal io_uring instance: the mapped rings and a submission/completion interface.
+ *
+ * Only one thread may use an instance.
+ */
+class uring_queue {
+public:
+    /**
+     * @brief Sets up a ring with at least @p entries submission entries.
+     *
+     * valid() is false if the kernel refused the ring or lacks an operation the loader needs.
+     */
+    explicit uring_queue(unsigned entries) {
+        io_uring_params params{};
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) return;
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(std::uint32_t);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        sq_ring_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = params.features & IORING_FEAT_SINGLE_MMAP ? sq_ring_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+        if (!sq_ring_ || !cq_ring_ || !sqes_) return;
+
+        auto* sq = static_cast<char*>(sq_ring_);
+        auto* cq = static_cast<char*>(cq_ring_);
+        sq_tail_ = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<std::uint32_t*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<std::uint32_t*>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<std::uint32_t*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<std::uint32_t*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<std::uint32_t*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        entries_ = params.sq_entries;
+        valid_ = supports({IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_CLOSE});
+    }
+
+    uring_queue(const uring_queue&) = delete;
+    uring_queue& operator=(const uring_queue&) = delete;
+
+    ~uring_queue() {
+        if (sqes_) ::munmap(sqes_, sqes_size_);
+        if (cq_ring_ && cq_ring_ != sq_ring_) ::munmap(cq_ring_, cq_size_);
+        if (sq_ring_) ::munmap(sq_ring_, sq_size_);
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    /// @brief True if the ring is usable.
+    [[nodiscard]] bool valid() const { return valid_; }
+
+    /// @brief Number of submission entries.
+    [[nodiscard]] unsigned entries() const { return entries_; }
+
+    /**
+     * @brief Registers @p buffers for fixed reads.
+     * @return False if the kernel refused, e.g. over the locked-memory limit.
+     */
+    bool register_buffers(std::span<const iovec> buffers) {
+        return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                         static_cast<unsigned>(buffers.size())) == 0;
+    }
+
+    /**
+     * @brief Queues an entry; it is submitted by the next submit_and_wait().
+     *
+     * At most entries() entries may be queued between two submissions.
+     */
+    io_uring_sqe& queue(std::uint8_t opcode, std::uint64_t user_data) {
+        const auto tail = *sq_tail_ + pending_;
+        const auto index = tail & sq_mask_;
+        auto& sqe = sqes_[index];
+        sqe = io_uring_sqe{};
+        sqe.opcode = opcode;
+        sqe.user_data = user_data;
+        sq_array_[index] = index;
+        ++pending_;
+        return sqe;
+    }
+
+    /**
+     * @brief Submits the queued entries and waits for at least one completion.
+     * @return False if the kernel rejected the submission.
+     */
+    bool submit_and_wait() {
+        std::atomic_ref{*sq_tail_}.store(*sq_tail_ + pending_, std::memory_order_release);
+        const auto submitted = pending_;
+        pending_ = 0;
+        for (;;) {
+            const auto result = ::syscall(__NR_io_uring_enter, fd_, submitted, 1u, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result >= 0) return true;
+            if (errno != EINTR) return false;
+        }
+    }
+
+    /**
+     * @brief Calls @p on_completion with the user data and result of every available completion.
+     */
+    template <typename OnCompletion>
+    void reap(OnCompletion&& on_completion) {
+        auto head = *cq_head_;
+        const auto tail = std::atomic_ref{*cq_tail_}.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            const auto& cqe = cqes_[head & cq_mask_];
+            on_completion(cqe.user_data, cqe.res);
+        }
+        std::atomic_ref{*cq_head_}.store(head, std::memory_order_release);
+    }
+
+private:
+    void* map(std::size_t size, off_t offset) const {
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    bool supports(std::initializer_list<std::uint8_t> opcodes) const {
+        constexpr unsigned probe_ops{256};
+        std::vector<std::byte> storage(sizeof(io_uring_probe) + probe_ops * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, probe_ops) != 0) return false;
+        return std::ranges::all_of(opcodes, [&](std::uint8_t op) {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        });
+    }
+
+    int fd_{-1};
+    bool valid_{false};
+    unsigned entries_{};
+    unsigned pending_{}; ///< Entries queued since the last submission.
+    void* sq_ring_{};
+    void* cq_ring_{};
+    io_uring_sqe* sqes_{};
+    std::size_t sq_size_{}, cq_size_{}, sqes_size_{};
+    std::uint32_t* sq_tail_{};
+    std::uint32_t sq_mask_{};
+    std::uint32_t* sq_array_{};
+    std::uint32_t* cq_head_{};
+    std::uint32_t* cq_tail_{};
+    std::uint32_t cq_mask_{};
+    io_uring_cqe* cqes_{};
+};
+
+#endif
+
+/**
+ * @brief Tuning of the batched loader.
+ */
+struct uring_options {
+    unsigned queue_depth{64};         ///< Files in flight at once.
+    std::size_t buffer_size{1 << 16}; ///< Size of each registered read buffer.
+};
+
+/**
+ * @brief Reads files through io_uring and feeds their contents to parser workers.
+ */
+class uring_file_loader {
+public:
+    /**
+     * @brief Prepares a ring and its buffers; see available().
+     */
+    explicit uring_file_loader(const uring_options& options = {})
+#ifdef SCALEBLANCER_HAS_IO_URING
+        : ring_{std::max(options.queue_depth, 1u)}
+#endif
+    {
+#ifdef SCALEBLANCER_HAS_IO_URING
+        if (!ring_.valid()) return;
+        buffer_size_ = std::max<std::size_t>(options.buffer_size, 4096);
+        const auto buffers = ring_.entries();
+        storage_.resize(buffers * buffer_size_);
+        std::vector<iovec> vectors;
+        for (unsigned b = 0; b < buffers; ++b) {
+            vectors.push_back({storage_.data() + b * buffer_size_, buffer_size_});
+            free_buffers_.push_back(b);
+        }
+        fixed_ = ring_.register_buffers(vectors); // plain reads into the same buffers otherwise
+        available_ = true;
+#else
+        (void)options;
+#endif
+    }
+
+    /// @brief True if io_uring can be used; otherwise load() must not be called.
+    [[nodiscard]] bool available() const { return available_; }
+
+    /// @brief True if the read buffers are registered with the kernel.
+    [[nodiscard]] bool fixed_buffers() const { return fixed_; }
+
+    /**
+     * @brief Reads every file in @p paths and calls @p parse with each complete content.
+     * @param paths The files.
+     * @param parse Called from @p parsers worker threads with the file index and its content.
+     * @param parsers Number of parser threads.
+     * @return False if a file could not be opened or read; the other files are still parsed.
+     */
+    bool load(std::span<const std::string> paths,
+              const std::function<void(std::size_t, std::string_view)>& parse, unsigned parsers) {
+        bool ok = true;
+#ifdef SCALEBLANCER_HAS_IO_URING
+        std::vector<std::jthread> pool;
+        for (unsigned t = 0; t < std::max(parsers, 1u); ++t) pool.emplace_back([&] { parse_jobs(parse); });
+        ok = drive(paths);
+        {
+            std::scoped_lock guard{lock_};
+            done_ = true;
+        }
+        jobs_ready_.notify_all();
+#else
+        (void)paths, (void)parse, (void)parsers;
+#endif
+        return ok;
+    }
+
+private:
+#ifdef SCALEBLANCER_HAS_IO_URING
+    enum stage : std::uint8_t { opening, reading, closing };
+
+    /// A file in flight: one ring operation at a time.
+    struct slot {
+        std::size_t file{};
+        int fd{-1};
+        unsigned buffer{};
+        std::size_t used{};     ///< Bytes in the buffer.
+        std::uint64_t offset{}; ///< File offset of the buffer's first byte.
+        std::string spill;      ///< Earlier contents of a file larger than the buffer.
+    };
+
+    /// A complete file waiting for a parser; small files stay in their buffer.
+    struct job {
+        std::size_t file{};
+        std::optional<unsigned> buffer;
+        std::size_t size{};
+        std::string content;
+    };
+
+    static std::uint64_t tag(std::size_t slot_index, stage s) { return slot_index << 2 | s; }
+
+    char* buffer_data(unsigned buffer) { return storage_.data() + std::size_t{buffer} * buffer_size_; }
+
+    void queue_read(std::size_t index, slot& s) {
+        auto& sqe = ring_.queue(fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ, tag(index, reading));
+        sqe.fd = s.fd;
+        sqe.addr = reinterpret_cast<std::uintptr_t>(buffer_data(s.buffer) + s.used);
+        sqe.len = static_cast<std::uint32_t>(buffer_size_ - s.used);
+        sqe.off = s.offset + s.used;
+        sqe.buf_index = static_cast<std::uint16_t>(s.buffer);
+    }
+
+    void queue_close(std::size_t index, slot& s) {
+        ring_.queue(IORING_OP_CLOSE, tag(index, closing)).fd = s.fd;
+    }
+
+    /// Hands a finished file to the parsers and keeps its buffer busy until it is parsed.
+    void finish_file(slot& s) {
+        job j{s.file, s.buffer, s.used, {}};
+        if (!s.spill.empty()) {
+            s.spill.append(buffer_data(s.buffer), s.used);
+            j = job{s.file, std::nullopt, s.spill.size(), std::move(s.spill)};
+            release_buffer(s.buffer);
+        }
+        {
+            std::scoped_lock guard{lock_};
+            jobs_.push_back(std::move(j));
+        }
+        jobs_ready_.notify_one();
+    }
+
+    void release_buffer(unsigned buffer) {
+        {
+            std::scoped_lock guard{lock_};
+            free_buffers_.push_back(buffer);
+        }
+        buffer_freed_.notify_one();
+    }
+
+    /// Runs the ring until every file was read and closed.
+    bool drive(std::span<const std::string> paths) {
+        std::vector<slot> slots(ring_.entries());
+        std::vector<std::size_t> free_slots;
+        for (std::size_t i = slots.size(); i-- > 0;) free_slots.push_back(i);
+        std::size_t next_file = 0;
+        std::size_t in_flight = 0;
+        bool ok = true;
+
+        while (next_file < paths.size() || in_flight > 0) {
+            // Start as many files as there are free slots and buffers.
+            while (next_file < paths.size() && !free_slots.empty()) {
+                std::unique_lock guard{lock_};
+                if (free_buffers_.empty()) {
+                    if (in_flight > 0) break;
+                    buffer_freed_.wait(guard, [&] { return !free_buffers_.empty(); });
+                }
+                const auto buffer = free_buffers_.back();
+                free_buffers_.pop_back();
+                guard.unlock();
+
+                const auto index = free_slots.back();
+                free_slots.pop_back();
+                slots[index] = slot{next_file, -1, buffer, 0, 0, {}};
+                auto& sqe = ring_.queue(IORING_OP_OPENAT, tag(index, opening));
+                sqe.fd = AT_FDCWD;
+                sqe.addr = reinterpret_cast<std::uintptr_t>(paths[next_file].c_str());
+                sqe.open_flags = O_RDONLY | O_CLOEXEC;
+                ++next_file;
+                ++in_flight;
+            }
+            if (!ring_.submit_and_wait()) {
+                std::cerr << "io_uring submission failed: " << std::strerror(errno) << '\n';
+                return false;
+            }
+
+            ring_.reap([&](std::uint64_t user_data, std::int32_t result) {
+                const auto index = static_cast<std::size_t>(user_data >> 2);
+                auto& s = slots[index];
+                switch (static_cast<stage>(user_data & 3)) {
+                    case opening:
+                        if (result < 0) {
+                            std::cerr << "Cannot open input: " << std::quoted(paths[s.file]) << '\n';
+                            release_buffer(s.buffer);
+                            free_slots.push_back(index);
+                            --in_flight;
+                            ok = false;
+                            return;
+                        }
+                        s.fd = result;
+                        queue_read(index, s);
+                        return;
+                    case reading:
+                        if (result < 0) {
+                            std::cerr << "Cannot read input: " << std::quoted(paths[s.file]) << '\n';
+                            release_buffer(s.buffer);
+                            ok = false;
+                        } else if (result > 0) {
+                            s.used += static_cast<std::size_t>(result);
+                            if (s.used == buffer_size_) {
+                                s.spill.append(buffer_data(s.buffer), s.used);
+                                s.offset += s.used;
+                                s.used = 0;
+                            }
+                            queue_read(index, s); // until a read returns end of file
+                            return;
+                        } else {
+                            finish_file(s);
+                        }
+                        queue_close(index, s);
+                        return;
+                    case closing:
+                        free_slots.push_back(index);
+                        --in_flight;
+                        return;
+                }
+            });
+        }
+        return ok;
+    }
+
+    template <typename Parse>
+    void parse_jobs(const Parse& parse) {
+        for (;;) {
+            job j;
+            {
+                std::unique_lock guard{lock_};
+                jobs_ready_.wait(guard, [&] { return done_ || !jobs_.empty(); });
+                if (jobs_.empty()) return;
+                j = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            if (j.buffer) {
+                parse(j.file, {buffer_data(*j.buffer), j.size});
+                release_buffer(*j.buffer);
+            } else {
+                parse(j.file, j.content);
+            }
+        }
+    }
+
+    uring_queue ring_;
+    std::size_t buffer_size_{};
+    std::vector<char> storage_; ///< All read buffers, back to back.
+
+    std::mutex lock_; ///< Guards the members below.
+    std::vector<unsigned> free_buffers_;
+    std::deque<job> jobs_;
+    bool done_{false};
+    std::condition_variable jobs_ready_;
+    std::condition_variable buffer_freed_;
+#endif
+    bool available_{false};
+    bool fixed_{false};
+};
+
+/**
+ * @brief Parses many files into one list of interconnected scales, batching their I/O.
+ *
+ * Same result as parse_scale_files(); uses io_uring when the kernel offers it and plain
+ * reads otherwise.
+ * @param paths The files, in global order.
+ * @param scales_list Output vector to hold the constructed scales.
+ * @param max_threads Maximum number of parser threads.
+ * @param format Notation of the masses in every file.
+ * @param metrics Counts the bytes and lines read, if given.
+ * @return False if a file could not be opened or read; nothing is parsed in that case.
+ */
+inline bool parse_scale_files_batched(std::span<const std::string> paths, std::vector<scale_wrapper>& scales_list,
+                                      unsigned max_threads, const mass_format& format = {},
+                                      run_metrics* metrics = nullptr) {
+    uring_file_loader loader;
+    if (!loader.available()) return parse_scale_files(paths, scales_list, max_threads, format, metrics);
+
+    scale_ingest ingest{format};
+    const bool ok = loader.load(paths, [&](std::size_t file, std::string_view content) {
+        memory_streambuf memory{content.data(), content.size()};
+        std::optional<counting_streambuf> counted;
+        if (metrics) counted.emplace(memory, *metrics);
+        std::istream in{counted ? static_cast<std::streambuf*>(&*counted) : &memory};
+        ingest.parse(in, file, paths[file]);
+    }, std::max(max_threads, 1u));
+    if (!ok) {
+        scales_list.clear();
+        return false;
+    }
+    ingest.finish(scales_list);
+    return true;
+}
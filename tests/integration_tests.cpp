@@ -17,6 +17,7 @@
 #undef main 
 
 #include <catch2/catch_test_macros.hpp>
+#include <filesystem>
 #include <sstream>
 
 TEST_CASE("Integration: simple input produces correct output", "[integration]") {
@@ -72,3 +73,184 @@ TEST_CASE("Integration: nested scale balancing", "[integration]") {
 
     REQUIRE(out.str() == expected);
 }
+
+TEST_CASE("Integration: scales defined bottom-up balance correctly", "[integration]") {
+    std::istringstream in("B,1,3\nA,2,B\n");
+    std::ostringstream out;
+
+    std::vector<scale_wrapper> scales;
+    parse_scales(in, scales);
+    const auto shape = profile_shape(scales);
+    balance_with(scales, shape, choose_engine(shape, cost_model{}, 4));
+    report_changes(out, scales);
+
+    REQUIRE(out.str() == "B,2,0\nA,5,0\n");
+}
+
+TEST_CASE("Integration: streamed report matches the batch report", "[integration][stream]") {
+    auto batch = make_binary_tree(3000);
+    const auto shape = profile_shape(batch);
+    balance_each_scale(batch);
+    std::ostringstream expected;
+    report_changes(expected, batch);
+
+    for (const engine_choice choice : {engine_choice{balance_engine::sequential, 1},
+                                       engine_choice{balance_engine::level_parallel, 4}}) {
+        auto streamed = make_binary_tree(3000);
+        std::ostringstream out;
+        balance_and_stream(out, streamed, shape, choice);
+        REQUIRE(out.str() == expected.str());
+    }
+}
+
+TEST_CASE("Integration: fused report matches the batch report", "[integration][fused]") {
+    const std::string input = "Rig,Beam,2,Hook,1\nBeam,1,1,1\nHook,4,Beam2,0\nBeam2,1.25,2,3\nLoose,0.5,7\n";
+    for (const mass_format format : {mass_format{}, mass_format{2}}) {
+        std::vector<scale_wrapper> scales;
+        std::istringstream in{input};
+        parse_scales(in, scales, format);
+        for (auto& scale : make_binary_tree(5000)) scales.push_back(std::move(scale));
+        const auto shape = profile_shape(scales);
+        balance_with(scales, shape, {});
+        std::ostringstream expected;
+        report_changes(expected, scales, format);
+
+        for (const engine_choice choice : {engine_choice{balance_engine::sequential, 1},
+                                           engine_choice{balance_engine::level_parallel, 4}}) {
+            std::ostringstream out;
+            balance_and_format(out, scales, shape, choice, format);
+            REQUIRE(out.str() == expected.str());
+        }
+    }
+}
+
+TEST_CASE("Integration: --pipeline matches the scale graph on files", "[integration][pipeline]") {
+    const auto dir = std::filesystem::temp_directory_path() / "scaleblancer_pipeline_test";
+    std::filesystem::create_directories(dir);
+    const std::vector<std::string> paths{(dir / "a.csv").string(), (dir / "b.csv").string()};
+    std::ofstream{paths[0]} << "Rig,Beam,2,Hook\nBeam,1,1,1\n";
+    std::ofstream{paths[1]} << "Hook,4,Beam2\nBeam2,1.25,2,3\nRig,,,,1\n";
+
+    std::vector<scale_wrapper> scales;
+    REQUIRE(parse_scale_files(paths, scales, 2, mass_format{2}));
+    balance_with(scales, profile_shape(scales), {});
+    std::ostringstream expected;
+    report_changes(expected, scales, mass_format{2});
+
+    for (const char* name : {"minimal", "checked"}) {
+        std::vector<std::string> args{"--pipeline", name, "--decimals", "2", paths[0], paths[1]};
+        std::vector<char*> argv;
+        for (auto& arg : args) argv.push_back(arg.data());
+        const auto opts = parse_options(argv);
+        REQUIRE(opts);
+
+        std::ostringstream out;
+        auto* const saved = std::cout.rdbuf(out.rdbuf());
+        const int status = opts->pipeline == "minimal"
+            ? [&] { minimal_pipeline pipeline{opts->format}; return run_pipeline(pipeline, opts->inputs); }()
+            : [&] { checked_pipeline pipeline{opts->format, {}, {2}}; return run_pipeline(pipeline, opts->inputs); }();
+        std::cout.rdbuf(saved);
+        REQUIRE(status == 0);
+        REQUIRE(out.str() == expected.str());
+    }
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Integration: concurrent multi-file parsing matches the concatenated input", "[integration][ingest]") {
+    const std::vector<std::string> parts = {
+        "Root,SectionA,SectionB\n# section A\nA2,1,2\n",
+        "SectionA,A1,A2\nA1,4,Root2\n",
+        "SectionB,7,B1\nB1,B2,3\nBad,,Bad\nRoot2,1,1\n",
+        "B2,5,5\nA2,3,2\n", // redefines A2 after its first definition
+    };
+
+    std::string concatenated;
+    for (const auto& part : parts) concatenated += part;
+    std::istringstream whole(concatenated);
+    std::vector<scale_wrapper> expected_scales;
+    parse_scales(whole, expected_scales);
+    balance_each_scale(expected_scales);
+    std::ostringstream expected;
+    report_changes(expected, expected_scales);
+
+    for (const unsigned threads : {1u, 4u}) {
+        std::vector<std::istringstream> streams(parts.begin(), parts.end());
+        std::vector<std::istream*> inputs;
+        for (auto& stream : streams) inputs.push_back(&stream);
+
+        std::vector<scale_wrapper> scales;
+        parse_scale_streams(inputs, {}, scales, threads);
+        balance_each_scale(scales);
+        std::ostringstream out;
+        report_changes(out, scales);
+        REQUIRE(out.str() == expected.str());
+    }
+}
+
+TEST_CASE("Integration: concurrent parsing keeps wide scales identical", "[integration][ingest][k_ary]") {
+    const std::vector<std::string> parts = {
+        "Rig,Beam,2,Hook,1\nBeam,1,1,1\n",
+        "Hook,4,Beam2,0\nBeam,3,,5,2\n", // widens Beam after its first definition
+        "Beam2,1,2,3,4,5,6,7,8,9\nBeam2,99999999999,1\n", // too large a mass: an invalid line
+    };
+
+    std::string concatenated;
+    for (const auto& part : parts) concatenated += part;
+    std::istringstream whole(concatenated);
+    std::vector<scale_wrapper> expected_scales;
+    parse_scales(whole, expected_scales);
+    balance_each_scale(expected_scales);
+    std::ostringstream expected;
+    report_changes(expected, expected_scales);
+
+    std::vector<std::istringstream> streams(parts.begin(), parts.end());
+    std::vector<std::istream*> inputs;
+    for (auto& stream : streams) inputs.push_back(&stream);
+    std::vector<scale_wrapper> scales;
+    parse_scale_streams(inputs, {}, scales, 3);
+    balance_each_scale(scales);
+    std::ostringstream out;
+    report_changes(out, scales);
+    REQUIRE(out.str() == expected.str());
+}
+
+TEST_CASE("Integration: batched file loading matches plain file parsing", "[integration][ingest][io_uring]") {
+    const auto dir = std::filesystem::temp_directory_path() / ("scaleblancer_uring_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> paths;
+    auto write_file = [&](const std::string& content) {
+        paths.push_back((dir / ("part" + std::to_string(paths.size()) + ".csv")).string());
+        std::ofstream{paths.back()} << content;
+    };
+    write_file("Root,SectionA,SectionB\n");
+    write_file("SectionA,1,Chain0\n");
+    write_file("SectionB,7,2\n# only a comment\n");
+    write_file("");
+    std::string chain; // several read buffers long
+    for (int i = 0; i < 20000; ++i) chain += "Chain" + std::to_string(i) + ",Chain" + std::to_string(i + 1) + ",1\n";
+    write_file(chain + "Chain20000,1,1\n");
+
+    auto report = [](std::vector<scale_wrapper>& scales) {
+        balance_each_scale(scales);
+        std::ostringstream out;
+        report_changes(out, scales);
+        return out.str();
+    };
+    std::vector<scale_wrapper> expected_scales;
+    REQUIRE(parse_scale_files(paths, expected_scales, 2));
+    std::vector<scale_wrapper> scales;
+    REQUIRE(parse_scale_files_batched(paths, scales, 2));
+    REQUIRE(report(scales) == report(expected_scales));
+
+    uring_file_loader loader{{4, 4096}};
+    if (loader.available()) {
+        std::vector<std::size_t> sizes(paths.size());
+        REQUIRE(loader.load(paths, [&](std::size_t file, std::string_view content) { sizes[file] = content.size(); }, 2));
+        for (std::size_t i = 0; i < paths.size(); ++i) REQUIRE(sizes[i] == std::filesystem::file_size(paths[i]));
+    }
+
+    paths.insert(paths.begin() + 1, (dir / "missing.csv").string());
+    REQUIRE_FALSE(parse_scale_files_batched(paths, scales, 2));
+    REQUIRE(scales.empty());
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,357 @@
+/**
+ * @file perf_tests.cpp
+ * @brief Throughput regression tests for the phases of the ScaleBalancer pipeline.
+ *
+ * Each test case runs a generated, fixed-seed workload through one phase, keeps the best
+ * throughput of a few repetitions and compares it with the value stored for this machine
+ * in a baseline file. A phase that got slower than the baseline by more than the tolerance
+ * fails, and so does a phase without a stored value: baselines are only written in record
+ * mode. The suite is not part of a plain ctest run; see tests/CMakeLists.txt.
+ *
+ * The workloads include the inputs that used to hit slow paths: scales defined bottom-up,
+ * deep chains and update walks up to the root of the incremental graph. Every workload
+ * that is balanced is at most synthetic_depth_limit levels deep, so its masses fit in int.
+ *
+ * Environment:
+ *     SCALEBLANCER_PERF_BASELINE   baseline file (default: perf_baselines/<hostname>.txt in the build tree)
+ *     SCALEBLANCER_PERF_UPDATE     set to 1 to record the measured values as the baseline
+ *     SCALEBLANCER_PERF_TOLERANCE  allowed slowdown as a fraction of the baseline (default 0.3)
+ */
+
+#define main __main__
+#include "scaleblancer.cpp"
+#undef main
+
+#include "scaling_bench.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+
+#include <unistd.h>
+
+#ifndef PERF_BASELINE_DIR
+#define PERF_BASELINE_DIR "perf_baselines"
+#endif
+
+namespace {
+
+/**
+ * @brief Path of the baseline file for this machine.
+ */
+std::string baseline_path() {
+    if (const char* path = std::getenv("SCALEBLANCER_PERF_BASELINE")) return path;
+    std::array<char, 256> host{};
+    if (::gethostname(host.data(), host.size() - 1) != 0) return PERF_BASELINE_DIR "/default.txt";
+    return std::string{PERF_BASELINE_DIR} + '/' + host.data() + ".txt";
+}
+
+std::map<std::string, double> load_baseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in{path};
+    std::string phase;
+    double value{};
+    while (in >> phase >> value) baseline[phase] = value;
+    return baseline;
+}
+
+void save_baseline(const std::string& path, const std::map<std::string, double>& baseline) {
+    std::filesystem::create_directories(std::filesystem::path{path}.parent_path());
+    std::ofstream out{path};
+    for (const auto& [phase, value] : baseline) out << phase << ' ' << value << '\n';
+}
+
+/**
+ * @brief Compares a measured throughput with the baseline, or records it in record mode.
+ * @param phase Key of the phase in the baseline file.
+ * @param items_per_second The best measured throughput.
+ */
+void check_throughput(const std::string& phase, double items_per_second) {
+    // Each test case may run in its own process, so the file is re-read for every phase.
+    const auto path = baseline_path();
+    auto baseline = load_baseline(path);
+    const char* update = std::getenv("SCALEBLANCER_PERF_UPDATE");
+    if (update && std::string_view{update} == "1") {
+        baseline[phase] = items_per_second;
+        save_baseline(path, baseline);
+        WARN("Recorded baseline for " << phase << ": " << items_per_second << " items/s in " << path);
+        return;
+    }
+    const auto it = baseline.find(phase);
+    if (it == baseline.end()) {
+        FAIL("No baseline for " << phase << " in " << path << " (measured " << items_per_second
+             << " items/s). Run with SCALEBLANCER_PERF_UPDATE=1 to record one.");
+    }
+
+    const char* tolerance_env = std::getenv("SCALEBLANCER_PERF_TOLERANCE");
+    const double tolerance = tolerance_env ? std::atof(tolerance_env) : 0.3;
+    const double floor = it->second * (1 - tolerance);
+    if (items_per_second < floor) {
+        FAIL("PERFORMANCE REGRESSION in " << phase << ": " << items_per_second << " items/s, baseline "
+             << it->second << " items/s (" << 100 * (1 - items_per_second / it->second) << "% slower, "
+             << 100 * tolerance << "% allowed). Run with SCALEBLANCER_PERF_UPDATE=1 if this is expected.");
+    }
+    SUCCEED(phase << ": " << items_per_second << " items/s, baseline " << it->second);
+}
+
+/**
+ * @brief Best throughput of @p run over a few repetitions, in @p items per second.
+ * @param prepare Called before every repetition, outside the measurement.
+ */
+template <typename Prepare, typename Run>
+double best_throughput(std::size_t items, Prepare&& prepare, Run&& run) {
+    constexpr int repetitions = 5;
+    double best = 0;
+    for (int r = 0; r < repetitions; ++r) {
+        prepare();
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, static_cast<double>(items) / std::max(elapsed.count(), 1e-9));
+    }
+    return best;
+}
+
+template <typename Run>
+double best_throughput(std::size_t items, Run&& run) {
+    return best_throughput(items, [] {}, std::forward<Run>(run));
+}
+
+/**
+ * @brief A random binary tree of @p n scales as input lines, top-down, with a fixed seed.
+ *
+ * No scale hangs deeper than synthetic_depth_limit levels; a scale arriving when every
+ * free side is that deep starts a new tree.
+ */
+std::vector<std::string> random_tree_lines(std::size_t n, std::uint64_t seed) {
+    std::mt19937_64 rng{seed};
+    std::vector<std::array<std::string, 2>> sides(n);
+    std::vector<std::size_t> depth(n, 0);
+    std::vector<std::pair<std::size_t, std::size_t>> free_sides{{0, 0}, {0, 1}};
+    for (std::size_t i = 1; i < n; ++i) {
+        if (!free_sides.empty()) {
+            const auto pick = std::uniform_int_distribution<std::size_t>{0, free_sides.size() - 1}(rng);
+            const auto [parent, side] = free_sides[pick];
+            free_sides[pick] = free_sides.back();
+            free_sides.pop_back();
+            sides[parent][side] = "S" + std::to_string(i);
+            depth[i] = depth[parent] + 1;
+        }
+        if (depth[i] + 1 >= synthetic_depth_limit) continue;
+        free_sides.emplace_back(i, 0);
+        free_sides.emplace_back(i, 1);
+    }
+    std::vector<std::string> lines;
+    lines.reserve(n);
+    std::uniform_int_distribution<int> mass{0, 99};
+    for (std::size_t i = 0; i < n; ++i) {
+        auto side = [&](std::size_t s) { return sides[i][s].empty() ? std::to_string(mass(rng)) : sides[i][s]; };
+        lines.push_back("S" + std::to_string(i) + ',' + side(0) + ',' + side(1) + '\n');
+    }
+    return lines;
+}
+
+std::string join(const std::vector<std::string>& lines) {
+    std::string text;
+    for (const auto& line : lines) text += line;
+    return text;
+}
+
+constexpr std::size_t workload_size = 1 << 17;
+constexpr std::uint64_t seed = 20240611;
+
+} // namespace
+
+TEST_CASE("Perf: parsing a random tree", "[perf][parse]") {
+    const auto text = join(random_tree_lines(workload_size, seed));
+    std::vector<scale_wrapper> scales;
+    check_throughput("parse_lines", best_throughput(workload_size, [&] {
+        std::istringstream in{text};
+        parse_scales(in, scales);
+    }));
+    REQUIRE(scales.size() == workload_size);
+}
+
+TEST_CASE("Perf: concurrent ingestion of split inputs", "[perf][parse]") {
+    const auto lines = random_tree_lines(workload_size, seed);
+    constexpr std::size_t parts = 8;
+    std::vector<std::string> texts(parts);
+    for (std::size_t i = 0; i < lines.size(); ++i) texts[i * parts / lines.size()] += lines[i];
+
+    std::vector<scale_wrapper> scales;
+    check_throughput("ingest_lines", best_throughput(workload_size, [&] {
+        std::vector<std::istringstream> streams(texts.begin(), texts.end());
+        std::vector<std::istream*> inputs;
+        for (auto& stream : streams) inputs.push_back(&stream);
+        parse_scale_streams(inputs, {}, scales, std::max(1u, std::thread::hardware_concurrency()));
+    }));
+    REQUIRE(scales.size() == workload_size);
+}
+
+TEST_CASE("Perf: balancing scales defined bottom-up", "[perf][balance]") {
+    auto lines = random_tree_lines(workload_size, seed);
+    std::ranges::reverse(lines);
+    std::istringstream in{join(lines)};
+    std::vector<scale_wrapper> scales;
+    parse_scales(in, scales);
+
+    check_throughput("balance_bottom_up_scales", best_throughput(workload_size, [&] {
+        balance_with(scales, profile_shape(scales), {});
+    }));
+}
+
+TEST_CASE("Perf: balancing a binary tree with each engine", "[perf][balance]") {
+    auto scales = make_binary_tree(workload_size);
+    const auto shape = profile_shape(scales);
+    const auto threads = std::max(2u, std::thread::hardware_concurrency());
+
+    check_throughput("balance_sequential_scales", best_throughput(workload_size, [&] {
+        balance_with(scales, shape, {balance_engine::sequential, 1});
+    }));
+    check_throughput("balance_level_scales", best_throughput(workload_size, [&] {
+        balance_with(scales, shape, {balance_engine::level_parallel, threads});
+    }));
+}
+
+TEST_CASE("Perf: reporting balanced scales", "[perf][report]") {
+    auto scales = make_binary_tree(workload_size);
+    balance_with(scales, profile_shape(scales), {});
+    std::ostringstream out;
+    check_throughput("report_rows", best_throughput(workload_size, [&] { out.str({}); }, [&] {
+        report_changes(out, scales);
+    }));
+}
+
+TEST_CASE("Perf: fused balancing and reporting", "[perf][report]") {
+    auto scales = make_binary_tree(workload_size);
+    const auto shape = profile_shape(scales);
+    std::ostringstream out;
+    check_throughput("fused_report_rows", best_throughput(workload_size, [&] { out.str({}); }, [&] {
+        balance_and_format(out, scales, shape, {});
+    }));
+}
+
+TEST_CASE("Perf: minimal pipeline end to end", "[perf][pipeline]") {
+    const auto text = join(random_tree_lines(workload_size, seed));
+    std::ostringstream out;
+    check_throughput("minimal_pipeline_lines", best_throughput(workload_size, [&] { out.str({}); }, [&] {
+        minimal_pipeline pipeline;
+        std::istringstream in{text};
+        pipeline.parse(in);
+        REQUIRE(pipeline.balance());
+        pipeline.report(out);
+    }));
+}
+
+#if SCALEBLANCER_HAS_ZLIB
+TEST_CASE("Perf: parallel gzip compression of the report", "[perf][gzip]") {
+    auto scales = make_binary_tree(workload_size);
+    balance_with(scales, profile_shape(scales), {});
+    std::ostringstream report;
+    report_changes(report, scales);
+    const auto text = report.str();
+    const auto threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::ostringstream out;
+    check_throughput("gzip_report_rows", best_throughput(workload_size, [&] { out.str({}); }, [&] {
+        parallel_gzip_streambuf gzip{out, threads};
+        gzip.sputn(text.data(), static_cast<std::streamsize>(text.size()));
+        REQUIRE(gzip.close());
+    }));
+}
+#endif
+
+TEST_CASE("Perf: parallel bottom-up ordering", "[perf][shape]") {
+    const auto links = link_scales(make_random_tree(workload_size, 11));
+    const auto threads = std::max(2u, std::thread::hardware_concurrency());
+    check_throughput("parallel_order_scales", best_throughput(workload_size, [&] {
+        const auto shape = profile_shape_parallel(links, threads);
+        REQUIRE(shape.order.size() == workload_size);
+    }));
+}
+
+TEST_CASE("Perf: indexing a deep chain", "[perf][ancestry]") {
+    const auto scales = make_chain(workload_size);
+    check_throughput("chain_index_scales", best_throughput(workload_size, [&] {
+        const auto links = link_scales(scales);
+        const auto shape = profile_shape(links);
+        const ancestry_index index{links};
+        REQUIRE(index.depth(static_cast<std::uint32_t>(workload_size - 1)) == workload_size - 1);
+        REQUIRE(shape.depth() == workload_size);
+    }));
+}
+
+TEST_CASE("Perf: incremental updates deep in a chain", "[perf][scale_graph]") {
+    // The deepest chain whose masses fit in int
+    constexpr std::size_t chain_length = synthetic_depth_limit;
+    constexpr std::size_t updates = 1 << 16;
+    scale_graph graph{make_chain(chain_length)};
+    const auto bottom = *graph.find("S" + std::to_string(chain_length - 1));
+
+    // Every update changes the bottom scale's mass, so it walks the whole chain up to the root.
+    check_throughput("chain_update_walks", best_throughput(updates, [&] {
+        for (std::size_t i = 0; i < updates; ++i) graph.replace_side(bottom, scale_side::right, std::to_string(i % 2 + 1));
+    }));
+}
+
+TEST_CASE("Perf: top-K imbalance queries between weight edits", "[perf][imbalance]") {
+    constexpr std::size_t rounds = 1 << 12;
+    scale_graph graph{make_binary_tree(workload_size)};
+    const auto leaf = *graph.find("S" + std::to_string(workload_size - 1));
+    const auto root = graph.root_of(leaf);
+
+    // Each round edits one leaf, which rebalances its whole path, and then asks for the top 10.
+    std::size_t found = 0;
+    check_throughput("imbalance_top_queries", best_throughput(rounds, [&] {
+        for (std::size_t i = 0; i < rounds; ++i) {
+            graph.replace_side(leaf, scale_side::right, std::to_string(i % 7 + 1));
+            graph.refresh_imbalances();
+            found = graph.imbalances().top(10, root).size();
+        }
+    }));
+    REQUIRE(found == 10);
+}
+
+TEST_CASE("Perf: requests of many tenants on one shared pool", "[perf][tenants]") {
+    constexpr std::size_t tenants = 64;
+    constexpr std::size_t requests = 1 << 14;
+    tenant_host host{std::max(1u, std::thread::hardware_concurrency())};
+    for (std::size_t t = 0; t < tenants; ++t) {
+        REQUIRE(host.create("T" + std::to_string(t), scale_graph{make_binary_tree(workload_size / tenants)}));
+    }
+
+    // Interleaved weight edits and lookups across all tenants, queued first and then collected.
+    std::string last;
+    std::vector<std::future<std::string>> responses;
+    check_throughput("tenant_requests", best_throughput(requests, [&] { responses.clear(); }, [&] {
+        for (std::size_t i = 0; i < requests; ++i) {
+            const auto tenant = "T" + std::to_string(i % tenants);
+            responses.push_back(host.submit(tenant, i % 2 ? "GET S0" : "SET S1,," + std::to_string(i % 5 + 1)));
+        }
+        for (auto& response : responses) last = response.get();
+    }));
+    REQUIRE(last.starts_with("S0,"));
+}
+
+TEST_CASE("Perf: queries while the whole graph reloads in the background", "[perf][reload]") {
+    constexpr std::size_t queries = 1 << 14;
+    const auto path = std::filesystem::temp_directory_path() / "scaleblancer_perf_reload.csv";
+    {
+        std::ofstream out{path};
+        for (const auto& line : scale_input_lines(make_binary_tree(workload_size))) out << line << '\n';
+    }
+    scale_server server{scale_graph{make_binary_tree(workload_size)}};
+
+    // Every repetition starts a reload and then queries the graph being replaced.
+    std::string last;
+    check_throughput("queries_during_reload", best_throughput(queries, [&] { REQUIRE(server.wait_for_reload()); }, [&] {
+        REQUIRE(server.handle("RELOAD " + path.string()) == "OK\n");
+        for (std::size_t i = 0; i < queries; ++i) last = server.handle("GET S" + std::to_string(i % 1024));
+    }));
+    REQUIRE(server.wait_for_reload());
+    REQUIRE(last.starts_with("S1023,"));
+    std::filesystem::remove(path);
+}
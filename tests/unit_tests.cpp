@@ -16,8 +16,14 @@
 #define main __main__
 #include "scaleblancer.cpp"
 #undef main 
+#include "load_generator.hpp"
+#include "scaling_bench.hpp"
 
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_all.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <sstream>
 
 TEST_CASE("Pan initializes correctly", "[Pan]") {
@@ -57,6 +63,15 @@ TEST_CASE("parse_scales builds structure from input", "[parse_scales]") {
     REQUIRE(scales[1]->name == "B");
 }
 
+TEST_CASE("parse_scales rejects lines with masses too large for int", "[parse_scales][edge]") {
+    std::istringstream iss("A,2,B\nB,1,3\nB,99999999999,1\nC,2147483648,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    REQUIRE(scales.size() == 2);
+    REQUIRE(std::get<Pan>(scales[1]->left).mass == 1);
+}
+
 TEST_CASE("balance_each_scale assigns correct counterweights", "[balance]") {
     auto a = std::make_shared<Scale>("A");
     a->left = Pan(4);
@@ -129,3 +144,1312 @@ TEST_CASE("Recursive scale dependencies resolve correctly", "[parse_scales][bala
     REQUIRE(right_mid.balance_mass == 0);
     REQUIRE(mid->mass == 6 + Scale::default_mass); // 2 + 3 + 1 + scale_mass
 }
+
+TEST_CASE("parse_fields keeps every side of a wide scale", "[parse_line][k_ary]") {
+    REQUIRE(parse_fields("A, 1 ,B,3") == std::vector<std::string>{"A", "1", "B", "3"});
+    REQUIRE(parse_fields("A,1,2,,") == std::vector<std::string>{"A", "1", "2"});
+    REQUIRE(parse_fields("A") == std::vector<std::string>{"A", "", ""});
+}
+
+TEST_CASE("balance_sides tops every side up to the heaviest", "[balance][k_ary]") {
+    const std::vector<int> masses{4, 9, 1, 9, 0};
+    std::vector<int> balances(masses.size());
+    REQUIRE(balance_sides(masses, balances) == 9);
+    REQUIRE(balances == std::vector<int>{5, 0, 8, 0, 9});
+}
+
+TEST_CASE("Scales with more than two sides balance every pan", "[parse_scales][balance][k_ary]") {
+    std::istringstream iss("Top,Tri,2,7,1\nTri,1,2,3\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    balance_each_scale(scales);
+
+    REQUIRE(scales[0]->side_count() == 4);
+    REQUIRE(scales[1]->side_count() == 3);
+    REQUIRE(scales[1]->mass == Scale::default_mass + 3 * 3);
+    std::ostringstream out;
+    report_changes(out, scales);
+    REQUIRE(out.str() == "Top,0,8,3,9\nTri,2,1,0\n");
+}
+
+TEST_CASE("Scales wider than the inline side buffer balance every pan", "[balance][k_ary]") {
+    std::string line{"Wide"};
+    for (int i = 1; i <= 100; ++i) line += "," + std::to_string(i);
+    std::istringstream iss(line + "\nTop,Wide,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    balance_each_scale(scales);
+
+    REQUIRE(scales[0]->side_count() == 100);
+    REQUIRE(scales[0]->mass == Scale::default_mass + 100 * 100);
+    for (std::size_t i = 0; i < 100; ++i) REQUIRE(Scale::resolve_side(scales[0]->side(i)).balance_mass == 99 - static_cast<int>(i));
+    REQUIRE(scales[0]->balance_mass == 0);
+    REQUIRE(std::get<Pan>(scales[1]->right).balance_mass == scales[0]->mass - 1);
+}
+
+TEST_CASE("mass_format parses and prints fixed-point masses", "[mass_format]") {
+    constexpr mass_format whole{};
+    constexpr mass_format milli{3};
+    STATIC_REQUIRE(milli.unit() == 1000);
+    STATIC_REQUIRE(milli.parse("12.345") == 12345);
+    STATIC_REQUIRE(milli.parse("0.5") == 500);
+    STATIC_REQUIRE(milli.parse("7") == 7000);
+    STATIC_REQUIRE(milli.parse("1.23456") == 1234); // extra places are cut off
+    STATIC_REQUIRE(whole.parse("42kg") == 42);
+    STATIC_REQUIRE(whole.parse("2147483647") == std::numeric_limits<int>::max());
+    STATIC_REQUIRE(!whole.parse("2147483648").has_value()); // too large for int: no mass at all
+    STATIC_REQUIRE(!whole.parse("99999999999").has_value());
+    STATIC_REQUIRE(!milli.parse("2147484").has_value());
+
+    auto printed = [](const mass_format& format, int mass) {
+        std::ostringstream os;
+        format.print(os, mass);
+        return os.str();
+    };
+    REQUIRE(printed(milli, 12345) == "12.345");
+    REQUIRE(printed(milli, 7) == "0.007");
+    REQUIRE(printed(milli, -1500) == "-1.500");
+    REQUIRE(printed(whole, 1500) == "1500");
+}
+
+TEST_CASE("Decimal masses balance exactly in fixed point", "[mass_format][balance]") {
+    std::istringstream iss("T,A,2.5\nA,0.5,1.25\n");
+    const mass_format milli{3};
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales, milli);
+    balance_each_scale(scales);
+
+    REQUIRE(scales[1]->mass == 3500); // 1 kg of beam plus 2 x 1.25 kg
+    std::ostringstream out;
+    report_changes(out, scales, milli);
+    REQUIRE(out.str() == "T,0.000,1.000\nA,0.750,0.000\n");
+}
+
+TEST_CASE("Topology file round-trips and answers lookups from its index", "[topology]") {
+    std::istringstream iss("A,2,B\nB,1,3\nC,A,7\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    std::ostringstream file(std::ios::binary);
+    REQUIRE(write_topology(file, scales));
+    const auto bytes = file.str();
+    std::vector<std::uint64_t> buffer((bytes.size() + 7) / 8);
+    std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+    const topology_view topology{std::as_bytes(std::span{buffer}).first(bytes.size())};
+    REQUIRE(topology.valid());
+    REQUIRE(topology.size() == 3);
+    REQUIRE(topology.find("A") == 0u);
+    REQUIRE(topology.find("C") == 2u);
+    REQUIRE_FALSE(topology.find("D").has_value());
+    REQUIRE(topology.node(*topology.find("C")).left_child == 0u);
+    REQUIRE(topology.node(*topology.find("B")).right_mass == 3);
+
+    std::vector<scale_wrapper> loaded;
+    load_topology(topology, loaded);
+    balance_each_scale(loaded);
+    std::ostringstream out;
+    report_changes(out, loaded);
+    REQUIRE(out.str() == "A,5,0\nB,2,0\nC,0,8\n"); // C is listed after A, which it holds
+}
+
+TEST_CASE("Topology file keeps the extra sides of wide scales", "[topology][k_ary]") {
+    std::istringstream iss("A,2,B,4\nB,1,3,C,5\nC,1,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    std::ostringstream file(std::ios::binary);
+    REQUIRE(write_topology(file, scales));
+    const auto bytes = file.str();
+    std::vector<std::uint64_t> buffer((bytes.size() + 7) / 8);
+    std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+    const topology_view topology{std::as_bytes(std::span{buffer}).first(bytes.size())};
+    REQUIRE(topology.valid());
+    REQUIRE(topology.extra_sides(0).size() == 1);
+    REQUIRE(topology.extra_sides(1).size() == 2);
+    REQUIRE(topology.extra_sides(1)[0].child == 2u);
+    REQUIRE(topology.extra_sides(2).empty());
+
+    std::vector<scale_wrapper> loaded;
+    load_topology(topology, loaded);
+    balance_each_scale(loaded);
+    std::ostringstream out;
+    report_changes(out, loaded);
+    REQUIRE(out.str() == "A,19,0,17\nB,4,2,2,0\nC,0,0\n");
+
+    std::istringstream decimal("A,0.25,1\n");
+    parse_scales(decimal, scales, mass_format{2});
+    std::ostringstream decimal_file(std::ios::binary);
+    REQUIRE(write_topology(decimal_file, scales, mass_format{2}));
+    const auto decimal_bytes = decimal_file.str();
+    buffer.assign((decimal_bytes.size() + 7) / 8, 0);
+    std::memcpy(buffer.data(), decimal_bytes.data(), decimal_bytes.size());
+    const topology_view decimal_topology{std::as_bytes(std::span{buffer}).first(decimal_bytes.size())};
+    REQUIRE(decimal_topology.format().decimals == 2);
+    load_topology(decimal_topology, loaded);
+    REQUIRE(loaded[0]->self_mass == 100);
+}
+
+TEST_CASE("Topology file groups trees into a component directory", "[topology][components]") {
+    std::istringstream iss("A,B,1\nX,2,3\nB,4,C\nY,X,1\nC,1,1\nZ,9,9\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    std::ostringstream file(std::ios::binary);
+    REQUIRE(write_topology(file, scales));
+    const auto bytes = file.str();
+    std::vector<std::uint64_t> buffer((bytes.size() + 7) / 8);
+    std::memcpy(buffer.data(), bytes.data(), bytes.size());
+    const topology_view topology{std::as_bytes(std::span{buffer}).first(bytes.size())};
+    REQUIRE(topology.valid());
+
+    // Trees in order of first appearance: A-B-C, Y-X, Z; each tree's nodes and names are contiguous.
+    REQUIRE(topology.component_count() == 3);
+    const auto& first = topology.component(0);
+    REQUIRE(first.node_first == 0);
+    REQUIRE(first.node_count == 3);
+    REQUIRE(topology.name(first.root) == "A");
+    REQUIRE(first.names_size == 3);
+    REQUIRE(topology.name(topology.component(1).root) == "Y");
+    REQUIRE(topology.component(1).node_count == 2);
+    REQUIRE(topology.component(2).node_first == 5);
+    REQUIRE(topology.component_of(*topology.find("C")) == 0u);
+    REQUIRE(topology.component_of(*topology.find("X")) == 1u);
+    REQUIRE(topology.component_of(*topology.find("Z")) == 2u);
+    REQUIRE_FALSE(topology.component_of(6).has_value());
+
+    std::vector<scale_wrapper> loaded;
+    load_topology(topology, loaded);
+    std::ostringstream out;
+    balance_with(loaded, profile_shape(loaded), {});
+    report_changes(out, loaded);
+    REQUIRE(out.str() == "A,0,8\nB,0,1\nX,1,0\nC,0,0\nY,0,6\nZ,0,0\n");
+
+    const std::vector<std::uint32_t> trees{2, 1, 2};
+    load_components(topology, trees, loaded);
+    REQUIRE(loaded.size() == 3);
+    balance_with(loaded, profile_shape(loaded), {});
+    out.str({});
+    report_changes(out, loaded);
+    REQUIRE(out.str() == "X,1,0\nY,0,6\nZ,0,0\n");
+}
+
+TEST_CASE("Topology view rejects truncated files", "[topology][edge]") {
+    std::vector<std::uint64_t> buffer(4);
+    REQUIRE_FALSE(topology_view{std::as_bytes(std::span{buffer})}.valid());
+}
+
+TEST_CASE("Topology view rejects node counts whose sizes would wrap", "[topology][edge]") {
+    std::istringstream iss("A,2,B\nB,1,3\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    std::ostringstream file(std::ios::binary);
+    REQUIRE(write_topology(file, scales));
+    const auto bytes = file.str();
+    std::vector<std::uint64_t> buffer((bytes.size() + 7) / 8);
+    std::memcpy(buffer.data(), bytes.data(), bytes.size());
+    const auto view = [&] { return topology_view{std::as_bytes(std::span{buffer}).first(bytes.size())}; };
+    REQUIRE(view().valid());
+
+    // 2^62 nodes: every node, index and order size wraps to 0 bytes
+    auto* header = reinterpret_cast<topology_header*>(buffer.data());
+    header->node_count = std::uint64_t{1} << 62;
+    REQUIRE_FALSE(view().valid());
+    header->node_count = bytes.size(); // more records than the file has bytes for
+    REQUIRE_FALSE(view().valid());
+}
+
+TEST_CASE("profile_shape reports levels, roots and a bottom-up order", "[shape]") {
+    std::istringstream iss("B,1,3\nA,2,B\nC,A,D\nD,4,4\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    const auto shape = profile_shape(scales);
+    REQUIRE(shape.node_count == 4);
+    REQUIRE(shape.root_count == 1);
+    REQUIRE(shape.depth() == 3);
+    REQUIRE(shape.width == std::vector<std::size_t>{2, 1, 1});
+    REQUIRE(shape.max_width() == 2);
+    REQUIRE(scales[shape.order.back()]->name == "C");
+}
+
+TEST_CASE("profile_shape tolerates cycles", "[shape][edge]") {
+    std::istringstream iss("A,B,1\nB,A,2\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    const auto shape = profile_shape(scales);
+    REQUIRE(shape.order.size() == 2);
+}
+
+TEST_CASE("profile_shape_parallel matches profile_shape on every shape", "[shape][parallel]") {
+    auto same_profile = [](const shape_profile& a, const shape_profile& b) {
+        return a.node_count == b.node_count && a.root_count == b.root_count && a.width == b.width
+            && a.order == b.order && a.level_offsets == b.level_offsets && a.height == b.height;
+    };
+    // Wide levels are peeled by all threads, narrow ones (chains, the tops of trees) by one
+    for (const auto& scales : {make_binary_tree(1 << 15), make_random_tree(20000, 9), make_forest(20000, 31),
+                               make_chain(5000), std::vector<scale_wrapper>{}}) {
+        const auto links = link_scales(scales);
+        const auto sequential = profile_shape(links);
+        for (const auto threads : {2u, 3u, 8u}) REQUIRE(same_profile(profile_shape_parallel(links, threads), sequential));
+    }
+
+    // A scale held by two parents, and a pan-only scale held twice by one parent
+    std::istringstream shared("A,S,1\nB,S,2\nS,T,T\nT,1,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(shared, scales);
+    const auto links = link_scales(scales);
+    const auto shape = profile_shape_parallel(links, 4);
+    REQUIRE(same_profile(shape, profile_shape(links)));
+    REQUIRE(shape.height == std::vector<std::uint32_t>{2, 1, 2, 0}); // A, S, B, T
+    REQUIRE(shape.root_count == 2);
+    REQUIRE(shape.shared_count == 2);
+}
+
+TEST_CASE("link_scales_parallel matches link_scales", "[shape][parallel]") {
+    auto same_links = [](const scale_links& a, const scale_links& b) {
+        return a.side_offsets == b.side_offsets && a.side_child == b.side_child;
+    };
+    for (const auto& scales : {make_binary_tree(1 << 15), make_random_tree(20000, 9), make_chain(5000),
+                               std::vector<scale_wrapper>{}}) {
+        const auto sequential = link_scales(scales);
+        for (const auto threads : {2u, 3u, 8u}) REQUIRE(same_links(link_scales_parallel(scales, threads), sequential));
+    }
+
+    // Shared and wide children, a scale listed twice and a child left out of the list
+    std::istringstream iss("A,S,1,W\nB,S,2\nS,T,T\nW,1,2,3,4\nT,1,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    scales.push_back(scales[1]);
+    scales.erase(scales.begin() + 4);
+    const auto links = link_scales_parallel(scales, 3);
+    REQUIRE(same_links(links, link_scales(scales)));
+    REQUIRE(links.children(0).size() == 3);
+    REQUIRE(links.children(1)[0] == scale_links::no_child); // T is not in the list
+    REQUIRE(links.children(0)[0] == 1u);                     // S keeps its first index
+
+    // The graph-sized overload links and peels on the pool and agrees with one thread
+    const auto big = make_random_tree(parallel_profile_scales, 5);
+    REQUIRE(profile_shape(big, 4).order == profile_shape(big).order);
+}
+
+TEST_CASE("profile_shape_parallel falls back on cycles", "[shape][parallel][edge]") {
+    std::istringstream iss("A,B,1\nB,A,2\nC,1,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    const auto links = link_scales(scales);
+    const auto shape = profile_shape_parallel(links, 4);
+    REQUIRE(shape.order.size() == 3);
+    REQUIRE(shape.order == profile_shape(links).order);
+}
+
+TEST_CASE("Cost model prefers sequential for chains and parallel for wide trees", "[engine]") {
+    const cost_model model;
+    const auto chain = profile_shape(make_chain(1000));
+    REQUIRE(choose_engine(chain, model, 8).engine == balance_engine::sequential);
+
+    const auto wide = profile_shape(make_binary_tree(1 << 20));
+    const auto choice = choose_engine(wide, model, 8);
+    REQUIRE(choice.engine == balance_engine::level_parallel);
+    REQUIRE(choice.threads > 1);
+
+    std::istringstream saved("node_ns 5\nlevel_sync_ns 10\n");
+    const auto loaded = cost_model::load(saved);
+    REQUIRE(loaded.has_value());
+    REQUIRE(loaded->node_ns == 5);
+    REQUIRE(loaded->thread_start_ns == model.thread_start_ns);
+}
+
+TEST_CASE("Level-parallel engine matches the sequential engine", "[engine]") {
+    auto sequential = make_binary_tree(5000);
+    auto parallel = make_binary_tree(5000);
+    const auto shape = profile_shape(sequential);
+    balance_with(sequential, shape, {balance_engine::sequential, 1});
+    balance_with(parallel, shape, {balance_engine::level_parallel, 4});
+
+    std::ostringstream expected, actual;
+    report_changes(expected, sequential);
+    report_changes(actual, parallel);
+    REQUIRE(actual.str() == expected.str());
+}
+
+TEST_CASE("Scales sharing a child always balance in the sequential order", "[engine][edge]") {
+    // A and B, on one level, both write the counterweight of C; B, listed last, must win
+    const std::string input = "R,A,B\nA,C,1\nB,C,20\nC,1,1\n";
+    for (int run = 0; run < 20; ++run) {
+        std::istringstream iss(input);
+        std::vector<scale_wrapper> scales;
+        parse_scales(iss, scales);
+        const auto shape = profile_shape(scales);
+        REQUIRE(shape.shared_count == 1);
+
+        balance_with(scales, shape, {balance_engine::level_parallel, 4});
+        std::ostringstream out;
+        report_changes(out, scales);
+        REQUIRE(out.str() == "R,34,0\nA,17,2\nB,17,0\nC,0,0\n");
+    }
+}
+
+TEST_CASE("reorder_buffer releases only the complete prefix", "[stream]") {
+    std::istringstream iss("A,1,2\nB,3,3\nC,5,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    balance_each_scale(scales);
+
+    reorder_buffer rows{scales.size()};
+    std::ostringstream out;
+    const std::array<std::uint32_t, 2> late{1, 2};
+    rows.complete(late);
+    REQUIRE(rows.drain(out, scales) == 0);
+    REQUIRE(out.str().empty());
+
+    const std::array<std::uint32_t, 1> first{0};
+    rows.complete(first);
+    REQUIRE(rows.drain(out, scales) == 3);
+    REQUIRE(rows.finished());
+    REQUIRE(out.str() == "A,1,0\nB,0,0\nC,0,4\n");
+}
+
+TEST_CASE("compact_scales relocates the graph into one arena in balancing order", "[compaction]") {
+    std::istringstream iss("Top,Mid,1\nMid,Low,3\nLow,2,2\nOther,4,5\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+
+    auto compacted = compact_scales(scales);
+    scales.clear(); // the compacted graph must not depend on the original scales
+
+    REQUIRE(compacted.size() == 4);
+    REQUIRE(compacted[0]->name == "Top");
+    REQUIRE(compacted[3]->name == "Other");
+    REQUIRE(std::get<std::weak_ptr<Scale>>(compacted[0]->left).lock() == compacted[1]);
+    // Bottom-up layout: children precede their parents in memory.
+    REQUIRE(compacted[2].get() < compacted[1].get());
+    REQUIRE(compacted[1].get() < compacted[0].get());
+
+    balance_each_scale(compacted);
+    std::ostringstream out;
+    report_changes(out, compacted);
+    REQUIRE(out.str() == "Top,0,10\nMid,0,2\nLow,0,0\nOther,1,0\n");
+}
+
+TEST_CASE("ancestry_index answers root, depth and lowest common ancestor", "[ancestry]") {
+    std::istringstream iss("A,B,C\nB,D,1\nC,2,E\nD,1,1\nE,3,3\nX,1,Y\nY,1,1\n");
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    const auto by_name = index_by_name(scales);
+    auto id = [&](std::string_view name) { return by_name.at(name); };
+
+    const ancestry_index index{link_scales(scales)};
+    REQUIRE(index.size() == 7);
+    REQUIRE(index.root(id("D")) == id("A"));
+    REQUIRE(index.root(id("Y")) == id("X"));
+    REQUIRE(index.depth(id("A")) == 0);
+    REQUIRE(index.depth(id("E")) == 2);
+    REQUIRE(index.parent(id("E")) == id("C"));
+    REQUIRE(index.parent(id("A")) == ancestry_index::no_parent);
+    REQUIRE(index.lca(id("D"), id("E")) == id("A"));
+    REQUIRE(index.lca(id("D"), id("B")) == id("B"));
+    REQUIRE(index.lca(id("E"), id("E")) == id("E"));
+    REQUIRE_FALSE(index.lca(id("D"), id("Y")).has_value());
+}
+
+TEST_CASE("ancestry_index handles deep chains without recursion", "[ancestry][edge]") {
+    const auto chain = make_chain(200000);
+    const ancestry_index index{link_scales(chain)};
+    REQUIRE(index.depth(199999) == 199999);
+    REQUIRE(index.root(199999) == 0);
+    REQUIRE(index.lca(150000, 199999) == 150000u);
+}
+
+namespace {
+std::string balanced_report(const std::string& input) {
+    std::istringstream iss(input);
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    const auto shape = profile_shape(scales);
+    balance_with(scales, shape, {});
+    std::ostringstream out;
+    report_changes(out, scales);
+    return out.str();
+}
+
+scale_graph make_graph(const std::string& input) {
+    std::istringstream iss(input);
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales);
+    return scale_graph{std::move(scales)};
+}
+
+std::string report_of(const scale_graph& graph) {
+    std::ostringstream out;
+    graph.report(out);
+    return out.str();
+}
+} // namespace
+
+TEST_CASE("scale_graph link moves a subtree and rebalances its ancestors", "[scale_graph]") {
+    auto graph = make_graph("A,B,C\nB,1,2\nC,3,D\nD,4,4\n");
+    REQUIRE(report_of(graph) == balanced_report("A,B,C\nB,1,2\nC,3,D\nD,4,4\n"));
+
+    REQUIRE(graph.link(*graph.find("D"), *graph.find("B"), scale_side::left));
+    REQUIRE(graph.parent(*graph.find("D")).parent == *graph.find("B"));
+    REQUIRE(report_of(graph) == balanced_report("A,B,C\nB,D,2\nC,3,0\nD,4,4\n"));
+}
+
+TEST_CASE("scale_graph cut detaches a subtree into its own tree", "[scale_graph]") {
+    auto graph = make_graph("A,B,1\nB,C,2\nC,5,5\n");
+    graph.cut(*graph.find("C"));
+    REQUIRE(graph.parent(*graph.find("C")).parent == scale_graph::no_scale);
+    REQUIRE(report_of(graph) == balanced_report("A,B,1\nB,0,2\nC,5,5\n"));
+
+    REQUIRE(graph.link(*graph.find("C"), *graph.find("A"), scale_side::right));
+    REQUIRE(report_of(graph) == balanced_report("A,B,C\nB,0,2\nC,5,5\n"));
+}
+
+TEST_CASE("scale_graph rejects links that would create a cycle", "[scale_graph][edge]") {
+    auto graph = make_graph("A,B,1\nB,C,2\nC,5,5\n");
+    const auto before = report_of(graph);
+    REQUIRE_FALSE(graph.link(*graph.find("A"), *graph.find("C"), scale_side::left));
+    REQUIRE_FALSE(graph.link(*graph.find("B"), *graph.find("B"), scale_side::left));
+    REQUIRE(report_of(graph) == before);
+}
+
+TEST_CASE("scale_graph stops rebalancing where masses stop changing", "[scale_graph]") {
+    auto graph = make_graph("A,B,100\nB,C,1\nC,1,1\n");
+    // C still weighs the same, so neither B nor A needs to be revisited.
+    REQUIRE(graph.rebalance_from(*graph.find("C")) == 1);
+}
+
+TEST_CASE("scale_graph adds, replaces and removes scale definitions", "[scale_graph][incremental]") {
+    auto graph = make_graph("A,B,1\nB,2,3\n");
+
+    const auto c = graph.add("C", "4", "D");
+    REQUIRE(c.has_value());
+    REQUIRE(graph.find("D").has_value());
+    REQUIRE(report_of(graph) == balanced_report("A,B,1\nB,2,3\nC,4,D\n"));
+
+    REQUIRE(graph.set(*graph.find("D"), "1", "9"));
+    REQUIRE(graph.set(*graph.find("A"), "C", ""));
+    REQUIRE(graph.parent(*graph.find("B")).parent == scale_graph::no_scale);
+    REQUIRE(report_of(graph) == balanced_report("A,0,1\nB,2,3\nC,4,D\nD,1,9\nA,C,1\n"));
+
+    graph.remove(*graph.find("D"));
+    REQUIRE_FALSE(graph.find("D").has_value());
+    REQUIRE(graph.holes() == 1);
+    REQUIRE(report_of(graph) == balanced_report("A,0,1\nB,2,3\nC,4,0\nA,C,1\n"));
+
+    graph.compact();
+    REQUIRE(graph.holes() == 0);
+    REQUIRE(graph.size() == 3);
+    REQUIRE(graph.parent(*graph.find("C")).parent == *graph.find("A"));
+    REQUIRE(report_of(graph) == balanced_report("A,0,1\nB,2,3\nC,4,0\nA,C,1\n"));
+}
+
+TEST_CASE("scale_graph validates edits locally", "[scale_graph][incremental][edge]") {
+    auto graph = make_graph("A,B,1\nB,C,2\nC,5,5\nX,1,1\n");
+    const auto before = report_of(graph);
+
+    REQUIRE_FALSE(graph.add("A", "1", "1").has_value());  // name taken
+    REQUIRE_FALSE(graph.add("N", "C", "1").has_value());  // C already hangs from B
+    REQUIRE_FALSE(graph.add("N", "X", "X").has_value());  // one scale on both sides
+    REQUIRE_FALSE(graph.set(*graph.find("C"), "A", "")); // cycle
+    REQUIRE_FALSE(graph.set(*graph.find("X"), "B", "")); // shared child
+    REQUIRE_FALSE(graph.set(*graph.find("X"), "2", "C")); // rejected as a whole
+    REQUIRE(report_of(graph) == before);
+}
+
+TEST_CASE("scale_graph refuses loads and edits whose masses overflow int", "[scale_graph][edge]") {
+    // A weighs 1 + 2 * 1000000000, so any scale holding A weighs more than INT_MAX
+    REQUIRE_FALSE(make_graph("B,A,1\nA,1000000000,1\n").valid());
+
+    auto graph = make_graph("A,1000000000,1\nB,1,1\nC,D,1\nD,1,1\nX,300000000,0\n");
+    REQUIRE(graph.valid());
+    const auto before = report_of(graph);
+
+    REQUIRE_FALSE(graph.link(*graph.find("A"), *graph.find("B"), scale_side::left));
+    REQUIRE_FALSE(graph.link(*graph.find("X"), *graph.find("D"), scale_side::right)); // D fits, C does not
+    REQUIRE_FALSE(graph.set(*graph.find("B"), "A", ""));
+    REQUIRE_FALSE(graph.set(*graph.find("D"), "2000000000", ""));
+    REQUIRE_FALSE(graph.replace_side(*graph.find("B"), 4, "800000000")); // five sides of 800000000
+    REQUIRE_FALSE(graph.add("N", "A", "").has_value());
+    // Masses that do not even fit an int are refused rather than read as INT_MAX
+    REQUIRE_FALSE(graph.add("N", "99999999999", "").has_value());
+    REQUIRE_FALSE(graph.set(*graph.find("X"), "", "2147483648"));
+    REQUIRE_FALSE(graph.replace_side(*graph.find("X"), 1, "99999999999"));
+    REQUIRE(graph.parent(*graph.find("A")).parent == scale_graph::no_scale);
+    REQUIRE(report_of(graph) == before);
+
+    // A refused link leaves the child on the side it hung from
+    auto moved = make_graph("C,D,1\nD,1,1\nE,B,1\nB,500000000,1\n");
+    const auto unmoved = report_of(moved);
+    REQUIRE_FALSE(moved.link(*moved.find("B"), *moved.find("D"), scale_side::left));
+    REQUIRE(moved.parent(*moved.find("B")).parent == *moved.find("E"));
+    REQUIRE(report_of(moved) == unmoved);
+}
+
+TEST_CASE("scale_graph refuses input that is not a forest", "[scale_graph][edge]") {
+    REQUIRE_FALSE(make_graph("A,C,1\nB,C,2\nC,1,1\n").valid()); // C hangs from A and B
+    REQUIRE_FALSE(make_graph("A,B,1\nB,C,1\nC,A,1\n").valid());
+    REQUIRE(make_graph("A,B,1\nB,C,1\nC,1,1\n").valid());
+}
+
+TEST_CASE("scale_graph set moves scales between the sides of their parent", "[scale_graph][incremental]") {
+    auto graph = make_graph("A,B,C\nB,1,1\nC,5,5\n");
+    REQUIRE(graph.set(*graph.find("A"), "C", "B"));
+    REQUIRE(graph.parent(*graph.find("C")).side == scale_side::left);
+    REQUIRE(report_of(graph) == "A,0,8\nB,0,0\nC,0,0\n");
+
+    // C leaves the left side empty and takes the right one from B
+    REQUIRE(graph.set(*graph.find("A"), "", "C"));
+    REQUIRE(graph.parent(*graph.find("B")).parent == scale_graph::no_scale);
+    REQUIRE(report_of(graph) == "A,11,0\nB,0,0\nC,0,0\n");
+}
+
+TEST_CASE("scale_graph add defines a scale so far only named as a side", "[scale_graph][incremental]") {
+    auto graph = make_graph("A,B,1\nB,1,1\n");
+    REQUIRE(graph.add("X", "Y", "1").has_value());
+    const auto y = graph.find("Y");
+    REQUIRE(graph.is_placeholder(*y));
+    REQUIRE(graph.add("Y", "2", "3") == y);
+    REQUIRE(report_of(graph) == balanced_report("A,B,1\nB,1,1\nX,Y,1\nY,2,3\n"));
+    REQUIRE_FALSE(graph.add("Y", "4", "4").has_value()); // defined now
+    REQUIRE_FALSE(graph.add("B", "1", "1").has_value());
+
+    REQUIRE(graph.add("P", "Q", "").has_value());
+    REQUIRE_FALSE(graph.add("Q", "P", "").has_value()); // cycle
+}
+
+TEST_CASE("scale_graph edits sides beyond left and right", "[scale_graph][incremental][k_ary]") {
+    auto graph = make_graph("A,B,1,2\nB,2,3\n");
+    REQUIRE(report_of(graph) == balanced_report("A,B,1,2\nB,2,3\n"));
+
+    const std::vector<std::string> sides{"1", "", "5"};
+    REQUIRE(graph.set(*graph.find("B"), sides));
+    REQUIRE(graph.link(*graph.find("B"), *graph.find("A"), 2));
+    REQUIRE(report_of(graph) == balanced_report("A,0,1,B\nB,1,3,5\n"));
+    REQUIRE_FALSE(graph.link(*graph.find("B"), *graph.find("A"), 3)); // A has three sides
+}
+
+TEST_CASE("imbalance_index answers threshold, range and top-K queries per tree", "[imbalance]") {
+    imbalance_index index;
+    index.set(0, 0, 16);
+    index.set(1, 0, 8);
+    index.set(2, 0, 2);
+    index.set(3, 3, 8);
+    using hit = imbalance_index::hit;
+
+    REQUIRE(index.above(7) == std::vector<hit>{{1, 8}, {3, 8}, {0, 16}});
+    REQUIRE(index.above(7, 0) == std::vector<hit>{{1, 8}, {0, 16}});
+    REQUIRE(index.range(2, 8, 0) == std::vector<hit>{{2, 2}, {1, 8}});
+    REQUIRE(index.top(2) == std::vector<hit>{{0, 16}, {3, 8}});
+    REQUIRE(index.above(0, 7).empty()); // no such tree
+
+    index.update(0, 1);
+    index.move(1, 3);
+    index.erase(2);
+    REQUIRE(index.top(5, 0) == std::vector<hit>{{0, 1}});
+    REQUIRE(index.top(5, 3) == std::vector<hit>{{3, 8}, {1, 8}});
+    REQUIRE(index.size() == 3);
+}
+
+TEST_CASE("scale_graph keeps the imbalance index current through edits", "[imbalance][scale_graph]") {
+    std::string input;
+    for (const auto& line : scale_input_lines(make_forest(300, 3))) input += line;
+    auto graph = make_graph(input);
+
+    auto check = [&] {
+        graph.refresh_imbalances();
+        REQUIRE_FALSE(graph.imbalances_stale());
+        std::size_t live = 0;
+        for (std::uint32_t i = 0; i < graph.size(); ++i) {
+            if (!graph.scales()[i]) {
+                REQUIRE_FALSE(graph.imbalances().contains(i));
+                continue;
+            }
+            ++live;
+            REQUIRE(graph.imbalances().balance(i) == required_balance(graph.scale(i)));
+            REQUIRE(graph.imbalances().tree(i) == graph.root_of(i));
+        }
+        REQUIRE(graph.imbalances().size() == live);
+    };
+    check();
+
+    std::mt19937 random{11};
+    auto any_scale = [&] {
+        for (;;) {
+            const auto i = static_cast<std::uint32_t>(random() % graph.size());
+            if (graph.scales()[i]) return i;
+        }
+    };
+    for (int edit = 0; edit < 400; ++edit) {
+        const auto a = any_scale();
+        const auto b = any_scale();
+        switch (random() % 5) {
+            case 0: graph.replace_side(a, random() % 2, std::to_string(random() % 50)); break;
+            case 1: graph.link(a, b, random() % 2); break;
+            case 2: graph.cut(a); break;
+            case 3: graph.add("N" + std::to_string(edit), std::to_string(random() % 9), ""); break;
+            default: graph.remove(a); break;
+        }
+        check();
+    }
+    graph.compact();
+    check();
+}
+
+TEST_CASE("latency_histogram buckets stay within a few percent", "[latency]") {
+    for (const std::uint64_t value : {0ull, 1ull, 63ull, 64ull, 65ull, 1000ull, 123456789ull}) {
+        const auto bucket = latency_histogram::bucket_of(value);
+        REQUIRE(bucket < latency_histogram::bucket_count);
+        REQUIRE(latency_histogram::highest_in(bucket) >= value);
+        REQUIRE(latency_histogram::highest_in(bucket) - value <= value / 32);
+        if (bucket > 0) REQUIRE(latency_histogram::highest_in(bucket - 1) < value);
+    }
+    REQUIRE(latency_histogram::bucket_of(~0ull) == latency_histogram::bucket_count - 1);
+
+    latency_histogram histogram;
+    for (std::uint64_t v = 1; v <= 1000; ++v) histogram.record(v);
+    REQUIRE(histogram.count() == 1000);
+    REQUIRE(histogram.value_at(0.5) >= 500);
+    REQUIRE(histogram.value_at(0.5) <= 500 + 500 / 32);
+    REQUIRE(histogram.value_at(1.0) >= 1000);
+}
+
+TEST_CASE("latency_stats merges the counters of all threads", "[latency]") {
+    latency_stats stats;
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&stats] {
+                for (int i = 0; i < 1000; ++i) stats.record(latency_path::update, std::chrono::microseconds{5});
+            });
+        }
+    }
+    stats.record(latency_path::query, std::chrono::nanoseconds{100});
+    REQUIRE(stats.snapshot(latency_path::update).count() == 4000);
+    const auto p99 = stats.snapshot(latency_path::update).value_at(0.99);
+    REQUIRE(p99 >= 5000);
+    REQUIRE(p99 <= 5000 + 5000 / 32);
+    REQUIRE(stats.snapshot(latency_path::query).count() == 1);
+    REQUIRE(stats.snapshot(latency_path::recompute).count() == 0);
+}
+
+TEST_CASE("thread_slots keeps each instance's slot when a thread alternates between instances", "[latency]") {
+    // More instances than the per-thread cache holds, so some lookups miss and evict
+    std::vector<std::unique_ptr<thread_slots<int>>> slots;
+    for (std::size_t i = 0; i < thread_slots<int>::cache_entries + 3; ++i) slots.push_back(std::make_unique<thread_slots<int>>());
+    for (int round = 0; round < 3; ++round) {
+        for (auto& s : slots) ++s->local();
+        ++slots.front()->local();
+    }
+    int total = 0;
+    for (const auto& s : slots) s->for_each([&](int v) { total += v; });
+    REQUIRE(total == 3 * static_cast<int>(slots.size()) + 3);
+    slots.front()->for_each([](int v) { REQUIRE(v == 6); });
+
+    latency_stats first;
+    latency_stats second;
+    for (int i = 0; i < 100; ++i) {
+        first.record(latency_path::query, std::chrono::nanoseconds{100});
+        second.record(latency_path::update, std::chrono::nanoseconds{100});
+    }
+    REQUIRE(first.snapshot(latency_path::query).count() == 100);
+    REQUIRE(first.snapshot(latency_path::update).count() == 0);
+    REQUIRE(second.snapshot(latency_path::update).count() == 100);
+}
+
+TEST_CASE("latency_stats can share one set of counters between threads", "[latency]") {
+    latency_stats shared{latency_recording::shared};
+    latency_stats per_thread;
+    const auto one_set = shared.memory_bytes();
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 1000; ++i) {
+                    shared.record(latency_path::update, std::chrono::microseconds{5});
+                    per_thread.record(latency_path::update, std::chrono::microseconds{5});
+                }
+            });
+        }
+    }
+    REQUIRE(shared.snapshot(latency_path::update).count() == 4000);
+    REQUIRE(shared.memory_bytes() == one_set);
+    REQUIRE(per_thread.snapshot(latency_path::update).count() == 4000);
+    REQUIRE(per_thread.memory_bytes() > 4 * one_set);
+}
+
+TEST_CASE("run_metrics sums per-thread counters and exports Prometheus text", "[metrics]") {
+    run_metrics metrics;
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&metrics] {
+                for (int i = 0; i < 1000; ++i) metrics.add(run_counter::balance_ns, 1000);
+            });
+        }
+    }
+    REQUIRE(metrics.total(run_counter::balance_ns) == 4'000'000);
+
+    std::istringstream source("A,B,1\nB,2,3\n# comment\n");
+    counting_streambuf counted{*source.rdbuf(), metrics};
+    std::istream input{&counted};
+    std::vector<scale_wrapper> scales;
+    parse_scales(input, scales);
+    REQUIRE(scales.size() == 2);
+    REQUIRE(metrics.total(run_counter::rows_parsed) == 3);
+    REQUIRE(metrics.total(run_counter::parse_bytes) == source.str().size());
+
+    std::ostringstream text;
+    write_prometheus(text, metrics, {2, 0, nullptr});
+    REQUIRE_THAT(text.str(), Catch::Matchers::ContainsSubstring("\nscaleblancer_rows_parsed_total 3\n"));
+    REQUIRE_THAT(text.str(), Catch::Matchers::ContainsSubstring("# TYPE scaleblancer_balance_seconds_total counter\n"
+                                                                "scaleblancer_balance_seconds_total 0.004\n"));
+    REQUIRE_THAT(text.str(), Catch::Matchers::ContainsSubstring("\nscaleblancer_graph_scales 2\n"));
+
+    // Latency summaries carry the exact sum, not one rebuilt from the buckets
+    for (const auto recording : {latency_recording::per_thread, latency_recording::shared}) {
+        latency_stats latencies{recording};
+        latencies.record(latency_path::query, std::chrono::nanoseconds{1'000'001});
+        latencies.record(latency_path::query, std::chrono::nanoseconds{2'000'003});
+        REQUIRE(latencies.snapshot(latency_path::query).sum() == 3'000'004);
+        std::ostringstream summary;
+        write_prometheus(summary, metrics, {2, 0, &latencies});
+        REQUIRE_THAT(summary.str(), Catch::Matchers::ContainsSubstring(
+                                        "scaleblancer_request_latency_seconds_sum{path=\"query\"} 0.003\n"
+                                        "scaleblancer_request_latency_seconds_count{path=\"query\"} 2\n"));
+        REQUIRE_THAT(summary.str(), Catch::Matchers::ContainsSubstring(
+                                        "scaleblancer_request_latency_seconds_sum{path=\"update\"} 0\n"));
+    }
+}
+
+TEST_CASE("Load generator drives a server in closed and open loop", "[load]") {
+    for (const auto mode : {load_mode::closed, load_mode::open}) {
+        load_config config;
+        config.mode = mode;
+        config.concurrency = 3;
+        config.rate = 50000;
+        config.requests = 600;
+        config.query_ratio = 0.5;
+        config.zipf_skew = 1.1;
+
+        auto scales = make_binary_tree(63);
+        const load_workload workload{scales, config};
+        scale_server server{scale_graph{std::move(scales)}};
+        latency_stats latencies;
+        const auto result = run_load(server, workload, config, latencies);
+
+        REQUIRE(result.requests == 600);
+        REQUIRE(result.errors == 0);
+        REQUIRE(latencies.snapshot(latency_path::query).count() + latencies.snapshot(latency_path::update).count() == 600);
+        REQUIRE(latencies.snapshot(latency_path::update).count() > 0);
+        if (mode == load_mode::open) REQUIRE(result.elapsed >= std::chrono::milliseconds{11});
+
+        // Updates only touch pans, so the tree keeps all of its scales and links.
+        const auto report = server.handle("REPORT");
+        REQUIRE(std::ranges::count(report, '\n') == 64);
+        REQUIRE(server.handle("GET S0").starts_with("S0,"));
+    }
+}
+
+TEST_CASE("scale_server answers queries and applies edits", "[scale_server]") {
+    scale_server server{make_graph("A,B,1\nB,2,3\n")};
+    REQUIRE(server.handle("GET A") == "A,0,6\n");
+    REQUIRE(server.handle("ADD C,4,D") == "OK\n");
+    REQUIRE(server.handle("SET A,C,1") == "OK\n");
+    REQUIRE(server.handle("LINK B C right") == "OK\n");
+    REQUIRE(server.handle("LINK A B left") == "ERROR cycle\n");
+    REQUIRE(server.handle("REMOVE D") == "OK\n");
+    REQUIRE(server.handle("GET D") == "ERROR unknown scale\n");
+    REQUIRE(server.handle("REPORT") == balanced_report("A,0,1\nB,2,3\nC,4,B\nA,C,1\n") + "OK\n");
+    REQUIRE(server.handle("CUT B") == "OK\n");
+    REQUIRE(server.handle("GET C") == "C,0,4\n");
+    REQUIRE(server.handle("FOO") == "ERROR unknown command\n");
+    REQUIRE(server.handle("ADD T,1,2,N") == "OK\n");
+    REQUIRE(server.handle("GET T") == "T,1,0,1\n");
+    REQUIRE(server.handle("LINK B T 3") == "ERROR invalid side\n");
+
+    const auto stats = server.handle("STATS");
+    REQUIRE_THAT(stats, Catch::Matchers::ContainsSubstring("query count=5 "));
+    REQUIRE_THAT(stats, Catch::Matchers::ContainsSubstring("update count=9 "));
+    REQUIRE(stats.ends_with("OK\n"));
+}
+
+TEST_CASE("scale_server answers imbalance queries as weights change", "[scale_server][imbalance]") {
+    scale_server server{make_graph("A,B,3\nB,1,C\nC,4,2\nD,1,9\n")};
+    REQUIRE(server.handle("TOP 10") == "A,16\nD,8\nB,8\nC,2\nOK\n");
+    REQUIRE(server.handle("ABOVE 2 C") == "B,8\nA,16\nOK\n");
+    REQUIRE(server.handle("RANGE 2 8 D") == "D,8\nOK\n");
+
+    REQUIRE(server.handle("SET C,4,10") == "OK\n");
+    REQUIRE(server.handle("TOP 2 A") == "A,40\nB,20\nOK\n");
+    REQUIRE(server.handle("LINK C D left") == "OK\n");
+    REQUIRE(server.handle("TOP 5 D") == "D,12\nC,6\nOK\n");
+    REQUIRE(server.handle("ABOVE 0 A") == "B,1\nOK\n");
+
+    REQUIRE(server.handle("ABOVE x") == "ERROR invalid mass\n");
+    REQUIRE(server.handle("RANGE 1 99999999999") == "ERROR invalid mass\n");
+    REQUIRE(server.handle("TOP -1") == "ERROR invalid count\n");
+    REQUIRE(server.handle("TOP 1 Z") == "ERROR unknown scale\n");
+}
+
+TEST_CASE("change_hub coalesces records per scale and routes them by subtree", "[subscriptions]") {
+    auto graph = make_graph("A,B,1\nB,C,2\nC,1,1\nD,1,3\n");
+    graph.journal_changes(true);
+    change_hub hub{std::chrono::hours{1}}; // only explicit flushes deliver
+    std::vector<std::string> exact, subtree, all;
+    const auto e = hub.connect([&](std::span<const std::string> r) { exact.insert(exact.end(), r.begin(), r.end()); });
+    const auto s = hub.connect([&](std::span<const std::string> r) { subtree.insert(subtree.end(), r.begin(), r.end()); });
+    const auto a = hub.connect([&](std::span<const std::string> r) { all.insert(all.end(), r.begin(), r.end()); });
+    REQUIRE(hub.watch(e, "C", false));
+    REQUIRE(hub.watch(s, "B", true));
+    REQUIRE(hub.watch_all(a));
+
+    // Three edits within one window leave one record per scale, in first-touch order
+    for (const auto* sides : {"1,2", "1,4", "5,4"}) {
+        const auto fields = parse_fields(std::string{"C,"} + sides);
+        REQUIRE(graph.set(*graph.find("C"), std::span{fields}.subspan(1)));
+        hub.collect(graph, graph.take_changes());
+    }
+    const auto fields = parse_fields("D,2,3");
+    REQUIRE(graph.set(*graph.find("D"), std::span{fields}.subspan(1)));
+    hub.collect(graph, graph.take_changes());
+    REQUIRE(exact.empty());
+    hub.flush();
+    REQUIRE(exact == std::vector<std::string>{"CHANGE C,0,1"});
+    REQUIRE(subtree == std::vector<std::string>{"CHANGE C,0,1", "CHANGE B,0,9"});
+    REQUIRE(all == std::vector<std::string>{"CHANGE C,0,1", "CHANGE B,0,9", "CHANGE A,0,22", "CHANGE D,1,0"});
+
+    // A removed scale reaches the watchers of itself and of the subtrees it hung in
+    exact.clear();
+    subtree.clear();
+    graph.remove(*graph.find("C"));
+    hub.collect(graph, graph.take_changes());
+    hub.flush();
+    REQUIRE(exact == std::vector<std::string>{"REMOVED C"});
+    REQUIRE(subtree == std::vector<std::string>{"CHANGE B,2,0", "REMOVED C"});
+
+    REQUIRE(hub.unwatch(e, "C"));
+    REQUIRE_FALSE(hub.unwatch(e, "C"));
+    hub.disconnect(s);
+    REQUIRE_FALSE(hub.watch(s, "B", true));
+}
+
+TEST_CASE("change_hub keeps broadcasts apart from scale records and in order", "[subscriptions]") {
+    auto graph = make_graph("RELOADED,1,2\nB,3,4\n");
+    graph.journal_changes(true);
+    change_hub hub{std::chrono::hours{1}};
+    std::vector<std::string> all;
+    REQUIRE(hub.watch_all(hub.connect([&](std::span<const std::string> r) { all.insert(all.end(), r.begin(), r.end()); })));
+    auto set = [&](const char* line) {
+        const auto fields = parse_fields(line);
+        REQUIRE(graph.set(*graph.find(fields.front()), std::span{fields}.subspan(1)));
+        hub.collect(graph, graph.take_changes());
+    };
+
+    // A scale named like the broadcast keeps its record, and changes after the broadcast
+    // arrive after it rather than in the slots queued before it
+    set("RELOADED,1,5");
+    set("B,3,6");
+    hub.broadcast("RELOADED");
+    set("RELOADED,2,5");
+    set("B,3,7");
+    hub.flush();
+    REQUIRE(all == std::vector<std::string>{"CHANGE RELOADED,4,0", "CHANGE B,3,0", "RELOADED",
+                                            "CHANGE RELOADED,3,0", "CHANGE B,4,0"});
+}
+
+TEST_CASE("scale_server pushes subscribed changes onto the client stream and a capture file", "[scale_server][subscriptions]") {
+    const auto cdc = std::filesystem::temp_directory_path() / "scaleblancer_cdc_test.txt";
+    std::filesystem::remove(cdc);
+    {
+        scale_server server{make_graph("A,B,10\nB,1,2\n")};
+        REQUIRE(server.capture_changes(cdc.string()));
+        REQUIRE(server.handle("SUBSCRIBE A") == "ERROR no push channel\n");
+
+        std::istringstream in{"SUBSCRIBE A subtree\nSET B,5,2\nUNSUBSCRIBE A\nSET B,1,1\nUNSUBSCRIBE A\nSUBSCRIBE A x\n"};
+        std::ostringstream out;
+        server.serve(in, out);
+        REQUIRE(out.str() == "OK\nCHANGE B,0,3\nCHANGE A,0,1\nOK\nOK\nOK\nERROR not subscribed\nERROR invalid subscription\n");
+    }
+    std::ifstream file{cdc};
+    std::vector<std::string> records;
+    for (std::string line; std::getline(file, line);) records.push_back(line.substr(line.find(' ') + 1));
+    REQUIRE(records == std::vector<std::string>{"CHANGE B,0,3", "CHANGE A,0,1", "CHANGE B,0,0", "CHANGE A,7,0"});
+    std::filesystem::remove(cdc);
+}
+
+TEST_CASE("scale_server reloads the whole graph in the background and swaps it in", "[scale_server][reload]") {
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto text = dir / "scaleblancer_reload_test.csv";
+    const auto topology = dir / "scaleblancer_reload_test.topo";
+    std::string big;
+    for (const auto& line : scale_input_lines(make_random_tree(20000, 5))) big += line + '\n';
+    {
+        std::ofstream{text} << big;
+        std::ofstream topo{topology, std::ios::binary};
+        REQUIRE(write_topology(topo, make_graph("T,1,4\n").scales(), mass_format{}));
+    }
+
+    scale_server server{make_graph("A,B,10\nB,1,2\n")};
+    REQUIRE(server.handle("RELOAD") == "ERROR invalid reload\n");
+    REQUIRE(server.handle("RELOAD topology a b") == "ERROR invalid reload\n");
+    REQUIRE(server.handle("RELOAD " + text.string()) == "OK\n");
+    // Queries keep being answered while the new graph loads, from one graph or the other
+    const auto during = server.handle("GET A");
+    REQUIRE((during == "A,5,0\n" || during == "ERROR unknown scale\n"));
+    REQUIRE(server.wait_for_reload());
+    REQUIRE(server.scale_count() == 20000);
+    REQUIRE(server.handle("GET A") == "ERROR unknown scale\n");
+    REQUIRE(server.handle("REPORT") == balanced_report(big) + "OK\n");
+
+    REQUIRE(server.handle("RELOAD topology " + topology.string()) == "OK\n");
+    REQUIRE(server.wait_for_reload());
+    REQUIRE(server.handle("GET T") == "T,3,0\n");
+
+    REQUIRE(server.handle("RELOAD " + (dir / "scaleblancer_missing.csv").string()) == "OK\n");
+    REQUIRE_FALSE(server.wait_for_reload());
+    REQUIRE(server.handle("GET T") == "T,3,0\n");
+    REQUIRE_THAT(server.handle("STATS"), Catch::Matchers::ContainsSubstring("reload count=2 failed=1 running=0 "));
+
+    std::filesystem::remove(text);
+    std::filesystem::remove(topology);
+}
+
+TEST_CASE("scale_server compacts in the background and replays the edits made meanwhile", "[scale_server][compaction]") {
+    std::string input;
+    for (int i = 0; i < 1000; ++i) input += "S" + std::to_string(i) + ",1," + std::to_string(i % 7) + '\n';
+    scale_server server{make_graph(input)};
+    auto expected = make_graph(input);
+    auto edit = [&](const std::string& request) {
+        REQUIRE(server.handle(request) == "OK\n");
+        const auto fields = parse_fields(request.substr(request.find(' ') + 1));
+        if (request.starts_with("REMOVE")) expected.remove(*expected.find(fields.front()));
+        else if (request.starts_with("SET")) REQUIRE(expected.set(*expected.find(fields.front()), fields[1], fields[2]));
+        else REQUIRE(expected.add(fields.front(), fields[1], fields[2]));
+    };
+
+    // The 501st removal leaves holes in more than half of the list and starts the compaction
+    for (int i = 0; i <= 500; ++i) edit("REMOVE S" + std::to_string(i));
+    // Edits go on meanwhile, against the old graph or replayed on the compacted one
+    for (int i = 600; i < 800; ++i) {
+        edit("SET S" + std::to_string(i) + ',' + std::to_string(i % 5) + ",1");
+        std::this_thread::sleep_for(std::chrono::microseconds{20}); // lets the compaction copy the graph
+    }
+    edit("ADD N,S900,3");
+    edit("REMOVE S950");
+    server.wait_for_compaction();
+
+    REQUIRE(server.scale_count() == 499);
+    REQUIRE(server.handle("REPORT") == report_of(expected) + "OK\n");
+    REQUIRE_THAT(server.handle("STATS"), Catch::Matchers::ContainsSubstring("recompute count=1 "));
+}
+
+TEST_CASE("scale_graph keeps its memory estimate current through edits", "[scale_graph][tenants]") {
+    auto graph = make_graph("A,B,1\nB,2,3\n");
+    const auto initial = graph.memory_bytes();
+    REQUIRE(initial > 2 * sizeof(Scale));
+    REQUIRE(graph.add("C_with_a_name_too_long_for_small_strings", "1", "2"));
+    const auto grown = graph.memory_bytes();
+    REQUIRE(grown > initial + sizeof(Scale));
+    graph.remove(*graph.find("C_with_a_name_too_long_for_small_strings"));
+    REQUIRE(graph.memory_bytes() < grown);
+}
+
+TEST_CASE("tenant_host keeps tenants apart and enforces their limits", "[tenants]") {
+    tenant_host host{2};
+    REQUIRE(host.create("acme", make_graph("A,B,10\nB,1,2\n"), {.max_scales = 3}));
+    REQUIRE(host.create("zeta", make_graph("A,1,5\n")));
+    REQUIRE_FALSE(host.create("acme", make_graph("A,1,1\n")));
+    REQUIRE_FALSE(host.create("two words", make_graph("A,1,1\n")));
+
+    // Same names, separate graphs
+    REQUIRE(host.handle("acme", "GET A") == "A,5,0\n");
+    REQUIRE(host.handle("zeta", "GET A") == "A,4,0\n");
+    REQUIRE(host.handle("zeta", "GET B") == "ERROR unknown scale\n");
+
+    REQUIRE(host.handle("acme", "ADD C,1,1") == "OK\n");
+    REQUIRE(host.handle("acme", "ADD D,1,1") == "ERROR tenant limit\n");
+    REQUIRE(host.handle("acme", "GET D") == "ERROR unknown scale\n");
+    REQUIRE(host.handle("zeta", "ADD D,1,1") == "OK\n");
+
+    const auto acme = host.usage("acme");
+    REQUIRE(acme);
+    REQUIRE(acme->scales == 3);
+    REQUIRE(acme->requests == 4);
+    REQUIRE(acme->rejected == 1);
+    // The tenant's one shared set of latency histograms is part of its memory
+    REQUIRE(acme->memory_bytes > latency_stats{latency_recording::shared}.memory_bytes());
+    REQUIRE(host.usage("zeta")->scales == 2);
+
+    REQUIRE(host.drop("zeta"));
+    REQUIRE_FALSE(host.usage("zeta"));
+    REQUIRE(host.handle("zeta", "GET A") == "ERROR unknown tenant\n");
+    REQUIRE(host.tenants() == std::vector<std::string>{"acme"});
+
+    std::istringstream in{"acme GET A\nnobody GET A\nTENANTS\n"};
+    std::ostringstream out;
+    host.serve(in, out);
+    REQUIRE_THAT(out.str(), Catch::Matchers::StartsWith("A,5,0\nERROR unknown tenant\nacme scales=3 "));
+    REQUIRE(out.str().ends_with(" rejected=1 cpu_ns=" + std::to_string(host.usage("acme")->cpu.count()) + "\nOK\n"));
+}
+
+TEST_CASE("tenant_host reloads a tenant on the pool and within its limits", "[tenants][reload]") {
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto small = dir / "scaleblancer_tenant_small.csv";
+    const auto big = dir / "scaleblancer_tenant_big.csv";
+    std::ofstream{small} << "X,Y,1\nY,2,3\nZ,1,1\n";
+    std::ofstream{big} << "A,B,1\nB,C,1\nC,D,1\nD,E,1\nE,F,1\nF,1,1\n";
+
+    tenant_host host{1};
+    REQUIRE(host.create("acme", make_graph("A,1,1\n"), {.max_scales = 5}));
+    auto reloaded = [&] {
+        for (;;) {
+            const auto stats = host.handle("acme", "STATS");
+            if (stats.find(" running=0 ") != std::string::npos) return stats;
+        }
+    };
+
+    REQUIRE(host.handle("acme", "RELOAD " + big.string()) == "OK\n");
+    REQUIRE_THAT(reloaded(), Catch::Matchers::ContainsSubstring("reload count=0 failed=1 "));
+    REQUIRE(host.handle("acme", "GET A") == "A,0,0\n");
+    REQUIRE(host.usage("acme")->rejected == 1);
+
+    REQUIRE(host.handle("acme", "RELOAD " + small.string()) == "OK\n");
+    REQUIRE_THAT(reloaded(), Catch::Matchers::ContainsSubstring("reload count=1 failed=1 "));
+    REQUIRE(host.handle("acme", "GET Y") == "Y,1,0\n");
+    REQUIRE(host.usage("acme")->scales == 3);
+
+    std::filesystem::remove(small);
+    std::filesystem::remove(big);
+}
+
+TEST_CASE("tenant_host runs a newly busy tenant ahead of another tenant's backlog", "[tenants]") {
+    tenant_host host{1};
+    REQUIRE(host.create("busy", scale_graph{make_random_tree(2000, 3)}));
+    REQUIRE(host.create("quiet", make_graph("A,1,5\n")));
+
+    std::vector<std::future<std::string>> backlog;
+    for (int i = 0; i < 500; ++i) backlog.push_back(host.submit("busy", "REPORT"));
+    REQUIRE(host.handle("quiet", "GET A") == "A,4,0\n");
+    // At most the request running when quiet's arrived ran in between
+    REQUIRE(backlog.back().wait_for(std::chrono::seconds{0}) != std::future_status::ready);
+    for (auto& response : backlog) REQUIRE(response.get().ends_with("OK\n"));
+    REQUIRE(host.usage("busy")->cpu > host.usage("quiet")->cpu);
+}
+
+TEST_CASE("Synthetic random trees and forests have the requested size and shape", "[engine]") {
+    const auto random = make_random_tree(1000, 7);
+    REQUIRE(random.size() == 1000);
+    const auto random_shape = profile_shape(random);
+    REQUIRE(random_shape.width.back() == 1);
+    REQUIRE(random_shape.depth() > 2);
+    REQUIRE(random_shape.depth() < 100);
+    REQUIRE(scale_input_lines(make_random_tree(1000, 7)) == scale_input_lines(random));
+
+    const auto forest = make_forest(1000, 8);
+    REQUIRE(forest.size() == 1000);
+    const auto forest_shape = profile_shape(forest);
+    REQUIRE(forest_shape.width.back() == 8);
+
+    // Shapes meant for balancing stay shallow enough for int masses
+    REQUIRE(profile_shape(make_random_tree(1 << 17, 11)).depth() == synthetic_depth_limit);
+    const auto chains = profile_shape(make_chains(100, synthetic_depth_limit));
+    REQUIRE(chains.depth() == synthetic_depth_limit);
+    REQUIRE(chains.root_count == 5);
+}
+
+TEST_CASE("Scale input lines parse back into the same scales", "[scaling]") {
+    for (const auto shape : all_scaling_shapes) {
+        auto scales = make_scaling_input(shape, 300, 3);
+        const auto lines = scale_input_lines(scales);
+        std::string text;
+        for (const auto& line : lines) text += line;
+        std::istringstream in{text};
+        std::vector<scale_wrapper> parsed;
+        parse_scales(in, parsed);
+
+        // Scales named on a side before their own line are listed where they are first named.
+        auto by_name = [](const auto& a, const auto& b) { return a->name < b->name; };
+        std::ranges::sort(scales, by_name);
+        std::ranges::sort(parsed, by_name);
+        balance_each_scale(scales);
+        balance_each_scale(parsed);
+        std::ostringstream expected, actual;
+        report_changes(expected, scales);
+        report_changes(actual, parsed);
+        REQUIRE(actual.str() == expected.str());
+    }
+}
+
+TEST_CASE("Scaling sweep reports every thread count for both scaling modes", "[scaling]") {
+    scaling_config config;
+    config.max_threads = 3;
+    config.scales = 200;
+    config.repetitions = 1;
+    config.shapes = {scaling_shape::binary, scaling_shape::forest};
+
+    std::vector<scaling_point> points;
+    run_scaling(config, [&](const scaling_point& point) { points.push_back(point); });
+    REQUIRE(points.size() == 2 * 2 * 3 * 3);
+    for (const auto& point : points) {
+        REQUIRE(point.scales == (point.weak ? 200 * point.threads : 200));
+        REQUIRE(point.depth == profile_shape(make_scaling_input(point.shape, point.scales, config.seed)).depth());
+        REQUIRE(point.seconds > 0);
+        if (point.threads == 1) REQUIRE(point.speedup == 1);
+        REQUIRE(std::abs(point.efficiency - point.speedup / point.threads) < 1e-9);
+    }
+
+    config.max_threads = 1;
+    config.order = false;
+    config.balance = false;
+    std::ostringstream csv;
+    write_scaling_csv(csv, config);
+    REQUIRE(csv.str().starts_with(std::string{scaling_csv_header} + "\nstrong,parse,binary,8,1,200,"));
+    REQUIRE(std::ranges::count(csv.str(), '\n') == 1 + 2 * 2);
+}
+
+namespace {
+
+/// Report of the scale graph for @p input, balanced by the sequential engine.
+std::string graph_report(const std::string& input, const mass_format& format = {}) {
+    std::istringstream iss(input);
+    std::vector<scale_wrapper> scales;
+    parse_scales(iss, scales, format);
+    balance_with(scales, profile_shape(scales), {});
+    std::ostringstream out;
+    report_changes(out, scales, format);
+    return out.str();
+}
+
+/// Report of a pipeline for @p input, given in two parts to exercise repeated parse() calls.
+template <typename Pipeline, typename... Policies>
+std::string pipeline_report(const std::string& first, const std::string& second, const mass_format& format,
+                            Policies... policies) {
+    Pipeline pipeline{format, policies...};
+    std::istringstream in1(first), in2(second);
+    pipeline.parse(in1);
+    pipeline.parse(in2);
+    REQUIRE(pipeline.balance());
+    std::ostringstream out;
+    pipeline.report(out);
+    return out.str();
+}
+
+} // namespace
+
+TEST_CASE("Policy pipelines report exactly what the scale graph reports", "[pipeline]") {
+    const std::string first = "# redefinitions, wide scales, blanks and invalid lines\n"
+                              "Top, Tri ,B,4\nTri,1,2,3\n\nB,,9\nBad,Bad,1\n,1,2\nB,C,,\nTri,99999999999,1\n";
+    const std::string second = "C,5,6,7,8\nTop,,,,1\nD,E E,3\n";
+    for (const auto decimals : {0u, 2u}) {
+        const mass_format format{decimals};
+        const auto expected = graph_report(first + second, format);
+        REQUIRE(pipeline_report<minimal_pipeline>(first, second, format) == expected);
+        REQUIRE(pipeline_report<scale_pipeline<wide_mass, interned_names>>(first, second, format) == expected);
+        REQUIRE(pipeline_report<checked_pipeline>(first, second, format, metrics_instrumentation{},
+                                                  level_engine{3}) == expected);
+    }
+
+    std::string random_tree;
+    for (const auto& line : scale_input_lines(make_random_tree(5000, 7))) random_tree += line;
+    REQUIRE(pipeline_report<scale_pipeline<int_mass, hashed_names, arena_allocation, no_instrumentation, level_engine>>(
+                random_tree, "", {}, no_instrumentation{}, level_engine{4}) == graph_report(random_tree));
+}
+
+TEST_CASE("Mass policies check or widen totals that overflow int", "[pipeline][edge]") {
+    std::string chain = "S0,2000000000,1\n";
+    for (int i = 1; i < 4; ++i) chain += "S" + std::to_string(i) + ",S" + std::to_string(i - 1) + ",1\n";
+
+    run_metrics metrics;
+    checked_pipeline checked{{}, {&metrics}, {1}};
+    std::istringstream in(chain);
+    checked.parse(in);
+    REQUIRE_FALSE(checked.balance());
+    REQUIRE(metrics.total(run_counter::rows_parsed) == 4);
+
+    scale_pipeline<wide_mass> wide;
+    std::istringstream wide_in(chain);
+    wide.parse(wide_in);
+    REQUIRE(wide.balance());
+    std::ostringstream out;
+    wide.report(out);
+    REQUIRE(out.str() == "S0,0,1999999999\nS1,0,4000000000\nS2,0,8000000002\nS3,0,16000000006\n");
+}
+
+#if SCALEBLANCER_HAS_ZLIB
+namespace {
+
+/// Decompresses every gzip member of @p compressed, counting them into @p members.
+std::string gunzip(const std::string& compressed, int& members) {
+    z_stream z{};
+    REQUIRE(inflateInit2(&z, 15 + 16) == Z_OK);
+    std::string out;
+    std::array<char, 4096> chunk;
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+    z.avail_in = static_cast<uInt>(compressed.size());
+    members = 0;
+    while (z.avail_in > 0) {
+        z.next_out = reinterpret_cast<Bytef*>(chunk.data());
+        z.avail_out = chunk.size();
+        const auto status = inflate(&z, Z_NO_FLUSH);
+        REQUIRE((status == Z_OK || status == Z_STREAM_END));
+        out.append(chunk.data(), chunk.size() - z.avail_out);
+        if (status == Z_STREAM_END) {
+            ++members;
+            inflateReset(&z);
+        }
+    }
+    inflateEnd(&z);
+    return out;
+}
+
+} // namespace
+
+TEST_CASE("Parallel gzip output decompresses to the written bytes, in order", "[gzip]") {
+    std::string text;
+    for (int i = 0; i < 20000; ++i) text += "S" + std::to_string(i) + "," + std::to_string(i * 7 % 13) + ",0\n";
+
+    for (const unsigned threads : {1u, 3u}) {
+        std::ostringstream compressed;
+        {
+            parallel_gzip_streambuf gzip{compressed, threads, {1, 4096}};
+            std::ostream os{&gzip};
+            os << text.substr(0, 1000);
+            os.flush(); // passes on finished members without cutting a block
+            os << text.substr(1000);
+            REQUIRE(gzip.close());
+        }
+        int members = 0;
+        REQUIRE(gunzip(compressed.str(), members) == text);
+        REQUIRE(members == static_cast<int>((text.size() + 4095) / 4096));
+    }
+
+    std::vector<std::string> args{"--gzip-level", "9"};
+    std::vector<char*> argv{args[0].data(), args[1].data()};
+    const auto opts = parse_options(argv);
+    REQUIRE((opts && opts->gzip && opts->compression.level == 9));
+    args[1] = "0";
+    argv[1] = args[1].data();
+    REQUIRE_FALSE(parse_options(argv));
+
+    // Modes that write plain text to stdout cannot be compressed
+    for (const auto& mode : std::vector<std::vector<std::string>>{
+             {"--root", "B"}, {"--lca", "A", "B"}, {"--serve"}, {"--load-topology", "t.bin", "--lookup", "A"}}) {
+        std::vector<std::string> plain{"--gzip"};
+        plain.insert(plain.end(), mode.begin(), mode.end());
+        std::vector<char*> plain_argv;
+        for (auto& arg : plain) plain_argv.push_back(arg.data());
+        REQUIRE_FALSE(parse_options(plain_argv));
+    }
+
+    std::ostringstream empty;
+    REQUIRE(parallel_gzip_streambuf{empty, 2}.close());
+    int members = 0;
+    REQUIRE(gunzip(empty.str(), members).empty());
+    REQUIRE(members == 1);
+}
+#endif